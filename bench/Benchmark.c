@@ -0,0 +1,444 @@
+// Headless benchmark for cpSpaceStep().
+//
+// Builds a handful of canonical scenes at a given body count, steps them a
+// fixed number of frames and reports the time per step and the peak heap.
+// Lives outside of src/ so the Pebble build doesn't pick up main().
+//
+// Build and run from the repository root:
+//   cc -std=gnu99 -O2 -Isrc/chipmunk -o cpbench bench/Benchmark.c src/chipmunk/cp*.c src/chipmunk/chipmunk.c -lm
+//   ./cpbench                        (every scene at 10, 100, ... 100000 bodies)
+//   ./cpbench circles 10000 300      (one scene, body count and frame count)
+//   ./cpbench all 1000 100 tree      (use cpBBTrees instead of spatial hashes)
+//   ./cpbench all 1000 100 sap       (sort and sweep for the active shapes)
+//   ./cpbench all 1000 100 inc       (incrementally rehashed active hash)
+//   ./cpbench all 1000 100 auto      (default hash sizes, tuned while stepping)
+//   ./cpbench all 1000 100 sleep     (let resting islands fall asleep)
+//   ./cpbench all 1000 100 cache     (reuse the contacts of pairs that barely moved)
+//   ./cpbench all 1000 100 hash 4    (4 threads, add -DCP_USE_PTHREADS -pthread)
+//   ./cpbench stacks 1000 300 hash 1 100000
+//                                    (move the scene 100000 units from the origin)
+//
+// Peak heap is the process high water mark from getrusage(), so run one scene
+// per process when comparing memory use.
+//
+// Add -DCP_STEP_STATS to the command line to print a per phase breakdown.
+// Add -DCP_USE_FIXED to run the scenes on 16.16 fixed point. Keep the body
+// counts small there, the larger scenes reach past the 32768 unit range.
+// Add -DCP_USE_DOUBLE to run them on doubles. Comparing a float and a double
+// build with a large offset shows the precision lost far from the origin.
+// With an offset, the RMS speed of the bodies after the last step is printed.
+// Scenes that should be at rest by then show float jitter there.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "chipmunk.h"
+
+#define DEFAULT_FRAMES 100
+#define DT CP_FLOAT(1.0f/60.0f)
+
+typedef struct benchScene {
+	const char *name;
+	// Fills the space with roughly 'count' bodies.
+	void (*init)(cpSpace *space, cpBody *staticBody, int count);
+} benchScene;
+
+// Scene geometry is laid out in plain floats and converted at the API
+// boundary so the same scenes run in a CP_USE_FIXED build.
+static cpVect
+vf(float x, float y)
+{
+	return cpv(cpffromdouble(x), cpffromdouble(y));
+}
+
+static void
+addStaticSegment(cpSpace *space, cpBody *staticBody, cpVect a, cpVect b, float r)
+{
+	cpShape *shape = cpSegmentShapeNew(staticBody, a, b, cpffromdouble(r));
+	shape->e = CP_FLOAT(1.0f); shape->u = CP_FLOAT(1.0f);
+	cpSpaceAddStaticShape(space, shape);
+}
+
+static cpBody *
+addPoly(cpSpace *space, int num, cpVect *verts, cpVect p, float a, float e, float u)
+{
+	cpBody *body = cpBodyInit(cpSpaceAllocBody(space), CP_FLOAT(1.0f), cpMomentForPoly(CP_FLOAT(1.0f), num, verts, cpvzero));
+	body->p = p;
+	cpBodySetAngle(body, cpffromdouble(a));
+	cpSpaceAddBody(space, body);
+
+	cpShape *shape = (cpShape *)cpPolyShapeInit(cpSpaceAllocPolyShape(space, num), body, num, verts, cpvzero);
+	shape->e = cpffromdouble(e); shape->u = cpffromdouble(u);
+	cpSpaceAddShape(space, shape);
+
+	return body;
+}
+
+static cpBody *
+addCircle(cpSpace *space, float r, cpVect p, float e, float u)
+{
+	cpBody *body = cpBodyInit(cpSpaceAllocBody(space), CP_FLOAT(1.0f), cpMomentForCircle(CP_FLOAT(1.0f), CP_FLOAT(0.0f), cpffromdouble(r), cpvzero));
+	body->p = p;
+	cpSpaceAddBody(space, body);
+
+	cpShape *shape = (cpShape *)cpCircleShapeInit(cpSpaceAllocCircleShape(space), body, cpffromdouble(r), cpvzero);
+	shape->e = cpffromdouble(e); shape->u = cpffromdouble(u);
+	cpSpaceAddShape(space, shape);
+
+	return body;
+}
+
+// Demo5 style domino pyramids. Rows of standing planks capped with lying ones.
+// Pyramids are placed side by side until the body count is reached.
+static void
+pyramidInit(cpSpace *space, cpBody *staticBody, int count)
+{
+	cpVect verts[] = {
+		vf(-2,-15),
+		vf(-2, 15),
+		vf( 2, 15),
+		vf( 2,-15),
+	};
+
+	// Number of rows in each pyramid. Each row i holds 2i - 1 bodies.
+	int rows = 1;
+	while(rows < 14 && (rows + 1)*(rows + 1) <= count) rows++;
+	int perPyramid = rows*rows;
+	int pyramids = (count + perPyramid - 1)/perPyramid;
+
+	float width = rows*30.0f + 60.0f;
+	addStaticSegment(space, staticBody, vf(-30, 160), vf(pyramids*width, 160), 0.0f);
+
+	int added = 0;
+	for(int k=0; k<pyramids; k++){
+		float x0 = k*width;
+		for(int i=0; i<rows && added<count; i++){
+			float y = 145 - 36*i;
+			int standing = rows - i;
+			for(int j=0; j<standing && added<count; j++){
+				float x = x0 + (i + 2*j)*15;
+				addPoly(space, 4, verts, vf(x, y), 0.0f, 0.0f, 0.6f); added++;
+
+				if(j == standing - 1 || added == count) continue;
+				addPoly(space, 4, verts, vf(x + 15, y - 17), M_PI/2.0f, 0.0f, 0.6f); added++;
+			}
+		}
+	}
+}
+
+// Demo42 style falling triangles between two walls.
+static void
+trianglesInit(cpSpace *space, cpBody *staticBody, int count)
+{
+	cpVect verts[] = {
+		vf( 5, 0),
+		vf(-5, 0),
+		vf( 0, 5),
+	};
+
+	int cols = 1;
+	while(cols*cols < count) cols++;
+
+	float spacing = 12.0f;
+	float w = cols*spacing + 16.0f;
+	float floor = 160.0f;
+	float top = floor - (count/cols + 2)*spacing;
+	addStaticSegment(space, staticBody, vf(-20, floor), vf(w, floor), 8.0f);
+	addStaticSegment(space, staticBody, vf(-8, top), vf(-8, floor), 8.0f);
+	addStaticSegment(space, staticBody, vf(w, top), vf(w, floor), 8.0f);
+
+	for(int i=0; i<count; i++){
+		cpVect p = vf((i%cols)*spacing + 8.0f, floor - 12.0f - (i/cols)*spacing);
+		addPoly(space, 3, verts, p, 0.0f, 0.5f, 0.5f);
+	}
+}
+
+// A loose pile of circles dropped onto a floor.
+static void
+circlesInit(cpSpace *space, cpBody *staticBody, int count)
+{
+	int cols = 1;
+	while(cols*cols < count) cols++;
+
+	float r = 5.0f;
+	float spacing = 2.0f*r + 1.0f;
+	addStaticSegment(space, staticBody, vf(-100, 160), vf(cols*spacing + 100, 160), 0.0f);
+
+	for(int i=0; i<count; i++){
+		// Stagger every other row so the pile doesn't stack perfectly.
+		int row = i/cols;
+		float x = (i%cols)*spacing + (row&1)*r;
+		addCircle(space, r, vf(x, 160 - r - row*spacing), 0.0f, 0.7f);
+	}
+}
+
+// Square polys rattling around inside a closed box made of segments.
+static void
+boxesInit(cpSpace *space, cpBody *staticBody, int count)
+{
+	cpVect verts[] = {
+		vf(-4,-4),
+		vf(-4, 4),
+		vf( 4, 4),
+		vf( 4,-4),
+	};
+
+	int cols = 1;
+	while(cols*cols < count) cols++;
+
+	float spacing = 12.0f;
+	float size = cols*spacing + 24.0f;
+	addStaticSegment(space, staticBody, vf(0, 0), vf(size, 0), 2.0f);
+	addStaticSegment(space, staticBody, vf(size, 0), vf(size, size), 2.0f);
+	addStaticSegment(space, staticBody, vf(size, size), vf(0, size), 2.0f);
+	addStaticSegment(space, staticBody, vf(0, size), vf(0, 0), 2.0f);
+
+	for(int i=0; i<count; i++){
+		cpVect p = vf((i%cols)*spacing + 12.0f, size - 12.0f - (i/cols)*spacing);
+		cpBody *body = addPoly(space, 4, verts, p, i*0.1f, 0.9f, 0.2f);
+		body->v = vf((i*37%100) - 50.0f, (i*61%100) - 50.0f);
+	}
+}
+
+// Short stacks of boxes that settle quickly. Mostly resting debris.
+static void
+stacksInit(cpSpace *space, cpBody *staticBody, int count)
+{
+	cpVect verts[] = {
+		vf(-5,-5),
+		vf(-5, 5),
+		vf( 5, 5),
+		vf( 5,-5),
+	};
+
+	int height = 4;
+	int stacks = (count + height - 1)/height;
+	addStaticSegment(space, staticBody, vf(-20, 160), vf(stacks*20.0f, 160), 0.0f);
+
+	for(int i=0; i<count; i++){
+		cpVect p = vf((i/height)*20.0f, 155.0f - (i%height)*10.0f);
+		addPoly(space, 4, verts, p, 0.0f, 0.0f, 0.8f);
+	}
+}
+
+// Convex hulls with 8 to 12 vertexes tumbling inside a closed box.
+// Mostly poly to poly collisions between shapes with many axes.
+static void
+hullsInit(cpSpace *space, cpBody *staticBody, int count)
+{
+	int cols = 1;
+	while(cols*cols < count) cols++;
+
+	float spacing = 14.0f;
+	float size = cols*spacing + 24.0f;
+	addStaticSegment(space, staticBody, vf(0, 0), vf(size, 0), 2.0f);
+	addStaticSegment(space, staticBody, vf(size, 0), vf(size, size), 2.0f);
+	addStaticSegment(space, staticBody, vf(size, size), vf(0, size), 2.0f);
+	addStaticSegment(space, staticBody, vf(0, size), vf(0, 0), 2.0f);
+
+	for(int i=0; i<count; i++){
+		// Clockwise winding like the boxes. Stretched so they don't roll like circles.
+		int num = 8 + i%5;
+		cpVect verts[12];
+		for(int j=0; j<num; j++){
+			float a = -2.0f*M_PI*j/num;
+			verts[j] = vf(6.0f*cosf(a), 4.0f*sinf(a));
+		}
+
+		cpVect p = vf((i%cols)*spacing + 12.0f, size - 12.0f - (i/cols)*spacing);
+		cpBody *body = addPoly(space, num, verts, p, i*0.1f, 0.5f, 0.5f);
+		body->v = vf((i*37%100) - 50.0f, (i*61%100) - 50.0f);
+	}
+}
+
+static const benchScene scenes[] = {
+	{"pyramid", pyramidInit},
+	{"triangles", trianglesInit},
+	{"circles", circlesInit},
+	{"boxes", boxesInit},
+	{"stacks", stacksInit},
+	{"hulls", hullsInit},
+};
+static const int numScenes = sizeof(scenes)/sizeof(*scenes);
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// Process high water mark in kilobytes.
+static long
+peakHeapKB(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss/1024;
+#else
+	return usage.ru_maxrss;
+#endif
+}
+
+#ifdef CP_STEP_STATS
+static const char *phaseNames[CP_NUM_PHASES] = {
+	"contact reject",
+	"integrate velocity",
+	"cache BBs",
+	"active to static",
+	"query rehash",
+	"prestep",
+	"solve",
+	"integrate position",
+	"sleep",
+};
+
+static void
+printStepStats(cpSpace *space)
+{
+	const cpSpaceStepStats *stats = cpSpaceGetStepStats(space);
+
+	for(int i=0; i<CP_NUM_PHASES; i++){
+		double avg = stats->totalPhaseTime[i]/stats->steps;
+		printf("    %-20s %12.0f ns %5.1f%%\n", phaseNames[i], avg*1e9, 100.0*avg*stats->steps/stats->totalStepTime);
+	}
+
+	printf("    last step: %d pairs, %d narrow phase, %d collisions, %d arbiters, %d contacts\n",
+		stats->pairs, stats->narrowPhase, stats->collisions, stats->arbiters, stats->contacts);
+	if(stats->narrowPhase)
+		printf("    pair cache: %d hits, %.1f%% of the narrow phase\n",
+			stats->pairCacheHits, 100.0*stats->pairCacheHits/stats->narrowPhase);
+
+	printf("    step time histogram (us):");
+	for(int i=0; i<CP_STEP_STATS_BUCKETS; i++)
+		if(stats->histogram[i]) printf(" <%d:%d", 1<<i, stats->histogram[i]);
+	printf("\n");
+}
+#endif
+
+// Root mean square speed of the awake bodies.
+static double
+rmsSpeed(cpSpace *space)
+{
+	cpArray *bodies = space->bodies;
+	if(!bodies->num) return 0.0;
+
+	double sum = 0.0;
+	for(int i=0; i<bodies->num; i++){
+		cpBody *body = (cpBody *)bodies->arr[i];
+		double vx = cpftodouble(body->v.x), vy = cpftodouble(body->v.y);
+		sum += vx*vx + vy*vy;
+	}
+
+	return sqrt(sum/bodies->num);
+}
+
+static void
+runScene(const benchScene *scene, int count, int frames, const char *indexType, int threads, double offset)
+{
+	cpBody *staticBody = cpBodyNew(CP_INFINITY, CP_INFINITY);
+
+	cpSpace *space = cpSpaceNew();
+	space->gravity = vf(0, 300);
+	cpSpaceSetThreads(space, threads);
+	// Keep the number of cells proportional to the number of shapes
+	// so the large scenes don't degrade into chain scans.
+	if(!strcmp(indexType, "tree")){
+		cpSpaceUseBBTree(space);
+	} else if(!strcmp(indexType, "sleep")){
+		cpSpaceResizeActiveHash(space, CP_FLOAT(20.0f), count*4);
+		cpSpaceResizeStaticHash(space, CP_FLOAT(20.0f), count > 1000 ? count : 1000);
+		space->sleepTicks = 30;
+	} else if(!strcmp(indexType, "auto")){
+		space->hashTuneTicks = 10;
+	} else if(!strcmp(indexType, "sap")){
+		cpSpaceSetActiveIndex(space, (cpSpatialIndex *)cpSweepAndPruneNew(NULL));
+		cpSpaceResizeStaticHash(space, CP_FLOAT(20.0f), count > 1000 ? count : 1000);
+	} else {
+		cpSpaceResizeActiveHash(space, CP_FLOAT(20.0f), count*4);
+		cpSpaceResizeStaticHash(space, CP_FLOAT(20.0f), count > 1000 ? count : 1000);
+		if(!strcmp(indexType, "inc")) cpSpaceHashSetIncremental((cpSpaceHash *)space->activeShapes, 1);
+		if(!strcmp(indexType, "cache")) space->pairCacheTolerance = CP_FLOAT(0.01f);
+	}
+
+	// Static shapes are placed relative to the static body, so moving it
+	// first moves them too. The dynamic bodies are moved afterwards.
+	staticBody->p = cpv(cpffromdouble(offset), cpffromdouble(offset));
+	scene->init(space, staticBody, count);
+	for(int i=0; i<space->bodies->num; i++){
+		cpBody *body = (cpBody *)space->bodies->arr[i];
+		body->p = cpvadd(body->p, staticBody->p);
+	}
+
+	double start = now();
+	for(int i=0; i<frames; i++)
+		cpSpaceStep(space, DT);
+	double elapsed = now() - start;
+
+	printf("%-10s %8d %8d %14.0f %12.1f %12ld\n",
+		scene->name, count, frames,
+		elapsed*1e9/frames, frames/elapsed, peakHeapKB());
+#ifdef CP_STEP_STATS
+	printStepStats(space);
+#endif
+	if(offset)
+		printf("    rms speed at offset %.0f: %.4f\n", offset, rmsSpeed(space));
+	if(space->sleepTicks)
+		printf("    %d bodies asleep\n", count - space->bodies->num);
+	if(!strcmp(indexType, "auto")){
+		cpSpaceHash *hash = (cpSpaceHash *)space->activeShapes;
+		printf("    tuned active hash: celldim %.1f, %d cells\n", cpftodouble(hash->celldim), hash->numcells);
+	}
+	fflush(stdout);
+
+	cpSpaceFreeChildren(space);
+	cpSpaceFree(space);
+	cpBodyFree(staticBody);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *only = (argc > 1 ? argv[1] : NULL);
+	int count = (argc > 2 ? atoi(argv[2]) : 0);
+	int frames = (argc > 3 ? atoi(argv[3]) : DEFAULT_FRAMES);
+	const char *indexType = (argc > 4 ? argv[4] : "hash");
+	int threads = (argc > 5 ? atoi(argv[5]) : 1);
+	double offset = (argc > 6 ? atof(argv[6]) : 0.0);
+
+	static const int counts[] = {10, 100, 1000, 10000, 100000};
+	int numCounts = sizeof(counts)/sizeof(*counts);
+
+	cpInitChipmunk();
+
+	printf("%-10s %8s %8s %14s %12s %12s\n", "scene", "bodies", "frames", "ns/step", "steps/sec", "peak KB");
+
+	int found = 0;
+	for(int i=0; i<numScenes; i++){
+		const benchScene *scene = &scenes[i];
+		if(only && strcmp(only, "all") && strcmp(only, scene->name)) continue;
+		found = 1;
+
+		if(count){
+			runScene(scene, count, frames, indexType, threads, offset);
+		} else {
+			for(int j=0; j<numCounts; j++)
+				runScene(scene, counts[j], frames, indexType, threads, offset);
+		}
+	}
+
+	if(!found){
+		fprintf(stderr, "Unknown scene '%s'. Use one of: all", only);
+		for(int i=0; i<numScenes; i++) fprintf(stderr, " %s", scenes[i].name);
+		fprintf(stderr, "\n");
+		return 1;
+	}
+
+	return 0;
+}
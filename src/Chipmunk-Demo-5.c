@@ -17,13 +17,13 @@ void layerUpdate(Layer *layer, GContext *ctx) {
   graphics_fill_rect(ctx, GRect(0, 0, 144, 168), 0, GCornerNone);
 
   graphics_context_set_fill_color(ctx, GColorBlack);
-	cpSpaceHashEach(space->activeShapes, &drawObject, ctx);
-	cpSpaceHashEach(space->staticShapes, &drawObject, ctx);
+	cpSpatialIndexEach(space->activeShapes, &drawObject, ctx);
+	cpSpatialIndexEach(space->staticShapes, &drawObject, ctx);
   demo5_update();
 }
 
 void drawCircleShape(GContext *ctx, cpCircleShape *circle) {
-  graphics_fill_circle(ctx, GPoint((int)circle->shape.body->p.x, (int)circle->shape.body->p.y), (int)circle->r);
+  graphics_fill_circle(ctx, GPoint(cpftoint(circle->shape.body->p.x), cpftoint(circle->shape.body->p.y)), cpftoint(circle->r));
 }
 
 void drawPolyShape(GContext *ctx, cpPolyShape *poly) {
@@ -33,7 +33,7 @@ void drawPolyShape(GContext *ctx, cpPolyShape *poly) {
   cpVect *verts = poly->verts;
   for (int i = 0; i < num_points; i++) {
     cpVect v = cpvadd(body->p, cpvrotate(verts[i], body->rot));
-    points[i] = GPoint(v.x, v.y); 
+    points[i] = GPoint(cpftoint(v.x), cpftoint(v.y));
   }
 
   GPathInfo poly_path_info = {
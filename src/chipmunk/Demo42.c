@@ -13,31 +13,31 @@ extern cpBody *staticBody;
 
 void demo42_update(void)
 {
-		cpSpaceStep(space, 1/60.0);
+		cpSpaceStep(space, CP_FLOAT(1/60.0));
 }
 
 static void addPoly(GPoint p) {
   int num = 3;
   cpVect verts[] = {
-      cpv(5, 0),
-      cpv(-5, 0),
-      cpv(0, 5)
+      cpv(CP_FLOAT(5), CP_FLOAT(0)),
+      cpv(CP_FLOAT(-5), CP_FLOAT(0)),
+      cpv(CP_FLOAT(0), CP_FLOAT(5))
   };
 
-  cpBody *body = cpBodyNew(1.0, cpMomentForPoly(1.0, num, verts, cpvzero));
-  body->p = (cpVect) {p.x, p.y};
+  cpBody *body = cpBodyNew(CP_FLOAT(1.0), cpMomentForPoly(CP_FLOAT(1.0), num, verts, cpvzero));
+  body->p = cpv(cpffromint(p.x), cpffromint(p.y));
   cpSpaceAddBody(space, body);
   cpShape *shape = cpPolyShapeNew(body, num, verts, cpvzero);
-  shape->e = 0.5; shape->u = 0.5;
+  shape->e = CP_FLOAT(0.5); shape->u = CP_FLOAT(0.5);
   cpSpaceAddShape(space, shape);
 }
 
 static cpBody *addBall(GPoint p) {
-  cpBody *body = cpBodyNew(1.0, 1.0);
-  body->p = (cpVect) {p.x, p.y};
+  cpBody *body = cpBodyNew(CP_FLOAT(1.0), CP_FLOAT(1.0));
+  body->p = cpv(cpffromint(p.x), cpffromint(p.y));
   cpSpaceAddBody(space, body);
-  cpShape *shape = cpCircleShapeNew(body, 10.0, (cpVect) {0, 0}); 
-  shape->e = 0.7;
+  cpShape *shape = cpCircleShapeNew(body, CP_FLOAT(10.0), cpvzero); 
+  shape->e = CP_FLOAT(0.7);
   cpSpaceAddShape(space, shape);
   return body;
 }
@@ -45,7 +45,7 @@ static cpBody *addBall(GPoint p) {
 void demo42_init(void)
 {
   space = cpSpaceNew();
-  space->gravity = (cpVect) {0, 300};
+  space->gravity = cpv(CP_FLOAT(0), CP_FLOAT(300));
 
   GPoint ball_points[NUM_BALLS] = {
     GPoint(55, 20),
@@ -62,24 +62,24 @@ void demo42_init(void)
     addPoly(ball_points[i]); 
   }
   
-  cpBody *staticBody = cpBodyNew(1e7, 1e7);
-  cpVect a = cpv(-20, 160);
-  cpVect b = cpv(160, 160);
-  cpShape *my_shape = cpSegmentShapeNew(staticBody, a, b, 8.0f);
-  my_shape->e = 0.8; my_shape->u = 1.0;
+  cpBody *staticBody = cpBodyNew(cpffromdouble(1e7), cpffromdouble(1e7));
+  cpVect a = cpv(CP_FLOAT(-20), CP_FLOAT(160));
+  cpVect b = cpv(CP_FLOAT(160), CP_FLOAT(160));
+  cpShape *my_shape = cpSegmentShapeNew(staticBody, a, b, CP_FLOAT(8.0f));
+  my_shape->e = CP_FLOAT(0.8); my_shape->u = CP_FLOAT(1.0);
   cpSpaceAddStaticShape(space, my_shape);
 
-  cpBody *staticBody2 = cpBodyNew(1e7, 1e7);
-  cpVect a2 = cpv(0, 0);
-  cpVect b2 = cpv(0, 188);
-  cpShape *my_shape2 = cpSegmentShapeNew(staticBody2, a2, b2, 8.0f);
-  my_shape2->e = 0.8; my_shape2->u = 1.0;
+  cpBody *staticBody2 = cpBodyNew(cpffromdouble(1e7), cpffromdouble(1e7));
+  cpVect a2 = cpv(CP_FLOAT(0), CP_FLOAT(0));
+  cpVect b2 = cpv(CP_FLOAT(0), CP_FLOAT(188));
+  cpShape *my_shape2 = cpSegmentShapeNew(staticBody2, a2, b2, CP_FLOAT(8.0f));
+  my_shape2->e = CP_FLOAT(0.8); my_shape2->u = CP_FLOAT(1.0);
   cpSpaceAddStaticShape(space, my_shape2);
 
-  cpBody *staticBody3 = cpBodyNew(1e7, 1e7);
-  cpVect a3 = cpv(144, 0);
-  cpVect b3 = cpv(144, 188);
-  cpShape *my_shape3 = cpSegmentShapeNew(staticBody3, a3, b3, 8.0f);
-  my_shape3->e = 0.8; my_shape3->u = 1.0;
+  cpBody *staticBody3 = cpBodyNew(cpffromdouble(1e7), cpffromdouble(1e7));
+  cpVect a3 = cpv(CP_FLOAT(144), CP_FLOAT(0));
+  cpVect b3 = cpv(CP_FLOAT(144), CP_FLOAT(188));
+  cpShape *my_shape3 = cpSegmentShapeNew(staticBody3, a3, b3, CP_FLOAT(8.0f));
+  my_shape3->e = CP_FLOAT(0.8); my_shape3->u = CP_FLOAT(1.0);
   cpSpaceAddStaticShape(space, my_shape3);
 }
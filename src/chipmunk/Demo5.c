@@ -26,16 +26,15 @@ extern cpBody *staticBody;
 
 void demo5_update(void)
 {
-	cpSpaceStep(space, 1/60.0);
+	cpSpaceStep(space, CP_FLOAT(1/60.0));
 }
 
 void demo5_init(void)
 {
-	staticBody = cpBodyNew(1e7, 1e7);
+	staticBody = cpBodyNew(cpffromdouble(1e7), cpffromdouble(1e7));
 	
-	cpResetShapeIdCounter();
 	space = cpSpaceNew();
-	space->gravity = cpv(0, 300);
+	space->gravity = cpv(CP_FLOAT(0), CP_FLOAT(300));
 	
 	cpBody *body;
 	
@@ -43,75 +42,75 @@ void demo5_init(void)
 	
 	int num = 4;
 	cpVect verts[] = {
-		cpv(-2,-15),
-		cpv(-2, 15),
-		cpv( 2, 15),
-		cpv( 2,-15),
+		cpv(CP_FLOAT(-2), CP_FLOAT(-15)),
+		cpv(CP_FLOAT(-2), CP_FLOAT( 15)),
+		cpv(CP_FLOAT( 2), CP_FLOAT( 15)),
+		cpv(CP_FLOAT( 2), CP_FLOAT(-15)),
 	};
 	
-	shape = cpSegmentShapeNew(staticBody, cpv(-600,160), cpv(600,160), 0.0f);
-	shape->e = 1.0; shape->u = 1.0;
+	shape = cpSegmentShapeNew(staticBody, cpv(CP_FLOAT(-600), CP_FLOAT(160)), cpv(CP_FLOAT(600), CP_FLOAT(160)), CP_FLOAT(0.0f));
+	shape->e = CP_FLOAT(1.0); shape->u = CP_FLOAT(1.0);
 	cpSpaceAddStaticShape(space, shape);
 	
-	cpFloat u = 0.6;
+	cpFloat u = CP_FLOAT(0.6);
 	
-			body = cpBodyNew(1.0, cpMomentForPoly(8.0, num, verts, cpvzero));
+			body = cpBodyNew(CP_FLOAT(1.0), cpMomentForPoly(CP_FLOAT(8.0), num, verts, cpvzero));
 			// body->p = cpvadd(cpv(j*60, -220), offset);
-			body->p = cpv(120, 80);
-      body->v = cpv(-250, 0);
+			body->p = cpv(CP_FLOAT(120), CP_FLOAT(80));
+      body->v = cpv(CP_FLOAT(-250), CP_FLOAT(0));
 			cpSpaceAddBody(space, body);
-			shape = cpCircleShapeNew(body, 10, cpvzero);
-			shape->e = 0.0; shape->u = u;
+			shape = cpCircleShapeNew(body, CP_FLOAT(10), cpvzero);
+			shape->e = CP_FLOAT(0.0); shape->u = u;
 			cpSpaceAddShape(space, shape);
 	int n = 2;
 	for(int i=1; i<=n; i++){
-		cpVect offset = cpv(-i*15, -(n - i)*36);
+		cpVect offset = cpv(cpffromint(-i*15), cpffromint(-(n - i)*36));
 		// cpVect offset = cpv(-i*60/2.0f, (n - i)*);
 		
 		for(int j=0; j<i; j++){
-			body = cpBodyNew(1.0, cpMomentForPoly(1.0, num, verts, cpvzero));
+			body = cpBodyNew(CP_FLOAT(1.0), cpMomentForPoly(CP_FLOAT(1.0), num, verts, cpvzero));
 			// body->p = cpvadd(cpv(j*60, -220), offset);
-			body->p = cpvadd(cpv(j*30 + 72, 145), offset);
+			body->p = cpvadd(cpv(cpffromint(j*30 + 72), CP_FLOAT(145)), offset);
 			cpSpaceAddBody(space, body);
 			shape = cpPolyShapeNew(body, num, verts, cpvzero);
-			shape->e = 0.0; shape->u = u;
+			shape->e = CP_FLOAT(0.0); shape->u = u;
 			cpSpaceAddShape(space, shape);
 
-			body = cpBodyNew(1.0, cpMomentForPoly(1.0, num, verts, cpvzero));
+			body = cpBodyNew(CP_FLOAT(1.0), cpMomentForPoly(CP_FLOAT(1.0), num, verts, cpvzero));
 			// body->p = cpvadd(cpv(j*60, -197), offset);
-			body->p = cpvadd(cpv(j*30 + 72, 128), offset);
-			cpBodySetAngle(body, 3.14/2.0f);
+			body->p = cpvadd(cpv(cpffromint(j*30 + 72), CP_FLOAT(128)), offset);
+			cpBodySetAngle(body, CP_FLOAT(3.14/2.0f));
 			cpSpaceAddBody(space, body);
 			shape = cpPolyShapeNew(body, num, verts, cpvzero);
-			shape->e = 0.0; shape->u = u;
+			shape->e = CP_FLOAT(0.0); shape->u = u;
 			cpSpaceAddShape(space, shape);
 			
 			if(j == (i - 1)) continue;
-			body = cpBodyNew(1.0, cpMomentForPoly(1.0, num, verts, cpvzero));
+			body = cpBodyNew(CP_FLOAT(1.0), cpMomentForPoly(CP_FLOAT(1.0), num, verts, cpvzero));
 			// body->p = cpvadd(cpv(j*60 + 30, -191), offset);
-			body->p = cpvadd(cpv(j*30 + 72 + 15, 126), offset);
-			cpBodySetAngle(body, 3.14/2.0f);
+			body->p = cpvadd(cpv(cpffromint(j*30 + 72 + 15), CP_FLOAT(126)), offset);
+			cpBodySetAngle(body, CP_FLOAT(3.14/2.0f));
 			cpSpaceAddBody(space, body);
 			shape = cpPolyShapeNew(body, num, verts, cpvzero);
-			shape->e = 0.0; shape->u = u;
+			shape->e = CP_FLOAT(0.0); shape->u = u;
 			cpSpaceAddShape(space, shape);
 		}
 
     if (i == 2) {
-		body = cpBodyNew(1.0, cpMomentForPoly(1.0, num, verts, cpvzero));
+		body = cpBodyNew(CP_FLOAT(1.0), cpMomentForPoly(CP_FLOAT(1.0), num, verts, cpvzero));
 		// body->p = cpvadd(cpv(-7, -174), offset);
-		body->p = cpvadd(cpv(72 - 12, 128 - 17), offset);
+		body->p = cpvadd(cpv(CP_FLOAT(72 - 12), CP_FLOAT(128 - 17)), offset);
 		cpSpaceAddBody(space, body);
 		shape = cpPolyShapeNew(body, num, verts, cpvzero);
-		shape->e = 0.0; shape->u = u;
+		shape->e = CP_FLOAT(0.0); shape->u = u;
 		cpSpaceAddShape(space, shape);		
 
-		body = cpBodyNew(1.0, cpMomentForPoly(1.0, num, verts, cpvzero));
+		body = cpBodyNew(CP_FLOAT(1.0), cpMomentForPoly(CP_FLOAT(1.0), num, verts, cpvzero));
 		// body->p = cpvadd(cpv((i - 1)*60 + 17, -174), offset);
-		body->p = cpvadd(cpv(72 + 12 + (i-1)*30, 128 - 17), offset);
+		body->p = cpvadd(cpv(cpffromint(72 + 12 + (i-1)*30), CP_FLOAT(128 - 17)), offset);
 		cpSpaceAddBody(space, body);
 		shape = cpPolyShapeNew(body, num, verts, cpvzero);
-		shape->e = 0.0; shape->u = u;
+		shape->e = CP_FLOAT(0.0); shape->u = u;
 		cpSpaceAddShape(space, shape);		
     }
 	}
@@ -29,17 +29,6 @@ extern "C" {
 }
 #endif
 
-float sqrt2(float num) {
-  if (num >=0) {
-    float x = num;
-    for (int i = 0; i < 20; i++) {
-      x = ((x*x) +num) / (2*x);
-    }
-    return x;
-  }
-  return -1;
-}
-
 void *realloc2(void *ptr, size_t size, size_t old_size) {
   void *new_res = malloc(size);
   memcpy(new_res, ptr, old_size);
@@ -53,31 +42,37 @@ cpInitChipmunk(void)
 	cpInitCollisionFuncs();
 }
 
+// The moment functions work in doubles. They are only used when setting up
+// bodies, and the sums can be larger than a fixed point cpFloat can hold.
 cpFloat
 cpMomentForCircle(cpFloat m, cpFloat r1, cpFloat r2, cpVect offset)
 {
-	return (1.0f/2.0f)*m*(r1*r1 + r2*r2) + m*cpvdot(offset, offset);
+	double dm = cpftodouble(m), dr1 = cpftodouble(r1), dr2 = cpftodouble(r2);
+	double ox = cpftodouble(offset.x), oy = cpftodouble(offset.y);
+	
+	return cpffromdouble((1.0/2.0)*dm*(dr1*dr1 + dr2*dr2) + dm*(ox*ox + oy*oy));
 }
 
 cpFloat
 cpMomentForPoly(cpFloat m, const int numVerts, cpVect *verts, cpVect offset)
 {
-	cpVect tVerts[numVerts];
-	for(int i=0; i<numVerts; i++)
-		tVerts[i] = cpvadd(verts[i], offset);
+	double x[numVerts], y[numVerts];
+	for(int i=0; i<numVerts; i++){
+		x[i] = cpftodouble(verts[i].x + offset.x);
+		y[i] = cpftodouble(verts[i].y + offset.y);
+	}
 	
-	cpFloat sum1 = 0.0f;
-	cpFloat sum2 = 0.0f;
+	double sum1 = 0.0;
+	double sum2 = 0.0;
 	for(int i=0; i<numVerts; i++){
-		cpVect v1 = tVerts[i];
-		cpVect v2 = tVerts[(i+1)%numVerts];
+		int j = (i+1)%numVerts;
 		
-		cpFloat a = cpvcross(v2, v1);
-		cpFloat b = cpvdot(v1, v1) + cpvdot(v1, v2) + cpvdot(v2, v2);
+		double a = x[j]*y[i] - y[j]*x[i];
+		double b = (x[i]*x[i] + y[i]*y[i]) + (x[i]*x[j] + y[i]*y[j]) + (x[j]*x[j] + y[j]*y[j]);
 		
 		sum1 += a*b;
 		sum2 += a;
 	}
 	
-	return (m*sum1)/(6.0f*sum2);
+	return cpffromdouble((cpftodouble(m)*sum1)/(6.0*sum2));
 }
@@ -21,50 +21,60 @@
 //#include <pebble.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <float.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 	
-typedef float cpFloat;
-	
 void *realloc2(void *ptr, size_t size, size_t old_size);
-float sqrt2(float number);
-static inline cpFloat
-cpfmax(cpFloat a, cpFloat b)
-{
-	return (a > b) ? a : b;
-}
-
-static inline cpFloat
-cpfmin(cpFloat a, cpFloat b)
-{
-	return (a < b) ? a : b;
-}
 
 #ifndef INFINITY
 #define INFINITY (1e1000)
 #endif
 
+#include "cpFloat.h"
 #include "cpVect.h"
 #include "cpBB.h"
+#include "cpAllocator.h"
 #include "cpBody.h"
 #include "cpArray.h"
 #include "cpHashSet.h"
+#include "cpSpatialIndex.h"
 #include "cpSpaceHash.h"
+#include "cpBBTree.h"
+#include "cpSweepAndPrune.h"
 
 #include "cpShape.h"
 #include "cpPolyShape.h"
 
+#include "cpThreads.h"
 #include "cpArbiter.h"
+#include "cpSolver.h"
 #include "cpCollision.h"
 	
 //#include "cpJoint.h"
 
 #include "cpSpace.h"
+#include "cpSpaceBatch.h"
+
+// Spreads every bit of x over the whole hash. (The MurmurHash3 finalizer)
+// cpHashSet masks off the low bits of the hashes, which are always zero
+// for aligned pointers.
+static inline unsigned int
+cpHashMix(unsigned int x)
+{
+	x ^= x >> 16;
+	x *= 0x85ebca6bu;
+	x ^= x >> 13;
+	x *= 0xc2b2ae35u;
+	x ^= x >> 16;
+	return x;
+}
 
-#define CP_HASH_COEF (3344921057ul)
-#define CP_HASH_PAIR(A, B) ((unsigned int)(A)*CP_HASH_COEF ^ (unsigned int)(B)*CP_HASH_COEF)
+// Order independent hash of a pair of pointers or integers.
+#define CP_HASH_PAIR(A, B) (cpHashMix((unsigned int)(size_t)(A)) ^ cpHashMix((unsigned int)(size_t)(B)))
 
 void cpInitChipmunk(void);
 
@@ -0,0 +1,150 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ 
+#include <stdlib.h>
+
+#include "chipmunk.h"
+
+// Header at the start of each slab. Padded so the objects stay aligned.
+typedef union slabHeader {
+	struct {
+		union slabHeader *next;
+		size_t bytes;
+	} slab;
+	char padding[CP_POOL_GRANULARITY];
+} slabHeader;
+
+// Size in bytes of the objects in a size class.
+static inline size_t
+classSize(int sizeClass)
+{
+	return (sizeClass + 1)*CP_POOL_GRANULARITY;
+}
+
+static inline int
+sizeClassFor(size_t size)
+{
+	return (size ? (int)((size - 1)/CP_POOL_GRANULARITY) : 0);
+}
+
+// Allocate a new slab and push its objects onto the free list.
+static void
+refill(cpPoolAllocator *pool, int sizeClass)
+{
+	size_t size = classSize(sizeClass);
+	int count = pool->slabObjects[sizeClass];
+	size_t bytes = sizeof(slabHeader) + size*count;
+	
+	if(count < CP_POOL_MAX_SLAB_OBJECTS) pool->slabObjects[sizeClass] = 2*count;
+	
+	slabHeader *header = (slabHeader *)cpAllocatorAlloc(pool->parent, bytes);
+	header->slab.next = (slabHeader *)pool->slabs;
+	header->slab.bytes = bytes;
+	pool->slabs = header;
+	
+	char *objects = (char *)(header + 1);
+	for(int i=0; i<count; i++){
+		void **obj = (void **)(objects + i*size);
+		*obj = pool->freeLists[sizeClass];
+		pool->freeLists[sizeClass] = obj;
+	}
+}
+
+static void *
+poolAlloc(cpAllocator *allocator, size_t size)
+{
+	cpPoolAllocator *pool = (cpPoolAllocator *)allocator;
+	if(size > CP_POOL_MAX_SIZE) return cpAllocatorAlloc(pool->parent, size);
+	
+	int sizeClass = sizeClassFor(size);
+	if(!pool->freeLists[sizeClass]) refill(pool, sizeClass);
+	
+	void **obj = (void **)pool->freeLists[sizeClass];
+	pool->freeLists[sizeClass] = *obj;
+	
+	return obj;
+}
+
+static void
+poolFree(cpAllocator *allocator, void *ptr, size_t size)
+{
+	cpPoolAllocator *pool = (cpPoolAllocator *)allocator;
+	if(size > CP_POOL_MAX_SIZE){
+		cpAllocatorFree(pool->parent, ptr, size);
+		return;
+	}
+	
+	int sizeClass = sizeClassFor(size);
+	*(void **)ptr = pool->freeLists[sizeClass];
+	pool->freeLists[sizeClass] = ptr;
+}
+
+cpPoolAllocator *
+cpPoolAllocatorAlloc(void)
+{
+	return (cpPoolAllocator *)calloc(1, sizeof(cpPoolAllocator));
+}
+
+cpPoolAllocator *
+cpPoolAllocatorInit(cpPoolAllocator *pool, cpAllocator *parent)
+{
+	pool->allocator.alloc = &poolAlloc;
+	pool->allocator.free = &poolFree;
+	pool->parent = parent;
+	
+	for(int i=0; i<CP_POOL_CLASSES; i++){
+		pool->freeLists[i] = NULL;
+		pool->slabObjects[i] = CP_POOL_SLAB_OBJECTS;
+	}
+	pool->slabs = NULL;
+	
+	return pool;
+}
+
+cpPoolAllocator *
+cpPoolAllocatorNew(cpAllocator *parent)
+{
+	return cpPoolAllocatorInit(cpPoolAllocatorAlloc(), parent);
+}
+
+void
+cpPoolAllocatorDestroy(cpPoolAllocator *pool)
+{
+	slabHeader *header = (slabHeader *)pool->slabs;
+	while(header){
+		slabHeader *next = header->slab.next;
+		cpAllocatorFree(pool->parent, header, header->slab.bytes);
+		header = next;
+	}
+	
+	pool->slabs = NULL;
+	for(int i=0; i<CP_POOL_CLASSES; i++){
+		pool->freeLists[i] = NULL;
+		pool->slabObjects[i] = CP_POOL_SLAB_OBJECTS;
+	}
+}
+
+void
+cpPoolAllocatorFree(cpPoolAllocator *pool)
+{
+	if(pool) cpPoolAllocatorDestroy(pool);
+	free(pool);
+}
@@ -0,0 +1,88 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Memory allocation callbacks used by cpSpace for its bodies, shapes,
+// arbiters and internal bookkeeping. A NULL allocator means the heap.
+// Objects are always freed with the size they were allocated with.
+typedef struct cpAllocator cpAllocator;
+
+typedef void *(*cpAllocatorAllocFunc)(cpAllocator *allocator, size_t size);
+typedef void (*cpAllocatorFreeFunc)(cpAllocator *allocator, void *ptr, size_t size);
+
+// Custom allocators should embed this as their first member.
+struct cpAllocator{
+	cpAllocatorAllocFunc alloc;
+	cpAllocatorFreeFunc free;
+};
+
+static inline void *
+cpAllocatorAlloc(cpAllocator *allocator, size_t size)
+{
+	return (allocator ? allocator->alloc(allocator, size) : malloc(size));
+}
+
+static inline void
+cpAllocatorFree(cpAllocator *allocator, void *ptr, size_t size)
+{
+	if(!ptr) return;
+	
+	if(allocator){
+		allocator->free(allocator, ptr, size);
+	} else {
+		free(ptr);
+	}
+}
+
+// Allocations are rounded up to a multiple of this many bytes.
+#define CP_POOL_GRANULARITY 16
+// Larger allocations are passed straight on to the parent allocator.
+#define CP_POOL_MAX_SIZE 512
+#define CP_POOL_CLASSES (CP_POOL_MAX_SIZE/CP_POOL_GRANULARITY)
+// Number of objects carved out of the first slab of a size class. Each
+// slab after it holds twice as many, up to CP_POOL_MAX_SLAB_OBJECTS.
+#define CP_POOL_SLAB_OBJECTS 4
+#define CP_POOL_MAX_SLAB_OBJECTS 64
+
+// Allocator that keeps a free list for each size class. The objects are
+// carved out of slabs that are only given back when the pool is destroyed,
+// so allocating and freeing objects of the same type never hits the parent
+// allocator once the pool has warmed up.
+typedef struct cpPoolAllocator{
+	cpAllocator allocator;
+	
+	// Where the slabs come from.
+	cpAllocator *parent;
+	
+	void *freeLists[CP_POOL_CLASSES];
+	// Number of objects the next slab of each size class will hold.
+	int slabObjects[CP_POOL_CLASSES];
+	// Linked list of slabs. The link is stored in a header at the start of each slab.
+	void *slabs;
+} cpPoolAllocator;
+
+// Basic allocation/destruction functions.
+cpPoolAllocator *cpPoolAllocatorAlloc(void);
+cpPoolAllocator *cpPoolAllocatorInit(cpPoolAllocator *pool, cpAllocator *parent);
+cpPoolAllocator *cpPoolAllocatorNew(cpAllocator *parent);
+
+// Gives all of the slabs back to the parent. Any objects still allocated are lost.
+void cpPoolAllocatorDestroy(cpPoolAllocator *pool);
+void cpPoolAllocatorFree(cpPoolAllocator *pool);
@@ -20,15 +20,13 @@
  */
  
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "chipmunk.h"
 
-cpFloat cp_bias_coef = 0.1f;
-cpFloat cp_collision_slop = 0.1f;
-
 cpContact*
-cpContactInit(cpContact *con, cpVect p, cpVect n, cpFloat dist, unsigned int hash)
+cpContactInit(cpContact *con, cpVect p, cpVect n, cpFloat dist, cpContactID id)
 {
 	con->p = p;
 	con->n = n;
@@ -38,7 +36,7 @@ cpContactInit(cpContact *con, cpVect p, cpVect n, cpFloat dist, unsigned int has
 	con->jtAcc = 0.0f;
 	con->jBias = 0.0f;
 	
-	con->hash = hash;
+	con->id = id;
 		
 	return con;
 }
@@ -72,6 +70,76 @@ cpContactsSumImpulsesWithFriction(cpContact *contacts, int numContacts)
 	return sum;
 }
 
+static inline size_t
+blockSize(int max)
+{
+	return sizeof(cpContactBlock) + max*sizeof(cpContact);
+}
+
+cpContactBuffer*
+cpContactBufferInit(cpContactBuffer *buffer)
+{
+	buffer->first = NULL;
+	buffer->current = NULL;
+	buffer->num = 0;
+	buffer->allocator = NULL;
+	
+	return buffer;
+}
+
+void
+cpContactBufferDestroy(cpContactBuffer *buffer)
+{
+	cpContactBlock *block = buffer->first;
+	while(block){
+		cpContactBlock *next = block->next;
+		cpAllocatorFree(buffer->allocator, block, blockSize(block->max));
+		block = next;
+	}
+}
+
+void
+cpContactBufferReset(cpContactBuffer *buffer)
+{
+	buffer->current = buffer->first;
+	buffer->num = 0;
+}
+
+cpContact *
+cpContactBufferReserve(cpContactBuffer *buffer, int count)
+{
+	cpContactBlock *block = buffer->current;
+	if(block && block->max - buffer->num >= count)
+		return &block->contacts[buffer->num];
+	
+	// Move on to the next block, or add a new one if it's missing or too small.
+	cpContactBlock *next = (block ? block->next : buffer->first);
+	if(!next || next->max < count){
+		int max = (block ? 2*block->max : CP_CONTACT_BLOCK_SIZE);
+		if(max < count) max = count;
+		cpContactBlock *fresh = (cpContactBlock *)cpAllocatorAlloc(buffer->allocator, blockSize(max));
+		fresh->max = max;
+		fresh->next = next;
+		
+		if(block){
+			block->next = fresh;
+		} else {
+			buffer->first = fresh;
+		}
+		next = fresh;
+	}
+	
+	buffer->current = next;
+	buffer->num = 0;
+	return next->contacts;
+}
+
+void
+cpContactBufferCommit(cpContactBuffer *buffer, int count)
+{
+	buffer->num += count;
+}
+
 cpArbiter*
 cpArbiterAlloc(void)
 {
@@ -82,10 +150,10 @@ cpArbiter*
 cpArbiterInit(cpArbiter *arb, cpShape *a, cpShape *b, int stamp)
 {
 	arb->numContacts = 0;
-	arb->contacts = NULL;
 	
 	arb->a = a;
 	arb->b = b;
+	arb->func = NULL;
 	
 	arb->stamp = stamp;
 		
@@ -98,11 +166,7 @@ cpArbiterNew(cpShape *a, cpShape *b, int stamp)
 	return cpArbiterInit(cpArbiterAlloc(), a, b, stamp);
 }
 
-void
-cpArbiterDestroy(cpArbiter *arb)
-{
-	free(arb->contacts);
-}
+void cpArbiterDestroy(cpArbiter *arb){}
 
 void
 cpArbiterFree(cpArbiter *arb)
@@ -114,36 +178,41 @@ cpArbiterFree(cpArbiter *arb)
 void
 cpArbiterInject(cpArbiter *arb, cpContact *contacts, int numContacts)
 {
-	// Iterate over the possible pairs to look for hash value matches.
-	for(int i=0; i<arb->numContacts; i++){
-		cpContact *old = &arb->contacts[i];
+	cpContact *old = arb->contacts;
+	int numOld = arb->numContacts;
+	
+	// The collision functions find the features in the same order each step,
+	// so the search for each contact starts after the last match. That makes
+	// this linear unless the features changed.
+	int j = 0;
+	for(int i=0; i<numContacts && numOld; i++){
+		cpContact *new_contact = &contacts[i];
 		
-		for(int j=0; j<numContacts; j++){
-			cpContact *new_contact = &contacts[j];
+		for(int k=0; k<numOld; k++){
+			cpContact *match = &old[j];
+			j = (j + 1 < numOld ? j + 1 : 0);
 			
-			// This could trigger false possitives.
-			if(new_contact->hash == old->hash){
+			if(match->id == new_contact->id){
 				// Copy the persistant contact information.
-				new_contact->jnAcc = old->jnAcc;
-				new_contact->jtAcc = old->jtAcc;
+				new_contact->jnAcc = match->jnAcc;
+				new_contact->jtAcc = match->jtAcc;
+				break;
 			}
 		}
 	}
-
-	free(arb->contacts);
 	
-	arb->contacts = contacts;
+	memcpy(arb->contacts, contacts, numContacts*sizeof(cpContact));
 	arb->numContacts = numContacts;
 }
 
 void
-cpArbiterPreStep(cpArbiter *arb, cpFloat dt_inv)
+cpArbiterPreStep(cpArbiter *arb, cpFloat dt_inv, cpFloat slop, cpFloat bias)
 {
 	cpShape *shapea = arb->a;
 	cpShape *shapeb = arb->b;
 		
-	arb->e = shapea->e * shapeb->e;
-	arb->u = shapea->u * shapeb->u;
+	arb->e = cpfmul(shapea->e, shapeb->e);
+	arb->u = cpfmul(shapea->u, shapeb->u);
 	arb->target_v = cpvsub(shapeb->surface_v, shapea->surface_v);
 
 	cpBody *a = shapea->body;
@@ -161,26 +230,38 @@ cpArbiterPreStep(cpArbiter *arb, cpFloat dt_inv)
 		
 		cpFloat r1cn = cpvcross(con->r1, con->n);
 		cpFloat r2cn = cpvcross(con->r2, con->n);
-		cpFloat kn = mass_sum + a->i_inv*r1cn*r1cn + b->i_inv*r2cn*r2cn;
-		con->nMass = 1.0f/kn;
+		cpFloat kn = mass_sum + cpfmul(cpfmul(a->i_inv, r1cn), r1cn) + cpfmul(cpfmul(b->i_inv, r2cn), r2cn);
+		con->nMass = cpfdiv(CP_FLOAT(1.0f), kn);
 		
 		// Calculate the mass tangent.
 		cpVect t = cpvperp(con->n);
 		cpFloat r1ct = cpvcross(con->r1, t);
 		cpFloat r2ct = cpvcross(con->r2, t);
-		cpFloat kt = mass_sum + a->i_inv*r1ct*r1ct + b->i_inv*r2ct*r2ct;
-		con->tMass = 1.0f/kt;
+		cpFloat kt = mass_sum + cpfmul(cpfmul(a->i_inv, r1ct), r1ct) + cpfmul(cpfmul(b->i_inv, r2ct), r2ct);
+		con->tMass = cpfdiv(CP_FLOAT(1.0f), kt);
 				
 		// Calculate the target bias velocity.
-		con->bias = -cp_bias_coef*dt_inv*cpfmin(0.0f, con->dist + cp_collision_slop);
+		con->bias = cpfmul(cpfmul(-bias, dt_inv), cpfmin(0.0f, con->dist + slop));
 		con->jBias = 0.0f;
 		
 		// Calculate the target bounce velocity.
 		cpVect v1 = cpvadd(a->v, cpvmult(cpvperp(con->r1), a->w));
 		cpVect v2 = cpvadd(b->v, cpvmult(cpvperp(con->r2), b->w));
-		con->bounce = cpvdot(con->n, cpvsub(v2, v1))*arb->e;
+		con->bounce = cpfmul(cpvdot(con->n, cpvsub(v2, v1)), arb->e);
+	}
+}
+
+void
+cpArbiterApplyCachedImpulse(cpArbiter *arb)
+{
+	cpBody *a = arb->a->body;
+	cpBody *b = arb->b->body;
+	
+	for(int i=0; i<arb->numContacts; i++){
+		cpContact *con = &arb->contacts[i];
 		
 		// Apply the previous accumulated impulse.
+		cpVect t = cpvperp(con->n);
 		cpVect j = cpvadd(cpvmult(con->n, con->jnAcc), cpvmult(t, con->jtAcc));
 		cpBodyApplyImpulse(a, cpvneg(j), con->r1);
 		cpBodyApplyImpulse(b, j, con->r2);
@@ -205,10 +286,10 @@ cpArbiterApplyImpulse(cpArbiter *arb)
 		cpFloat vbn = cpvdot(cpvsub(vb2, vb1), n);
 		
 		// Calculate and clamp the bias impulse.
-		cpFloat jbn = (con->bias - vbn)*con->nMass;
+		cpFloat jbn = cpfmul(con->bias - vbn, con->nMass);
 		cpFloat jbnOld = con->jBias;
-		con->jBias = cpfmax(jbnOld + jbn, 0.0f);
-		jbn = con->jBias - jbnOld;
+		con->jBias = cpfmax(cpfadd(jbnOld, jbn), 0.0f);
+		jbn = cpfsub(con->jBias, jbnOld);
 		
 		// Apply the bias impulse.
 		cpVect jb = cpvmult(n, jbn);
@@ -222,21 +303,21 @@ cpArbiterApplyImpulse(cpArbiter *arb)
 		cpFloat vrn = cpvdot(vr, n);
 		
 		// Calculate and clamp the normal impulse.
-		cpFloat jn = -(con->bounce + vrn)*con->nMass;
+		cpFloat jn = cpfmul(-(con->bounce + vrn), con->nMass);
 		cpFloat jnOld = con->jnAcc;
-		con->jnAcc = cpfmax(jnOld + jn, 0.0f);
-		jn = con->jnAcc - jnOld;
+		con->jnAcc = cpfmax(cpfadd(jnOld, jn), 0.0f);
+		jn = cpfsub(con->jnAcc, jnOld);
 		
 		// Calculate the relative tangent velocity.
 		cpVect t = cpvperp(n);
 		cpFloat vrt = cpvdot(cpvadd(vr, arb->target_v), t);
 		
 		// Calculate and clamp the friction impulse.
-		cpFloat jtMax = arb->u*con->jnAcc;
-		cpFloat jt = -vrt*con->tMass;
+		cpFloat jtMax = cpfmul(arb->u, con->jnAcc);
+		cpFloat jt = cpfmul(-vrt, con->tMass);
 		cpFloat jtOld = con->jtAcc;
-		con->jtAcc = cpfmin(cpfmax(jtOld + jt, -jtMax), jtMax);
-		jt = con->jtAcc - jtOld;
+		con->jtAcc = cpfmin(cpfmax(cpfadd(jtOld, jt), -jtMax), jtMax);
+		jt = cpfsub(con->jtAcc, jtOld);
 		
 		// Apply the final impulse.
 		cpVect j = cpvadd(cpvmult(n, jn), cpvmult(t, jt));
@@ -19,10 +19,17 @@
  * SOFTWARE.
  */
 
-// Determines how fast penetrations resolve themselves.
-extern cpFloat cp_bias_coef;
-// Amount of allowed penetration. Used to reduce vibrating contacts.
-extern cpFloat cp_collision_slop;
+// Identifies the features (a vertex or an edge) of the two shapes that
+// made a contact so it can be matched with the same contact from the last
+// step. The feature of the first shape passed to cpCollideShapes() is in
+// the high 16 bits.
+typedef unsigned int cpContactID;
+
+#define CP_FEATURE_VERT(i) ((unsigned int)(i)<<1)
+#define CP_FEATURE_EDGE(i) (((unsigned int)(i)<<1) | 1)
+// Used when a contact doesn't involve a specific feature of the shape.
+#define CP_FEATURE_NONE 0xFFFF
+#define CP_CONTACT_ID(featureA, featureB) (((cpContactID)(featureA)<<16) | (cpContactID)(featureB))
 
 // Data structure for contact points.
 typedef struct cpContact{
@@ -39,25 +46,70 @@ typedef struct cpContact{
 	cpFloat jnAcc, jtAcc, jBias;
 	cpFloat bias;
 	
-	// Hash value used to (mostly) uniquely identify a contact.
-	unsigned int hash;
+	// Features of the shapes that made the contact. Unique within a collision.
+	cpContactID id;
 } cpContact;
 
 // Contacts are always allocated in groups.
-cpContact* cpContactInit(cpContact *con, cpVect p, cpVect n, cpFloat dist, unsigned int hash);
+cpContact* cpContactInit(cpContact *con, cpVect p, cpVect n, cpFloat dist, cpContactID id);
 
 // Sum the contact impulses. (Can be used after cpSpaceStep() returns)
 cpVect cpContactsSumImpulses(cpContact *contacts, int numContacts);
 cpVect cpContactsSumImpulsesWithFriction(cpContact *contacts, int numContacts);
 
+// Number of contacts in the first block. Each block added after it is twice
+// the size of the one before, unless a single collision needs more.
+#define CP_CONTACT_BLOCK_SIZE 16
+
+// Block of contacts in a cpContactBuffer.
+typedef struct cpContactBlock{
+	struct cpContactBlock *next;
+	int max;
+	cpContact contacts[];
+} cpContactBlock;
+
+// Arena that the collision functions allocate their contacts from.
+// The blocks are kept when the buffer is reset, so once it has grown to
+// the size of the busiest step there is no more heap traffic.
+typedef struct cpContactBuffer{
+	cpContactBlock *first, *current;
+	// Number of contacts used in the current block.
+	int num;
+	
+	// Allocator for the blocks. Defaults to NULL (the heap).
+	cpAllocator *allocator;
+} cpContactBuffer;
+
+cpContactBuffer* cpContactBufferInit(cpContactBuffer *buffer);
+void cpContactBufferDestroy(cpContactBuffer *buffer);
+
+// Forget all of the contacts. The memory is reused.
+void cpContactBufferReset(cpContactBuffer *buffer);
+// Get room for count contiguous contacts. They stay free until committed.
+cpContact *cpContactBufferReserve(cpContactBuffer *buffer, int count);
+// Mark count contacts of the last reservation as used.
+void cpContactBufferCommit(cpContactBuffer *buffer, int count);
+
+// Most contacts a collision can have. The collision functions clip the
+// overlap down to the two contacts that best describe it.
+#define CP_MAX_CONTACTS_PER_ARBITER 2
+
 // Data structure for tracking collisions between shapes.
 typedef struct cpArbiter{
 	// Information on the contact points between the objects.
+	// cpArbiterInject() copies them into the arbiter.
 	int numContacts;
-	cpContact *contacts;
+	cpContact contacts[CP_MAX_CONTACTS_PER_ARBITER];
 	
 	// The two shapes involved in the collision.
 	cpShape *a, *b;
+	// Collision pair function for the shapes, cached by the space so it's
+	// only looked up when the arbiter is created. NULL when not known.
+	struct cpCollPairFunc *func;
+	// Positions and angles of the bodies of a and b the last time the
+	// narrow phase was run on them. Used by the space's pair cache.
+	cpVect cacheP[2];
+	cpFloat cacheA[2];
 	
 	// Calculated by cpArbiterPreStep().
 	cpFloat u, e;
@@ -77,8 +129,12 @@ void cpArbiterFree(cpArbiter *arb);
 
 // These functions are all intended to be used internally.
 // Inject new contact points into the arbiter while preserving contact history.
+// There can be at most CP_MAX_CONTACTS_PER_ARBITER of them.
 void cpArbiterInject(cpArbiter *arb, cpContact *contacts, int numContacts);
-// Precalculate values used by the solver.
-void cpArbiterPreStep(cpArbiter *arb, cpFloat dt_inv);
+// Precalculate values used by the solver. slop and bias are the space's
+// collisionSlop and collisionBias. Only writes to the arbiter, so arbiters can be prestepped in parallel.
+void cpArbiterPreStep(cpArbiter *arb, cpFloat dt_inv, cpFloat slop, cpFloat bias);
+// Warm start the bodies with the impulses carried over from the last step.
+void cpArbiterApplyCachedImpulse(cpArbiter *arb);
 // Run an iteration of the solver on the arbiter.
 void cpArbiterApplyImpulse(cpArbiter *arb);
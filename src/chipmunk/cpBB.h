@@ -49,5 +49,18 @@ cpBBcontainsVect(const cpBB bb, const cpVect v)
 	return (bb.l < v.x && bb.r > v.x && bb.b < v.y && bb.t > v.y);
 }
 
+// Returns the smallest bbox containing both a and b.
+static inline cpBB
+cpBBmerge(const cpBB a, const cpBB b)
+{
+	return cpBBNew(cpfmin(a.l, b.l), cpfmin(a.b, b.b), cpfmax(a.r, b.r), cpfmax(a.t, b.t));
+}
+
+static inline cpFloat
+cpBBarea(const cpBB bb)
+{
+	return cpfmul(bb.r - bb.l, bb.t - bb.b);
+}
+
 cpVect cpBBClampVect(const cpBB bb, const cpVect v); // clamps the vector to lie within the bbox
 cpVect cpBBWrapVect(const cpBB bb, const cpVect v); // wrap a vector to a bbox
@@ -0,0 +1,518 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ 
+#include <stdlib.h>
+
+#include "chipmunk.h"
+
+// Default fraction of an object's size to grow its leaf BBox by.
+#define DEFAULT_MARGIN CP_FLOAT(0.1)
+
+static inline int
+isLeaf(cpBBTreeNode *node)
+{
+	return (node->a == NULL);
+}
+
+// Get a recycled or new node.
+static cpBBTreeNode *
+nodeAlloc(cpBBTree *tree)
+{
+	cpBBTreeNode *node = tree->pooledNodes;
+	
+	if(node){
+		tree->pooledNodes = node->parent;
+	} else {
+		node = (cpBBTreeNode *)malloc(sizeof(cpBBTreeNode));
+	}
+	
+	node->parent = NULL;
+	node->a = node->b = NULL;
+	node->obj = NULL;
+	node->stamp = 0;
+	
+	return node;
+}
+
+static void
+nodeRecycle(cpBBTree *tree, cpBBTreeNode *node)
+{
+	node->parent = tree->pooledNodes;
+	tree->pooledNodes = node;
+}
+
+// Equality function for the leaf set.
+static int
+leafSetEql(void *obj, void *elt)
+{
+	cpBBTreeNode *leaf = (cpBBTreeNode *)elt;
+	return (obj == leaf->obj);
+}
+
+// Transformation function for the leaf set.
+static void *
+leafSetTrans(void *obj, void *data)
+{
+	cpBBTreeNode *leaf = nodeAlloc((cpBBTree *)data);
+	leaf->obj = obj;
+	
+	return leaf;
+}
+
+cpBBTree *
+cpBBTreeAlloc(void)
+{
+	return (cpBBTree *)calloc(1, sizeof(cpBBTree));
+}
+
+cpBBTree *
+cpBBTreeInit(cpBBTree *tree, cpSpatialIndexBBFunc bbfunc)
+{
+	tree->index.klass = cpBBTreeGetClass();
+	tree->index.bbfunc = bbfunc;
+	
+	tree->margin = DEFAULT_MARGIN;
+	
+	tree->leaves = cpHashSetNew(0, &leafSetEql, &leafSetTrans);
+	tree->root = NULL;
+	tree->pooledNodes = NULL;
+	
+	tree->stamp = 0;
+	
+	return tree;
+}
+
+cpBBTree *
+cpBBTreeNew(cpSpatialIndexBBFunc bbfunc)
+{
+	return cpBBTreeInit(cpBBTreeAlloc(), bbfunc);
+}
+
+static void
+freeSubtree(cpBBTreeNode *node)
+{
+	if(!node) return;
+	
+	freeSubtree(node->a);
+	freeSubtree(node->b);
+	free(node);
+}
+
+void
+cpBBTreeDestroy(cpBBTree *tree)
+{
+	freeSubtree(tree->root);
+	
+	// Free the recycled nodes.
+	cpBBTreeNode *node = tree->pooledNodes;
+	while(node){
+		cpBBTreeNode *next = node->parent;
+		free(node);
+		node = next;
+	}
+	
+	// The leaves were freed with the tree.
+	cpHashSetFree(tree->leaves);
+}
+
+void
+cpBBTreeFree(cpBBTree *tree)
+{
+	if(!tree) return;
+	cpBBTreeDestroy(tree);
+	free(tree);
+}
+
+// Grow a BBox by the tree's margin.
+static inline cpBB
+fatten(cpBBTree *tree, cpBB bb)
+{
+	cpFloat m = cpfmul(cpfmax(bb.r - bb.l, bb.t - bb.b), tree->margin);
+	return cpBBNew(bb.l - m, bb.b - m, bb.r + m, bb.t + m);
+}
+
+static inline void
+replaceChild(cpBBTreeNode *parent, cpBBTreeNode *child, cpBBTreeNode *value)
+{
+	if(parent->a == child){
+		parent->a = value;
+	} else {
+		parent->b = value;
+	}
+}
+
+// Swap a grandchild of a node with its uncle.
+static void
+swapNodes(cpBBTreeNode *grandchild, cpBBTreeNode *uncle)
+{
+	cpBBTreeNode *parent = grandchild->parent;
+	cpBBTreeNode *node = uncle->parent;
+	
+	replaceChild(parent, grandchild, uncle);
+	replaceChild(node, uncle, grandchild);
+	uncle->parent = parent;
+	grandchild->parent = node;
+	
+	parent->bb = cpBBmerge(parent->a->bb, parent->b->bb);
+}
+
+// Area saved in 'child' by swapping 'uncle' with one of child's children.
+// 'keep' is the grandchild that stays.
+static inline cpFloat
+rotationGain(cpBBTreeNode *child, cpBBTreeNode *uncle, cpBBTreeNode *keep)
+{
+	return cpBBarea(child->bb) - cpBBarea(cpBBmerge(uncle->bb, keep->bb));
+}
+
+// Perform the tree rotation that shrinks the children of a node the most. (if any)
+static void
+rotate(cpBBTreeNode *node)
+{
+	cpBBTreeNode *a = node->a;
+	cpBBTreeNode *b = node->b;
+	
+	cpFloat best = 0.0f;
+	cpBBTreeNode *grandchild = NULL;
+	cpBBTreeNode *uncle = NULL;
+	
+	if(!isLeaf(b)){
+		cpFloat gain = rotationGain(b, a, b->b);
+		if(gain > best){ best = gain; grandchild = b->a; uncle = a; }
+		
+		gain = rotationGain(b, a, b->a);
+		if(gain > best){ best = gain; grandchild = b->b; uncle = a; }
+	}
+	
+	if(!isLeaf(a)){
+		cpFloat gain = rotationGain(a, b, a->b);
+		if(gain > best){ best = gain; grandchild = a->a; uncle = b; }
+		
+		gain = rotationGain(a, b, a->a);
+		if(gain > best){ best = gain; grandchild = a->b; uncle = b; }
+	}
+	
+	if(grandchild) swapNodes(grandchild, uncle);
+}
+
+// Walk up the tree from node, rotating and recalculating the BBoxes.
+static void
+refitAncestors(cpBBTreeNode *node)
+{
+	for(; node; node = node->parent){
+		rotate(node);
+		node->bb = cpBBmerge(node->a->bb, node->b->bb);
+	}
+}
+
+// Cost of pushing a leaf with the given BBox down into a child.
+static inline cpFloat
+descendCost(cpBBTreeNode *child, cpBB bb)
+{
+	cpFloat mergedArea = cpBBarea(cpBBmerge(child->bb, bb));
+	return (isLeaf(child) ? mergedArea : mergedArea - cpBBarea(child->bb));
+}
+
+static void
+insertLeaf(cpBBTree *tree, cpBBTreeNode *leaf)
+{
+	if(!tree->root){
+		tree->root = leaf;
+		leaf->parent = NULL;
+		return;
+	}
+	
+	// Find the best sibling for the leaf using the surface area heuristic.
+	cpBB bb = leaf->bb;
+	cpBBTreeNode *node = tree->root;
+	while(!isLeaf(node)){
+		cpFloat area = cpBBarea(node->bb);
+		cpFloat mergedArea = cpBBarea(cpBBmerge(node->bb, bb));
+		
+		// Cost of making a new parent for this node and the leaf.
+		cpFloat cost = cpfmul(CP_FLOAT(2.0f), mergedArea);
+		// Minimum cost of pushing the leaf further down.
+		cpFloat inheritance = cpfmul(CP_FLOAT(2.0f), mergedArea - area);
+		
+		cpFloat costA = cpfadd(descendCost(node->a, bb), inheritance);
+		cpFloat costB = cpfadd(descendCost(node->b, bb), inheritance);
+		if(cost < costA && cost < costB) break;
+		
+		node = (costA < costB ? node->a : node->b);
+	}
+	
+	// Make a new parent for the sibling and the leaf.
+	cpBBTreeNode *oldParent = node->parent;
+	cpBBTreeNode *parent = nodeAlloc(tree);
+	parent->bb = cpBBmerge(node->bb, bb);
+	parent->a = node;
+	parent->b = leaf;
+	parent->parent = oldParent;
+	node->parent = parent;
+	leaf->parent = parent;
+	
+	if(oldParent){
+		replaceChild(oldParent, node, parent);
+	} else {
+		tree->root = parent;
+	}
+	
+	refitAncestors(oldParent);
+}
+
+static void
+removeLeaf(cpBBTree *tree, cpBBTreeNode *leaf)
+{
+	if(leaf == tree->root){
+		tree->root = NULL;
+		return;
+	}
+	
+	// Replace the leaf's parent with its sibling.
+	cpBBTreeNode *parent = leaf->parent;
+	cpBBTreeNode *sibling = (parent->a == leaf ? parent->b : parent->a);
+	cpBBTreeNode *grandparent = parent->parent;
+	
+	if(grandparent){
+		replaceChild(grandparent, parent, sibling);
+	} else {
+		tree->root = sibling;
+	}
+	sibling->parent = grandparent;
+	
+	nodeRecycle(tree, parent);
+	leaf->parent = NULL;
+	
+	refitAncestors(grandparent);
+}
+
+static inline int
+leafInTree(cpBBTree *tree, cpBBTreeNode *leaf)
+{
+	return (leaf->parent || leaf == tree->root);
+}
+
+void
+cpBBTreeInsert(cpBBTree *tree, void *obj, unsigned int id, cpBB bb)
+{
+	cpBBTreeNode *leaf = (cpBBTreeNode *)cpHashSetInsert(tree->leaves, id, obj, tree);
+	
+	// Inserting an object twice just updates it.
+	if(leafInTree(tree, leaf)) removeLeaf(tree, leaf);
+	
+	leaf->bb = fatten(tree, bb);
+	insertLeaf(tree, leaf);
+}
+
+void
+cpBBTreeRemove(cpBBTree *tree, void *obj, unsigned int id)
+{
+	cpBBTreeNode *leaf = (cpBBTreeNode *)cpHashSetRemove(tree->leaves, id, obj);
+	if(!leaf) return;
+	
+	removeLeaf(tree, leaf);
+	nodeRecycle(tree, leaf);
+}
+
+// Used by the cpBBTreeEach() iterator.
+typedef struct eachPair {
+	cpSpatialIndexIterator func;
+	void *data;
+} eachPair;
+
+static void
+eachHelper(void *elt, void *data)
+{
+	cpBBTreeNode *leaf = (cpBBTreeNode *)elt;
+	eachPair *pair = (eachPair *)data;
+	
+	pair->func(leaf->obj, pair->data);
+}
+
+void
+cpBBTreeEach(cpBBTree *tree, cpSpatialIndexIterator func, void *data)
+{
+	eachPair pair = {func, data};
+	cpHashSetEach(tree->leaves, &eachHelper, &pair);
+}
+
+// Reinsert a leaf if its object has moved outside of the fattened BBox.
+static void
+updateLeaf(cpBBTree *tree, cpBBTreeNode *leaf)
+{
+	cpBB bb = tree->index.bbfunc(leaf->obj);
+	if(cpBBcontainsBB(leaf->bb, bb)) return;
+	
+	removeLeaf(tree, leaf);
+	leaf->bb = fatten(tree, bb);
+	insertLeaf(tree, leaf);
+}
+
+static void
+updateLeafHelper(void *elt, void *data)
+{
+	updateLeaf((cpBBTree *)data, (cpBBTreeNode *)elt);
+}
+
+void
+cpBBTreeRehash(cpBBTree *tree)
+{
+	cpHashSetEach(tree->leaves, &updateLeafHelper, tree);
+}
+
+void
+cpBBTreeRehashObject(cpBBTree *tree, void *obj, unsigned int id)
+{
+	cpBBTreeNode *leaf = (cpBBTreeNode *)cpHashSetFind(tree->leaves, id, obj);
+	if(leaf) updateLeaf(tree, leaf);
+}
+
+static void
+subtreeQuery(cpBBTreeNode *node, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
+{
+	if(!cpBBintersects(node->bb, bb)) return;
+	
+	if(isLeaf(node)){
+		if(node->obj != obj) func(obj, node->obj, data);
+	} else {
+		subtreeQuery(node->a, obj, bb, func, data);
+		subtreeQuery(node->b, obj, bb, func, data);
+	}
+}
+
+void
+cpBBTreeQuery(cpBBTree *tree, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
+{
+	if(tree->root) subtreeQuery(tree->root, obj, bb, func, data);
+}
+
+// Similar to struct eachPair above.
+typedef struct queryRehashContext {
+	cpBBTree *tree;
+	cpSpatialIndexQueryFunc func;
+	void *data;
+} queryRehashContext;
+
+// Like subtreeQuery(), but only reports leaves that have already been
+// stamped during this pass so each pair is only reported once.
+static void
+subtreeQueryStamped(cpBBTreeNode *node, cpBBTreeNode *leaf, cpBB bb, queryRehashContext *context)
+{
+	if(!cpBBintersects(node->bb, bb)) return;
+	
+	if(isLeaf(node)){
+		if(node->stamp == context->tree->stamp && node != leaf)
+			context->func(leaf->obj, node->obj, context->data);
+	} else {
+		subtreeQueryStamped(node->a, leaf, bb, context);
+		subtreeQueryStamped(node->b, leaf, bb, context);
+	}
+}
+
+static void
+leafQueryHelper(void *elt, void *data)
+{
+	cpBBTreeNode *leaf = (cpBBTreeNode *)elt;
+	queryRehashContext *context = (queryRehashContext *)data;
+	cpBBTree *tree = context->tree;
+	
+	// Query with the real BBox. If two objects overlap, each one's real
+	// BBox overlaps the other's fattened one, so no pairs are missed.
+	subtreeQueryStamped(tree->root, leaf, tree->index.bbfunc(leaf->obj), context);
+	leaf->stamp = tree->stamp;
+}
+
+void
+cpBBTreeQueryRehash(cpBBTree *tree, cpSpatialIndexQueryFunc func, void *data)
+{
+	cpBBTreeRehash(tree);
+	if(!tree->root) return;
+	
+	tree->stamp++;
+	
+	queryRehashContext context = {tree, func, data};
+	cpHashSetEach(tree->leaves, &leafQueryHelper, &context);
+}
+
+// cpSpatialIndex wrappers.
+static void
+destroyImpl(cpSpatialIndex *index)
+{
+	cpBBTreeDestroy((cpBBTree *)index);
+}
+
+static void
+insertImpl(cpSpatialIndex *index, void *obj, unsigned int id, cpBB bb)
+{
+	cpBBTreeInsert((cpBBTree *)index, obj, id, bb);
+}
+
+static void
+removeImpl(cpSpatialIndex *index, void *obj, unsigned int id)
+{
+	cpBBTreeRemove((cpBBTree *)index, obj, id);
+}
+
+static void
+eachImpl(cpSpatialIndex *index, cpSpatialIndexIterator func, void *data)
+{
+	cpBBTreeEach((cpBBTree *)index, func, data);
+}
+
+static void
+rehashImpl(cpSpatialIndex *index)
+{
+	cpBBTreeRehash((cpBBTree *)index);
+}
+
+static void
+rehashObjectImpl(cpSpatialIndex *index, void *obj, unsigned int id)
+{
+	cpBBTreeRehashObject((cpBBTree *)index, obj, id);
+}
+
+static void
+queryImpl(cpSpatialIndex *index, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
+{
+	cpBBTreeQuery((cpBBTree *)index, obj, bb, func, data);
+}
+
+static void
+queryRehashImpl(cpSpatialIndex *index, cpSpatialIndexQueryFunc func, void *data)
+{
+	cpBBTreeQueryRehash((cpBBTree *)index, func, data);
+}
+
+static cpSpatialIndexClass klass = {
+	destroyImpl,
+	insertImpl,
+	removeImpl,
+	eachImpl,
+	rehashImpl,
+	rehashObjectImpl,
+	queryImpl,
+	queryRehashImpl,
+};
+
+cpSpatialIndexClass *
+cpBBTreeGetClass(void)
+{
+	return &klass;
+}
@@ -0,0 +1,87 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Dynamic bounding box tree spatial index.
+// Unlike cpSpaceHash it doesn't need to be tuned for the size of the objects.
+// Leaves store a fattened copy of the object's BBox so that objects that
+// move a little don't need to be reinserted, and the tree is kept balanced
+// using tree rotations as nodes are inserted and removed.
+
+typedef struct cpBBTreeNode{
+	// Fattened BBox for leaves, union of the children's BBoxes otherwise.
+	cpBB bb;
+	
+	// Parent node. Also links the list of recycled nodes.
+	struct cpBBTreeNode *parent;
+	// Children. NULL for leaves.
+	struct cpBBTreeNode *a, *b;
+	
+	// Object stored in a leaf.
+	void *obj;
+	// Query stamp. Used by cpBBTreeQueryRehash() to report each pair once.
+	int stamp;
+} cpBBTreeNode;
+
+typedef struct cpBBTree{
+	// Spatial index base. (holds the bbfunc)
+	cpSpatialIndex index;
+	
+	// Fraction of an object's size that its leaf BBox is grown by.
+	cpFloat margin;
+	
+	// Hashset of the leaves, keyed by object.
+	cpHashSet *leaves;
+	cpBBTreeNode *root;
+	
+	// List of recycled nodes.
+	cpBBTreeNode *pooledNodes;
+	
+	// Incremented on each call to cpBBTreeQueryRehash().
+	int stamp;
+} cpBBTree;
+
+// Basic allocation/destruction functions.
+cpBBTree *cpBBTreeAlloc(void);
+cpBBTree *cpBBTreeInit(cpBBTree *tree, cpSpatialIndexBBFunc bbfunc);
+cpBBTree *cpBBTreeNew(cpSpatialIndexBBFunc bbfunc);
+
+void cpBBTreeDestroy(cpBBTree *tree);
+void cpBBTreeFree(cpBBTree *tree);
+
+// cpSpatialIndex class for the tree.
+cpSpatialIndexClass *cpBBTreeGetClass(void);
+
+// Add an object to the tree.
+void cpBBTreeInsert(cpBBTree *tree, void *obj, unsigned int id, cpBB bb);
+// Remove an object from the tree.
+void cpBBTreeRemove(cpBBTree *tree, void *obj, unsigned int id);
+
+// Iterate over the objects in the tree.
+void cpBBTreeEach(cpBBTree *tree, cpSpatialIndexIterator func, void *data);
+
+// Refit the leaves of objects that have moved outside of their fattened BBox.
+void cpBBTreeRehash(cpBBTree *tree);
+void cpBBTreeRehashObject(cpBBTree *tree, void *obj, unsigned int id);
+
+// Query the tree for a given BBox.
+void cpBBTreeQuery(cpBBTree *tree, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data);
+// Rehash the tree while calling func once for each pair of possibly overlapping objects.
+void cpBBTreeQueryRehash(cpBBTree *tree, cpSpatialIndexQueryFunc func, void *data);
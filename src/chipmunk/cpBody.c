@@ -27,10 +27,15 @@
 #define M_PI 3.14
 #endif
 
+#define TWO_PI CP_FLOAT(M_PI*2.0)
+
 cpBody*
 cpBodyAlloc(void)
 {
-	return (cpBody *)malloc(sizeof(cpBody));
+	cpBody *body = (cpBody *)malloc(sizeof(cpBody));
+	body->allocator = NULL;
+	
+	return body;
 }
 
 cpBody*
@@ -50,7 +55,16 @@ cpBodyInit(cpBody *body, cpFloat m, cpFloat i)
 	body->v_bias = cpvzero;
 	body->w_bias = 0.0f;
 	
-//	body->active = 1;
+	body->space = NULL;
+	body->shapesList = NULL;
+	
+	body->idleTicks = 0;
+	body->sleeping = 0;
+	body->islandParent = NULL;
+	body->islandNext = NULL;
+	body->islandIdle = 0;
+	body->islandStamp = -1;
+	body->solverIndex = -1;
 
 	return body;
 }
@@ -66,54 +80,78 @@ void cpBodyDestroy(cpBody *body){}
 void
 cpBodyFree(cpBody *body)
 {
-	if(body) cpBodyDestroy(body);
-	free(body);
+	if(!body) return;
+	
+	cpBodyDestroy(body);
+	cpAllocatorFree(body->allocator, body, sizeof(cpBody));
 }
 
 void
 cpBodySetMass(cpBody *body, cpFloat m)
 {
 	body->m = m;
-	body->m_inv = 1.0f/m;
+	body->m_inv = cpfdiv(CP_FLOAT(1.0f), m);
 }
 
 void
 cpBodySetMoment(cpBody *body, cpFloat i)
 {
 	body->i = i;
-	body->i_inv = 1.0f/i;
+	body->i_inv = cpfdiv(CP_FLOAT(1.0f), i);
 }
 
 void
 cpBodySetAngle(cpBody *body, cpFloat a)
 {
-  cpFloat res = a;
-  while (res >= M_PI * 2.0f) {
-    res -= (M_PI * 2.0f);
-  }
+	// Keep the angle in [0, 2pi) so it can't grow without bound.
+	cpFloat res = cpfmod(a, TWO_PI);
+	if(res < 0.0f) res += TWO_PI;
+	
 	body->a = res;
-	body->rot = cpvforangle(a);
+	body->rot = cpvforangle(res);
 }
 
 void
 cpBodySlew(cpBody *body, cpVect pos, cpFloat dt)
 {
 	cpVect delta = cpvsub(body->p, pos);
-	body->v = cpvmult(delta, 1.0/dt);
+	body->v = cpvmult(delta, cpfdiv(CP_FLOAT(1.0f), dt));
 }
 
 void
 cpBodyUpdateVelocity(cpBody *body, cpVect gravity, cpFloat damping, cpFloat dt)
 {
 	body->v = cpvadd(cpvmult(body->v, damping), cpvmult(cpvadd(gravity, cpvmult(body->f, body->m_inv)), dt));
-	body->w = body->w*damping + body->t*body->i_inv*dt;
+	body->w = cpfmul(body->w, damping) + cpfmul(cpfmul(body->t, body->i_inv), dt);
 }
 
+// Largest rotation in one step that cpBodyUpdatePosition() will do
+// incrementally. Faster spins recompute the rotation from the angle.
+#define MAX_INCREMENTAL_ROTATION CP_FLOAT(0.5f)
+
 void
 cpBodyUpdatePosition(cpBody *body, cpFloat dt)
 {
 	body->p = cpvadd(body->p, cpvmult(cpvadd(body->v, body->v_bias), dt));
-	cpBodySetAngle(body, body->a + (body->w + body->w_bias)*dt);
+	
+	cpFloat da = cpfmul(body->w + body->w_bias, dt);
+	if(da > MAX_INCREMENTAL_ROTATION || da < -MAX_INCREMENTAL_ROTATION){
+		cpBodySetAngle(body, cpfadd(body->a, da));
+	} else if(da){
+		// Rotate body->rot by da using the Taylor series of cos() and sin()
+		// instead of calling them. (error is below da^6/720)
+		cpFloat da2 = cpfmul(da, da);
+		cpFloat c = CP_FLOAT(1.0f) - cpfmul(da2, CP_FLOAT(0.5f) - cpfmul(da2, CP_FLOAT(1.0/24.0)));
+		cpFloat s = cpfmul(da, CP_FLOAT(1.0f) - cpfmul(da2, CP_FLOAT(1.0f/6.0f) - cpfmul(da2, CP_FLOAT(1.0f/120.0f))));
+		cpVect rot = cpvrotate(body->rot, cpv(c, s));
+		
+		// Keep the rounding errors from growing the vector. This is one
+		// Newton step towards unit length, so it doesn't need a sqrt.
+		body->rot = cpvmult(rot, CP_FLOAT(1.5f) - cpfmul(CP_FLOAT(0.5f), cpvdot(rot, rot)));
+		
+		cpFloat a = body->a + da;
+		body->a = (a >= TWO_PI ? a - TWO_PI : (a < 0.0f ? a + TWO_PI : a));
+	}
 	
 	body->v_bias = cpvzero;
 	body->w_bias = 0.0f;
@@ -126,9 +164,17 @@ cpBodyResetForces(cpBody *body)
 	body->t = 0.0f;
 }
 
+void
+cpBodyActivate(cpBody *body)
+{
+	if(body->sleeping && body->space) cpSpaceActivateBody(body->space, body);
+}
+
 void
 cpBodyApplyForce(cpBody *body, cpVect f, cpVect r)
 {
+	if(body->sleeping) cpBodyActivate(body);
+	
 	body->f = cpvadd(body->f, f);
 	body->t += cpvcross(r, f);
 }
@@ -142,9 +188,9 @@ cpDampedSpring(cpBody *a, cpBody *b, cpVect anchr1, cpVect anchr2, cpFloat rlen,
 	
 	cpVect delta = cpvsub(cpvadd(b->p, r2), cpvadd(a->p, r1));
 	cpFloat dist = cpvlength(delta);
-	cpVect n = dist ? cpvmult(delta, 1.0f/dist) : cpvzero;
+	cpVect n = dist ? cpvmult(delta, cpfdiv(CP_FLOAT(1.0f), dist)) : cpvzero;
 	
-	cpFloat f_spring = (dist - rlen)*k;
+	cpFloat f_spring = cpfmul(dist - rlen, k);
 
 	// Calculate the world relative velocities of the anchor points.
 	cpVect v1 = cpvadd(a->v, cpvmult(cpvperp(r1), a->w));
@@ -153,7 +199,7 @@ cpDampedSpring(cpBody *a, cpBody *b, cpVect anchr1, cpVect anchr2, cpFloat rlen,
 	// Calculate the damping force.
 	// This really should be in the impulse solver and can produce problems when using large damping values.
 	cpFloat vrn = cpvdot(cpvsub(v2, v1), n);
-	cpFloat f_damp = vrn*cpfmin(dmp, 1.0f/(dt*(a->m_inv + b->m_inv)));
+	cpFloat f_damp = cpfmul(vrn, cpfmin(dmp, cpfdiv(CP_FLOAT(1.0f), cpfmul(dt, a->m_inv + b->m_inv))));
 	
 	// Apply!
 	cpVect f = cpvmult(n, f_spring + f_damp);
@@ -161,22 +207,16 @@ cpDampedSpring(cpBody *a, cpBody *b, cpVect anchr1, cpVect anchr2, cpFloat rlen,
 	cpBodyApplyForce(b, cpvneg(f), r2);
 }
 
-//int
-//cpBodyMarkLowEnergy(cpBody *body, cpFloat dvsq, int max)
-//{
-//	cpFloat ke = body->m*cpvdot(body->v, body->v);
-//	cpFloat re = body->i*body->w*body->w;
-//	
-//	if(ke + re > body->m*dvsq)
-//		body->active = 1;
-//	else if(body->active)
-//		body->active = (body->active + 1)%(max + 1);
-//	else {
-//		body->v = cpvzero;
-//		body->v_bias = cpvzero;
-//		body->w = 0.0f;
-//		body->w_bias = 0.0f;
-//	}
-//	
-//	return body->active;
-//}
+int
+cpBodyMarkLowEnergy(cpBody *body, cpFloat dvsq, int max)
+{
+	cpFloat ke = cpfmul(body->m, cpvdot(body->v, body->v));
+	cpFloat re = cpfmul(cpfmul(body->i, body->w), body->w);
+	
+	if(cpfadd(ke, re) > cpfmul(body->m, dvsq))
+		body->idleTicks = 0;
+	else
+		body->idleTicks++;
+	
+	return body->idleTicks >= max;
+}
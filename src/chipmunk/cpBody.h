@@ -33,7 +33,26 @@ typedef struct cpBody{
 	// Unit length 
 	cpVect rot; 
 	
-//	int active;
+	// Allocator the body is returned to by cpBodyFree(). (NULL for the heap)
+	cpAllocator *allocator;
+	
+	// Space the body was added to. NULL if it's a static or rogue body.
+	struct cpSpace *space;
+	// Linked list of the body's shapes in the space. See cpShape.next.
+	struct cpShape *shapesList;
+	
+	// Number of steps the body has been below the space's idle energy.
+	int idleTicks;
+	// True if the body is part of a sleeping island. Use cpBodyActivate() to wake it.
+	int sleeping;
+	
+	// Used by cpSpace to build islands. For a sleeping body islandParent
+	// is the root of its island and islandNext the next body in it.
+	struct cpBody *islandParent, *islandNext;
+	int islandIdle, islandStamp;
+	
+	// Index of the body in the space's cpSolver during a step.
+	int solverIndex;
 } cpBody;
 
 // Basic allocation/destruction functions
@@ -70,28 +89,39 @@ cpBodyWorld2Local(cpBody *body, cpVect v)
 	return cpvunrotate(cpvsub(v, body->p), body->rot);
 }
 
+// Wake up the body and the rest of its island if it's sleeping.
+// Call this after changing the position or velocity of a sleeping body.
+void cpBodyActivate(cpBody *body);
+
 // Apply an impulse (in world coordinates) to the body.
+// Wakes the body up if it was sleeping.
 static inline void
 cpBodyApplyImpulse(cpBody *body, cpVect j, cpVect r)
 {
-	body->v = cpvadd(body->v, cpvmult(j, body->m_inv));
-	body->w += body->i_inv*cpvcross(r, j);
+	if(body->sleeping) cpBodyActivate(body);
+	cpVect dv = cpvmult(j, body->m_inv);
+	body->v = cpv(cpfadd(body->v.x, dv.x), cpfadd(body->v.y, dv.y));
+	body->w = cpfadd(body->w, cpfmul(body->i_inv, cpvcross(r, j)));
 }
 
 // Not intended for external use. Used by cpArbiter.c and cpJoint.c.
 static inline void
 cpBodyApplyBiasImpulse(cpBody *body, cpVect j, cpVect r)
 {
-	body->v_bias = cpvadd(body->v_bias, cpvmult(j, body->m_inv));
-	body->w_bias += body->i_inv*cpvcross(r, j);
+	cpVect dv = cpvmult(j, body->m_inv);
+	body->v_bias = cpv(cpfadd(body->v_bias.x, dv.x), cpfadd(body->v_bias.y, dv.y));
+	body->w_bias = cpfadd(body->w_bias, cpfmul(body->i_inv, cpvcross(r, j)));
 }
 
 // Zero the forces on a body.
 void cpBodyResetForces(cpBody *body);
-// Apply a force (in world coordinates) to a body.
+// Apply a force (in world coordinates) to a body. Wakes the body up if it was sleeping.
 void cpBodyApplyForce(cpBody *body, cpVect f, cpVect r);
 
 // Apply a damped spring force between two bodies.
 void cpDampedSpring(cpBody *a, cpBody *b, cpVect anchr1, cpVect anchr2, cpFloat rlen, cpFloat k, cpFloat dmp, cpFloat dt);
 
-//int cpBodyMarkLowEnergy(cpBody *body, cpFloat dvsq, int max);
+// Update the body's idle tick count. The body is idle while its kinetic
+// energy is less than what a velocity change of sqrt(dvsq) would give it.
+// Returns true if it has been idle for at least max steps.
+int cpBodyMarkLowEnergy(cpBody *body, cpFloat dvsq, int max);
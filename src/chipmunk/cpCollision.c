@@ -25,32 +25,28 @@
 
 #include "chipmunk.h"
 
-typedef int (*collisionFunc)(cpShape*, cpShape*, cpContact**);
-
-static collisionFunc *colfuncs = NULL;
+typedef int (*collisionFunc)(cpShape*, cpShape*, cpContact*, cpFloat);
 
 // Add contact points for circle to circle collisions.
 // Used by several collision tests.
 static int
-circle2circleQuery(cpVect p1, cpVect p2, cpFloat r1, cpFloat r2, cpContact **con)
+circle2circleQuery(cpVect p1, cpVect p2, cpFloat r1, cpFloat r2, cpContactID id, cpContact *con)
 {
 	cpFloat mindist = r1 + r2;
 	cpVect delta = cpvsub(p2, p1);
 	cpFloat distsq = cpvlengthsq(delta);
-	if(distsq >= mindist*mindist) return 0;
+	if(distsq >= cpfmul(mindist, mindist)) return 0;
 	
-	cpFloat dist = sqrt2(distsq);
+	cpFloat dist = cpfsqrt(distsq);
 	// To avoid singularities, do nothing in the case of dist = 0.
-	cpFloat non_zero_dist = (dist ? dist : INFINITY);
+	cpFloat non_zero_dist = (dist ? dist : CP_INFINITY);
 
-	// Allocate and initialize the contact.
-	(*con) = (cpContact *)malloc(sizeof(cpContact));
 	cpContactInit(
-		(*con),
-		cpvadd(p1, cpvmult(delta, 0.5 + (r1 - 0.5*mindist)/non_zero_dist)),
-		cpvmult(delta, 1.0/non_zero_dist),
+		con,
+		cpvadd(p1, cpvmult(delta, CP_FLOAT(0.5f) + cpfdiv(r1 - cpfmul(CP_FLOAT(0.5f), mindist), non_zero_dist))),
+		cpvmult(delta, cpfdiv(CP_FLOAT(1.0f), non_zero_dist)),
 		dist - mindist,
-		0
+		id
 	);
 	
 	return 1;
@@ -58,24 +54,24 @@ circle2circleQuery(cpVect p1, cpVect p2, cpFloat r1, cpFloat r2, cpContact **con
 
 // Collide circle shapes.
 static int
-circle2circle(cpShape *shape1, cpShape *shape2, cpContact **arr)
+circle2circle(cpShape *shape1, cpShape *shape2, cpContact *arr, cpFloat slop)
 {
 	cpCircleShape *circ1 = (cpCircleShape *)shape1;
 	cpCircleShape *circ2 = (cpCircleShape *)shape2;
 	
-	return circle2circleQuery(circ1->tc, circ2->tc, circ1->r, circ2->r, arr);
+	return circle2circleQuery(circ1->tc, circ2->tc, circ1->r, circ2->r, CP_CONTACT_ID(CP_FEATURE_VERT(0), CP_FEATURE_VERT(0)), arr);
 }
 
 // Collide circles to segment shapes.
 static int
-circle2segment(cpShape *circleShape, cpShape *segmentShape, cpContact **con)
+circle2segment(cpShape *circleShape, cpShape *segmentShape, cpContact *con, cpFloat slop)
 {
 	cpCircleShape *circ = (cpCircleShape *)circleShape;
 	cpSegmentShape *seg = (cpSegmentShape *)segmentShape;
 	
 	// Calculate normal distance from segment.
 	cpFloat dn = cpvdot(seg->tn, circ->tc) - cpvdot(seg->ta, seg->tn);
-	cpFloat dist = fabs(dn) - circ->r - seg->r;
+	cpFloat dist = cpfabs(dn) - circ->r - seg->r;
 	if(dist > 0.0f) return 0;
 	
 	// Calculate tangential distance along segment.
@@ -88,23 +84,22 @@ circle2segment(cpShape *circleShape, cpShape *segmentShape, cpContact **con)
 		if(dt < (dtMin - circ->r)){
 			return 0;
 		} else {
-			return circle2circleQuery(circ->tc, seg->ta, circ->r, seg->r, con);
+			return circle2circleQuery(circ->tc, seg->ta, circ->r, seg->r, CP_CONTACT_ID(CP_FEATURE_VERT(0), CP_FEATURE_VERT(0)), con);
 		}
 	} else {
 		if(dt < dtMax){
 			cpVect n = (dn < 0.0f) ? seg->tn : cpvneg(seg->tn);
-			(*con) = (cpContact *)malloc(sizeof(cpContact));
 			cpContactInit(
-				(*con),
-				cpvadd(circ->tc, cpvmult(n, circ->r + dist*0.5f)),
+				con,
+				cpvadd(circ->tc, cpvmult(n, circ->r + cpfmul(dist, CP_FLOAT(0.5f)))),
 				n,
 				dist,
-				0				 
+				CP_CONTACT_ID(CP_FEATURE_VERT(0), CP_FEATURE_EDGE(0))
 			);
 			return 1;
 		} else {
 			if(dt < (dtMax + circ->r)) {
-				return circle2circleQuery(circ->tc, seg->tb, circ->r, seg->r, con);
+				return circle2circleQuery(circ->tc, seg->tb, circ->r, seg->r, CP_CONTACT_ID(CP_FEATURE_VERT(0), CP_FEATURE_VERT(1)), con);
 			} else {
 				return 0;
 			}
@@ -114,98 +109,125 @@ circle2segment(cpShape *circleShape, cpShape *segmentShape, cpContact **con)
 	return 1;
 }
 
-// Helper function for allocating contact point lists.
-static cpContact *
-addContactPoint(cpContact **arr, int *max, int *num)
+// Edge of a shape used to build a contact manifold.
+typedef struct clipEdge{
+	cpVect a, b;
+	// Features of the end points and of the edge itself.
+	unsigned int fa, fb, edge;
+} clipEdge;
+
+static inline clipEdge
+polyEdge(cpPolyShape *poly, int i)
 {
-	if(*arr == NULL){
-		// Allocate the array if it hasn't been done.
-		(*max) = 2;
-		(*num) = 0;
-		(*arr) = (cpContact *)malloc((*max)*sizeof(cpContact));
-	} else if(*num == *max){
-		// Extend it if necessary.
-		(*max) *= 2;
-		(*arr) = (cpContact *)realloc2(*arr, (*max)*sizeof(cpContact), ((*max) / 2)*sizeof(cpContact));
-	}
-	
-	cpContact *con = &(*arr)[*num];
-	(*num)++;
-	
-	return con;
+	int j = (i + 1)%poly->numVerts;
+	clipEdge edge = {poly->tVerts[i], poly->tVerts[j], CP_FEATURE_VERT(i), CP_FEATURE_VERT(j), CP_FEATURE_EDGE(i)};
+	return edge;
 }
 
-// Find the minimum separating axis for the give poly and axis list.
+// Find the edge of the poly that faces the most against n.
 static inline int
-findMSA(cpPolyShape *poly, cpPolyShapeAxis *axes, int num, cpFloat *min_out)
+findIncident(cpPolyShape *poly, cpVect n)
 {
-	int min_index = 0;
-	cpFloat min = cpPolyShapeValueOnAxis(poly, axes->n, axes->d);
-	if(min > 0.0) return -1;
+	cpPolyShapeAxis *axes = poly->tAxes;
 	
-	for(int i=1; i<num; i++){
-		cpFloat dist = cpPolyShapeValueOnAxis(poly, axes[i].n, axes[i].d);
-		if(dist > 0.0) {
-			return -1;
-		} else if(dist > min){
-			min = dist;
+	int min_index = 0;
+	cpFloat min = cpvdot(axes[0].n, n);
+	for(int i=1; i<poly->numVerts; i++){
+		cpFloat dot = cpvdot(axes[i].n, n);
+		if(dot < min){
+			min = dot;
 			min_index = i;
 		}
 	}
 	
-	(*min_out) = min;
 	return min_index;
 }
 
-// Add contacts for penetrating vertexes.
-static inline int
-findVerts(cpContact **arr, cpPolyShape *poly1, cpPolyShape *poly2, cpVect n, cpFloat dist)
+// Build the contacts between a reference edge and an incident edge.
+// n and d are the plane of the reference edge with n pointing out of its shape.
+// The incident edge is clipped to the sides of the reference edge, and the
+// ends that are behind the plane become contacts with the normal contact_n.
+// An end that was clipped is named by the reference vertex and the incident
+// edge, otherwise by the reference edge and the incident vertex.
+// flip is true when the reference edge belongs to the second shape.
+static int
+clipContacts(cpContact *arr, clipEdge ref, clipEdge inc, cpVect n, cpFloat d, cpVect contact_n, int flip)
 {
-	int max = 0;
-	int num = 0;
+	// Distances along the reference edge.
+	cpVect t = cpvperp(n);
+	cpFloat lo = cpvdot(t, ref.a);
+	cpFloat hi = cpvdot(t, ref.b);
+	unsigned int flo = ref.fa;
+	unsigned int fhi = ref.fb;
+	if(lo > hi){
+		cpFloat temp = lo; lo = hi; hi = temp;
+		unsigned int ftemp = flo; flo = fhi; fhi = ftemp;
+	}
+	
+	cpFloat sa = cpvdot(t, inc.a);
+	cpFloat sb = cpvdot(t, inc.b);
+	if((sa < lo && sb < lo) || (sa > hi && sb > hi)) return 0;
 	
-	for(int i=0; i<poly1->numVerts; i++){
-		cpVect v = poly1->tVerts[i];
-		if(cpPolyShapeContainsVert(poly2, v))
-			cpContactInit(addContactPoint(arr, &max, &num), v, n, dist, CP_HASH_PAIR(poly1, i));
+	cpVect points[] = {inc.a, inc.b};
+	cpFloat s[] = {sa, sb};
+	unsigned int refFeatures[] = {ref.edge, ref.edge};
+	unsigned int incFeatures[] = {inc.fa, inc.fb};
+	
+	for(int i=0; i<2; i++){
+		if(s[i] < lo){
+			points[i] = cpvlerp(inc.a, inc.b, cpfdiv(lo - sa, sb - sa));
+			refFeatures[i] = flo;
+			incFeatures[i] = inc.edge;
+		} else if(s[i] > hi){
+			points[i] = cpvlerp(inc.a, inc.b, cpfdiv(hi - sa, sb - sa));
+			refFeatures[i] = fhi;
+			incFeatures[i] = inc.edge;
+		}
 	}
 	
-	for(int i=0; i<poly2->numVerts; i++){
-		cpVect v = poly2->tVerts[i];
-		if(cpPolyShapeContainsVert(poly1, v))
-			cpContactInit(addContactPoint(arr, &max, &num), v, n, dist, CP_HASH_PAIR(poly2, i));
+	int num = 0;
+	for(int i=0; i<2; i++){
+		cpFloat dist = cpvdot(n, points[i]) - d;
+		if(dist > 0.0f) continue;
+		
+		cpContactID id = (flip ? CP_CONTACT_ID(incFeatures[i], refFeatures[i]) : CP_CONTACT_ID(refFeatures[i], incFeatures[i]));
+		cpContactInit(&arr[num++], points[i], contact_n, dist, id);
 	}
 	
-	//	if(!num)
-	//		addContactPoint(arr, &size, &num, cpContactNew(shape1->body->p, n, dist, 0));
-
 	return num;
 }
 
 // Collide poly shapes together.
 static int
-poly2poly(cpShape *shape1, cpShape *shape2, cpContact **arr)
+poly2poly(cpShape *shape1, cpShape *shape2, cpContact *arr, cpFloat slop)
 {
 	cpPolyShape *poly1 = (cpPolyShape *)shape1;
 	cpPolyShape *poly2 = (cpPolyShape *)shape2;
 	
 	cpFloat min1;
-	int mini1 = findMSA(poly2, poly1->tAxes, poly1->numVerts, &min1);
+	int mini1 = cpPolyShapeFindMSA(poly2, poly1, &min1);
 	if(mini1 == -1) return 0;
 	
 	cpFloat min2;
-	int mini2 = findMSA(poly1, poly2->tAxes, poly2->numVerts, &min2);
+	int mini2 = cpPolyShapeFindMSA(poly1, poly2, &min2);
 	if(mini2 == -1) return 0;
 	
-	// There is overlap, find the penetrating verts
-	if(min1 > min2)
-		return findVerts(arr, poly1, poly2, poly1->tAxes[mini1].n, min1);
-	else
-		return findVerts(arr, poly1, poly2, cpvneg(poly2->tAxes[mini2].n), min2);
+	// The edge of the least penetrating axis is the reference edge. Resting
+	// polys of the same size have nearly equal axes, so poly1 is preferred
+	// unless poly2 is clearly better to keep the contact ids from flipping.
+	if(min2 > min1 + cpfmul(slop, CP_FLOAT(0.1f))){
+		cpPolyShapeAxis axis = poly2->tAxes[mini2];
+		clipEdge inc = polyEdge(poly1, findIncident(poly1, axis.n));
+		return clipContacts(arr, polyEdge(poly2, mini2), inc, axis.n, axis.d, cpvneg(axis.n), 1);
+	} else {
+		cpPolyShapeAxis axis = poly1->tAxes[mini1];
+		clipEdge inc = polyEdge(poly2, findIncident(poly2, axis.n));
+		return clipContacts(arr, polyEdge(poly1, mini1), inc, axis.n, axis.d, axis.n, 0);
+	}
 }
 
 // Like cpPolyValueOnAxis(), but for segments.
-static inline float
+static inline cpFloat
 segValueOnAxis(cpSegmentShape *seg, cpVect n, cpFloat d)
 {
 	cpFloat a = cpvdot(n, seg->ta) - seg->r;
@@ -213,29 +235,11 @@ segValueOnAxis(cpSegmentShape *seg, cpVect n, cpFloat d)
 	return cpfmin(a, b) - d;
 }
 
-// Identify vertexes that have penetrated the segment.
-static inline void
-findPointsBehindSeg(cpContact **arr, int *max, int *num, cpSegmentShape *seg, cpPolyShape *poly, cpFloat pDist, cpFloat coef) 
-{
-	cpFloat dta = cpvcross(seg->tn, seg->ta);
-	cpFloat dtb = cpvcross(seg->tn, seg->tb);
-	cpVect n = cpvmult(seg->tn, coef);
-	
-	for(int i=0; i<poly->numVerts; i++){
-		cpVect v = poly->tVerts[i];
-		if(cpvdot(v, n) < cpvdot(seg->tn, seg->ta)*coef + seg->r){
-			cpFloat dt = cpvcross(seg->tn, v);
-			if(dta >= dt && dt >= dtb){
-				cpContactInit(addContactPoint(arr, max, num), v, n, pDist, CP_HASH_PAIR(poly, i));
-			}
-		}
-	}
-}
-
-// This one is complicated and gross. Just don't go there...
-// TODO: Comment me!
+// Collide a segment with a poly. Either a side of the segment or an edge
+// of the poly is used as the reference edge for clipping.
+// The sides of the segment are edge 0 along tn and edge 1 against it.
 static int
-seg2poly(cpShape *shape1, cpShape *shape2, cpContact **arr)
+seg2poly(cpShape *shape1, cpShape *shape2, cpContact *arr, cpFloat slop)
 {
 	cpSegmentShape *seg = (cpSegmentShape *)shape1;
 	cpPolyShape *poly = (cpPolyShape *)shape2;
@@ -259,108 +263,93 @@ seg2poly(cpShape *shape1, cpShape *shape2, cpContact **arr)
 		}
 	}
 	
-	int max = 0;
-	int num = 0;
-	
-	cpVect poly_n = cpvneg(axes[mini].n);
-	
-	cpVect va = cpvadd(seg->ta, cpvmult(poly_n, seg->r));
-	cpVect vb = cpvadd(seg->tb, cpvmult(poly_n, seg->r));
-	if(cpPolyShapeContainsVert(poly, va))
-		cpContactInit(addContactPoint(arr, &max, &num), va, poly_n, poly_min, CP_HASH_PAIR(seg, 0));
-	if(cpPolyShapeContainsVert(poly, vb))
-		cpContactInit(addContactPoint(arr, &max, &num), vb, poly_n, poly_min, CP_HASH_PAIR(seg, 1));
-
 	// Floating point precision problems here.
-	// This will have to do for now.
-	poly_min -= cp_collision_slop;
-	if(minNorm >= poly_min || minNeg >= poly_min) {
-		if(minNorm > minNeg)
-			findPointsBehindSeg(arr, &max, &num, seg, poly, minNorm, 1.0f);
-		else
-			findPointsBehindSeg(arr, &max, &num, seg, poly, minNeg, -1.0f);
+	// Prefer the segment's side unless the poly's edge is clearly better.
+	if(cpfmax(minNorm, minNeg) >= poly_min - slop){
+		int side = (minNorm > minNeg ? 0 : 1);
+		cpVect n = (side ? cpvneg(seg->tn) : seg->tn);
+		cpFloat d = (side ? -segD : segD) + seg->r;
+		
+		clipEdge ref = {seg->ta, seg->tb, CP_FEATURE_VERT(0), CP_FEATURE_VERT(1), CP_FEATURE_EDGE(side)};
+		clipEdge inc = polyEdge(poly, findIncident(poly, n));
+		return clipContacts(arr, ref, inc, n, d, n, 0);
+	} else {
+		cpVect poly_n = cpvneg(axes[mini].n);
+		cpVect r = cpvmult(poly_n, seg->r);
+		int side = (cpvdot(seg->tn, poly_n) > 0.0f ? 0 : 1);
+		
+		clipEdge inc = {cpvadd(seg->ta, r), cpvadd(seg->tb, r), CP_FEATURE_VERT(0), CP_FEATURE_VERT(1), CP_FEATURE_EDGE(side)};
+		return clipContacts(arr, polyEdge(poly, mini), inc, axes[mini].n, axes[mini].d, poly_n, 1);
 	}
-
-	return num;
 }
 
 // This one is less gross, but still gross.
 // TODO: Comment me!
 static int
-circle2poly(cpShape *shape1, cpShape *shape2, cpContact **con)
+circle2poly(cpShape *shape1, cpShape *shape2, cpContact *con, cpFloat slop)
 {
 	cpCircleShape *circ = (cpCircleShape *)shape1;
 	cpPolyShape *poly = (cpPolyShape *)shape2;
 	cpPolyShapeAxis *axes = poly->tAxes;
 	
-	int mini = 0;
-	cpFloat min = cpvdot(axes->n, circ->tc) - axes->d - circ->r;
-	for(int i=0; i<poly->numVerts; i++){
-		cpFloat dist = cpvdot(axes[i].n, circ->tc) - axes[i].d - circ->r;
-		if(dist > 0.0){
-			return 0;
-		} else if(dist > min) {
-			min = dist;
-			mini = i;
-		}
-	}
+	cpFloat min;
+	int mini = cpPolyShapeFindPointAxis(poly, circ->tc, circ->r, &min);
+	if(mini == -1) return 0;
 	
 	cpVect n = axes[mini].n;
 	cpVect a = poly->tVerts[mini];
-	cpVect b = poly->tVerts[(mini + 1)%poly->numVerts];
+	int next = (mini + 1)%poly->numVerts;
+	cpVect b = poly->tVerts[next];
 	cpFloat dta = cpvcross(n, a);
 	cpFloat dtb = cpvcross(n, b);
 	cpFloat dt = cpvcross(n, circ->tc);
 		
 	if(dt < dtb){
-		return circle2circleQuery(circ->tc, b, circ->r, 0.0f, con);
+		return circle2circleQuery(circ->tc, b, circ->r, 0.0f, CP_CONTACT_ID(CP_FEATURE_VERT(0), CP_FEATURE_VERT(next)), con);
 	} else if(dt < dta) {
-		(*con) = (cpContact *)malloc(sizeof(cpContact));
 		cpContactInit(
-			(*con),
-			cpvsub(circ->tc, cpvmult(n, circ->r + min/2.0f)),
+			con,
+			cpvsub(circ->tc, cpvmult(n, circ->r + cpfdiv(min, CP_FLOAT(2.0f)))),
 			cpvneg(n),
 			min,
-			0				 
+			CP_CONTACT_ID(CP_FEATURE_VERT(0), CP_FEATURE_EDGE(mini))
 		);
 	
 		return 1;
 	} else {
-		return circle2circleQuery(circ->tc, a, circ->r, 0.0f, con);
+		return circle2circleQuery(circ->tc, a, circ->r, 0.0f, CP_CONTACT_ID(CP_FEATURE_VERT(0), CP_FEATURE_VERT(mini)), con);
 	}
 }
 
-static void
-addColFunc(cpShapeType a, cpShapeType b, collisionFunc func)
-{
-	colfuncs[a + b*CP_NUM_SHAPES] = func;
-}
+// Collision functions indexed by [b->type][a->type]. The table is constant
+// so that spaces on different threads can share it.
+static const collisionFunc colfuncs[CP_NUM_SHAPES][CP_NUM_SHAPES] = {
+	//  circle           segment    poly
+	{circle2circle,   NULL,      NULL},      // circle
+	{circle2segment,  NULL,      NULL},      // segment
+	{circle2poly,     seg2poly,  poly2poly}, // poly
+};
 
 #ifdef __cplusplus
 extern "C" {
 #endif
-	// Initializes the array of collision functions.
-	// Called by cpInitChipmunk().
+	// The collision function table is filled in at compile time now.
+	// Kept so that cpInitChipmunk() still links.
 	void
 	cpInitCollisionFuncs(void)
 	{
-		if(!colfuncs)
-			colfuncs = (collisionFunc *)calloc(CP_NUM_SHAPES*CP_NUM_SHAPES, sizeof(collisionFunc));
-		
-		addColFunc(CP_CIRCLE_SHAPE,  CP_CIRCLE_SHAPE,  circle2circle);
-		addColFunc(CP_CIRCLE_SHAPE,  CP_SEGMENT_SHAPE, circle2segment);
-		addColFunc(CP_SEGMENT_SHAPE, CP_POLY_SHAPE,    seg2poly);
-		addColFunc(CP_CIRCLE_SHAPE,  CP_POLY_SHAPE,    circle2poly);
-		addColFunc(CP_POLY_SHAPE,    CP_POLY_SHAPE,    poly2poly);
-	}	
+	}
 #ifdef __cplusplus
 }
 #endif
 
 int
-cpCollideShapes(cpShape *a, cpShape *b, cpContact **arr)
+cpCollideShapes(cpShape *a, cpShape *b, cpFloat slop, cpContactBuffer *buffer, cpContact **arr)
 {
 	// Their shape types must be in order.
-	collisionFunc cfunc = colfuncs[a->type + b->type*CP_NUM_SHAPES];
-	return (cfunc) ? cfunc(a, b, arr) : 0;
+	collisionFunc cfunc = colfuncs[b->type][a->type];
+	if(!cfunc) return 0;
+	
+	(*arr) = cpContactBufferReserve(buffer, CP_MAX_CONTACTS_PER_ARBITER);
+	return cfunc(a, b, *arr, slop);
 }
@@ -20,4 +20,6 @@
  */
 
 // Collides two cpShape structures. (this function is lonely :( )
-int cpCollideShapes(cpShape *a, cpShape *b, cpContact **arr);
+// The contacts are reserved from the buffer and need to be committed to keep them.
+// slop is the amount of allowed penetration. (see cpSpace.collisionSlop)
+int cpCollideShapes(cpShape *a, cpShape *b, cpFloat slop, cpContactBuffer *buffer, cpContact **arr);
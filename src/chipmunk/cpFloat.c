@@ -0,0 +1,125 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ 
+ 
+#include "chipmunk.h"
+
+#ifdef CP_USE_FIXED
+
+#define FIXED_PI CP_FLOAT(3.14159265358979323846)
+// Constant with 30 fractional bits.
+#define Q30(x) ((int64_t)((x)*1073741824.0 + ((x) < 0 ? -0.5 : 0.5)))
+
+// Integer square root, rounded down.
+static uint64_t
+isqrt64(uint64_t n)
+{
+	uint64_t root = 0;
+	uint64_t bit = (uint64_t)1 << 62;
+	while(bit > n) bit >>= 2;
+	
+	while(bit){
+		if(n >= root + bit){
+			n -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	
+	return root;
+}
+
+cpFloat
+cpfsqrt(cpFloat x)
+{
+	if(x <= 0) return 0;
+	
+	// Scaling by one more CP_FIXED_ONE keeps the root in fixed point.
+	return cpfsaturate((int64_t)isqrt64((uint64_t)x << CP_FIXED_FRAC_BITS));
+}
+
+cpFloat
+cpfhypot(cpFloat x, cpFloat y)
+{
+	// The squares are summed with twice the fraction bits,
+	// so the root comes out in fixed point without a shift.
+	uint64_t sq = (uint64_t)((int64_t)x*x) + (uint64_t)((int64_t)y*y);
+	return cpfsaturate((int64_t)isqrt64(sq));
+}
+
+cpFloat
+cpfsin(cpFloat a)
+{
+	// Wrap the angle to [-pi, pi], then fold it into [-pi/2, pi/2].
+	int64_t twoPi = 2*(int64_t)FIXED_PI;
+	int64_t x = ((int64_t)a + FIXED_PI)%twoPi;
+	if(x < 0) x += twoPi;
+	x -= FIXED_PI;
+	
+	if(x > FIXED_PI/2) x = FIXED_PI - x;
+	if(x < -FIXED_PI/2) x = -FIXED_PI - x;
+	
+	// Taylor series up to x^9, evaluated with 30 fractional bits so the
+	// small coefficients don't round away. (error is below 4e-6)
+	int64_t t = (int64_t)x*((int64_t)1 << (30 - CP_FIXED_FRAC_BITS));
+	int64_t t2 = (t*t) >> 30;
+	int64_t sum = Q30(1.0/362880.0);
+	sum = Q30(-1.0/5040.0) + ((t2*sum) >> 30);
+	sum = Q30(1.0/120.0) + ((t2*sum) >> 30);
+	sum = Q30(-1.0/6.0) + ((t2*sum) >> 30);
+	sum = Q30(1.0) + ((t2*sum) >> 30);
+	return (cpFloat)(((t*sum) >> 30) >> (30 - CP_FIXED_FRAC_BITS));
+}
+
+cpFloat
+cpfcos(cpFloat a)
+{
+	return cpfsin((cpFloat)(((int64_t)a + FIXED_PI/2)%(2*(int64_t)FIXED_PI)));
+}
+
+cpFloat
+cpfatan2(cpFloat y, cpFloat x)
+{
+	if(x == 0 && y == 0) return 0;
+	
+	// Reduce to atan(z) with z in [0, 1] and fix up the octant after.
+	cpFloat ax = cpfabs(x), ay = cpfabs(y);
+	int swap = (ay > ax);
+	cpFloat z = (swap ? cpfdiv(ax, ay) : cpfdiv(ay, ax));
+	
+	// Polynomial fit of atan() on [0, 1]. (error is below 1e-5)
+	int64_t t = (int64_t)z << (30 - CP_FIXED_FRAC_BITS);
+	int64_t t2 = (t*t) >> 30;
+	int64_t sum = Q30(0.0208351);
+	sum = Q30(-0.0851330) + ((t2*sum) >> 30);
+	sum = Q30(0.1801410) + ((t2*sum) >> 30);
+	sum = Q30(-0.3302995) + ((t2*sum) >> 30);
+	sum = Q30(0.9998660) + ((t2*sum) >> 30);
+	cpFloat angle = (cpFloat)(((t*sum) >> 30) >> (30 - CP_FIXED_FRAC_BITS));
+	
+	if(swap) angle = FIXED_PI/2 - angle;
+	if(x < 0) angle = FIXED_PI - angle;
+	return (y < 0 ? -angle : angle);
+}
+
+#endif
@@ -0,0 +1,254 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+// cpFloat is the scalar type used for all of the math in Chipmunk.
+//
+// By default it's a float. Define CP_USE_DOUBLE to make it a double, for
+// worlds large enough that floats lose precision far from the origin.
+// Define CP_USE_FIXED to make it a Q16.16 fixed point number instead, for
+// targets without an FPU (like Pebble) where every float operation is
+// emulated in software. Define CP_FIXED_FRAC_BITS
+// to use a different Q format. More fractional bits give more precision but
+// less range. With Q16.16, coordinates and other values should stay well
+// within +/-32768. The squared distances that the collision code uses are
+// only computed for nearby points.
+//
+// C has no operator overloading, so the code never multiplies or divides
+// cpFloats directly. It uses cpfmul() and cpfdiv(), and wraps constants in
+// CP_FLOAT(). Write constants without an f suffix so that double builds
+// get them at full precision. Addition, subtraction and comparisons work
+// on all of the types as is. In fixed point mode, multiplication, division
+// and the conversions saturate instead of overflowing.
+
+#if defined(CP_USE_FIXED) && defined(CP_USE_DOUBLE)
+	#error "CP_USE_FIXED and CP_USE_DOUBLE can't be used together."
+#endif
+
+#ifdef CP_USE_FIXED
+
+#include <stdint.h>
+
+#ifndef CP_FIXED_FRAC_BITS
+#define CP_FIXED_FRAC_BITS 16
+#endif
+
+typedef int32_t cpFloat;
+
+#define CP_FIXED_ONE ((int32_t)1 << CP_FIXED_FRAC_BITS)
+#define CP_FLOAT_MAX INT32_MAX
+#define CP_FLOAT_MIN INT32_MIN
+
+// Convert a constant to a cpFloat. Rounds to the nearest value.
+#define CP_FLOAT(x) ((cpFloat)((x)*(double)CP_FIXED_ONE + ((x) < 0 ? -0.5 : 0.5)))
+// Used in place of INFINITY for things like infinite masses.
+#define CP_INFINITY CP_FLOAT_MAX
+
+static inline cpFloat
+cpfsaturate(int64_t x)
+{
+	return (x > INT32_MAX ? INT32_MAX : (x < INT32_MIN ? INT32_MIN : (cpFloat)x));
+}
+
+// Saturating addition and subtraction. Only needed for sums of values that
+// can get close to the ends of the range, like areas or accumulated impulses
+// that were built from saturated products.
+static inline cpFloat
+cpfadd(cpFloat a, cpFloat b)
+{
+	return cpfsaturate((int64_t)a + b);
+}
+
+static inline cpFloat
+cpfsub(cpFloat a, cpFloat b)
+{
+	return cpfsaturate((int64_t)a - b);
+}
+
+// Rounds to nearest. Truncating would bias every product towards -infinity,
+// which shows up as drift in resting stacks.
+static inline cpFloat
+cpfmul(cpFloat a, cpFloat b)
+{
+	return cpfsaturate(((int64_t)a*b + (CP_FIXED_ONE >> 1)) >> CP_FIXED_FRAC_BITS);
+}
+
+// a*b + c*d with a single rounding. The products are summed in 64 bits so
+// dot and cross products of large vectors saturate instead of overflowing.
+static inline cpFloat
+cpfmul2(cpFloat a, cpFloat b, cpFloat c, cpFloat d)
+{
+	return cpfsaturate(((int64_t)a*b + (int64_t)c*d + (CP_FIXED_ONE >> 1)) >> CP_FIXED_FRAC_BITS);
+}
+
+// Dividing by zero gives the largest value with the sign of a. Dividing by
+// CP_INFINITY gives zero like it does for floats, so bodies with infinite
+// mass or moment get an inverse of exactly zero.
+static inline cpFloat
+cpfdiv(cpFloat a, cpFloat b)
+{
+	if(b == 0) return (a < 0 ? CP_FLOAT_MIN : CP_FLOAT_MAX);
+	if(b == CP_INFINITY || b == -CP_INFINITY) return 0;
+	return cpfsaturate((int64_t)a*CP_FIXED_ONE/b);
+}
+
+// Conversions to and from other number types. Values outside of the
+// range of a cpFloat saturate.
+static inline cpFloat
+cpffromint(int i)
+{
+	return cpfsaturate((int64_t)i*CP_FIXED_ONE);
+}
+
+static inline cpFloat
+cpffromdouble(double d)
+{
+	d *= CP_FIXED_ONE;
+	if(d >= (double)INT32_MAX) return INT32_MAX;
+	if(d <= (double)INT32_MIN) return INT32_MIN;
+	return (cpFloat)(d < 0.0 ? d - 0.5 : d + 0.5);
+}
+
+static inline double
+cpftodouble(cpFloat x)
+{
+	return (double)x/CP_FIXED_ONE;
+}
+
+// Integer part of x, rounded towards zero like a cast.
+static inline int
+cpftoint(cpFloat x)
+{
+	return x/CP_FIXED_ONE;
+}
+
+static inline cpFloat
+cpfabs(cpFloat x)
+{
+	return (x < 0 ? (x == INT32_MIN ? INT32_MAX : -x) : x);
+}
+
+// Remainder of a/b with the sign of a, like fmodf().
+static inline cpFloat
+cpfmod(cpFloat a, cpFloat b)
+{
+	return (b ? a%b : 0);
+}
+
+cpFloat cpfsqrt(cpFloat x);
+// Length of (x, y). Squaring anything over 181 overflows a cpFloat,
+// so this doesn't go through cpfsqrt().
+cpFloat cpfhypot(cpFloat x, cpFloat y);
+cpFloat cpfsin(cpFloat a);
+cpFloat cpfcos(cpFloat a);
+cpFloat cpfatan2(cpFloat y, cpFloat x);
+
+static inline cpFloat
+cpfrsqrt(cpFloat x)
+{
+	return cpfdiv(CP_FIXED_ONE, cpfsqrt(x));
+}
+
+#else
+
+#ifdef CP_USE_DOUBLE
+
+typedef double cpFloat;
+
+#define CP_FLOAT_MAX DBL_MAX
+#define CP_FLOAT_MIN (-DBL_MAX)
+
+// Picks the libm function for cpFloat, sqrt() for doubles or sqrtf() for floats.
+#define CP_LIBM(name) name
+
+#else
+
+typedef float cpFloat;
+
+#define CP_FLOAT_MAX FLT_MAX
+#define CP_FLOAT_MIN (-FLT_MAX)
+
+#define CP_LIBM(name) name##f
+
+#endif
+
+#define CP_FLOAT(x) ((cpFloat)(x))
+#define CP_INFINITY INFINITY
+
+static inline cpFloat cpfadd(cpFloat a, cpFloat b){return a + b;}
+static inline cpFloat cpfsub(cpFloat a, cpFloat b){return a - b;}
+static inline cpFloat cpfmul(cpFloat a, cpFloat b){return a*b;}
+static inline cpFloat cpfdiv(cpFloat a, cpFloat b){return a/b;}
+static inline cpFloat cpfmul2(cpFloat a, cpFloat b, cpFloat c, cpFloat d){return a*b + c*d;}
+
+static inline cpFloat cpffromint(int i){return (cpFloat)i;}
+static inline cpFloat cpffromdouble(double d){return (cpFloat)d;}
+static inline double cpftodouble(cpFloat x){return x;}
+static inline int cpftoint(cpFloat x){return (int)x;}
+static inline cpFloat cpfabs(cpFloat x){return CP_LIBM(fabs)(x);}
+static inline cpFloat cpfmod(cpFloat a, cpFloat b){return CP_LIBM(fmod)(a, b);}
+
+// Reciprocal square root. By default this uses sqrtf(), which compiles to a
+// single instruction on targets with an FPU. Define CP_NO_FPU_SQRT on targets
+// without one to use a bit trick estimate with one Newton step instead.
+// That is accurate to about 0.2%. The trick only works on floats, so double
+// builds ignore it.
+static inline cpFloat
+cpfrsqrt(cpFloat x)
+{
+#if defined(CP_NO_FPU_SQRT) && !defined(CP_USE_DOUBLE)
+	union {float f; unsigned int i;} u = {(float)x};
+	u.i = 0x5f3759df - (u.i >> 1);
+	return u.f*(1.5f - 0.5f*x*u.f*u.f);
+#else
+	return CP_FLOAT(1.0)/CP_LIBM(sqrt)(x);
+#endif
+}
+
+static inline cpFloat
+cpfsqrt(cpFloat x)
+{
+#if defined(CP_NO_FPU_SQRT) && !defined(CP_USE_DOUBLE)
+	return x*cpfrsqrt(x);
+#else
+	return CP_LIBM(sqrt)(x);
+#endif
+}
+
+static inline cpFloat cpfhypot(cpFloat x, cpFloat y){return cpfsqrt(x*x + y*y);}
+
+static inline cpFloat cpfsin(cpFloat a){return CP_LIBM(sin)(a);}
+static inline cpFloat cpfcos(cpFloat a){return CP_LIBM(cos)(a);}
+static inline cpFloat cpfatan2(cpFloat y, cpFloat x){return CP_LIBM(atan2)(y, x);}
+
+#endif
+
+static inline cpFloat
+cpfmax(cpFloat a, cpFloat b)
+{
+	return (a > b) ? a : b;
+}
+
+static inline cpFloat
+cpfmin(cpFloat a, cpFloat b)
+{
+	return (a < b) ? a : b;
+}
@@ -23,23 +23,33 @@
 #include <assert.h>
 
 #include "chipmunk.h"
-#include "prime.h"
+
+// Smallest table, also used for sets created with a size of 0.
+#define MIN_SIZE 8
+
+// Hashes are used as is, apart from folding the high half into the low
+// half. Shape ids are small, so sets keyed by id map them to themselves
+// and iterate in id order, which is also allocation order in memory.
+// Pointer hashes are mixed with cpHashMix() beforehand.
+static inline int
+homeSlot(cpHashSet *set, unsigned int hash)
+{
+	return (int)((hash ^ (hash >> 16)) & (set->size - 1));
+}
+
+static void
+allocTable(cpHashSet *set, int size)
+{
+	int newSize = 1;
+	while(newSize < size) newSize *= 2;
+	
+	set->size = newSize;
+	set->table = (cpHashSetBin *)calloc(set->size, sizeof(cpHashSetBin));
+}
 
 void
 cpHashSetDestroy(cpHashSet *set)
 {
-	// Free the chains.
-	for(int i=0; i<set->size; i++){
-		// Free the bins in the chain.
-		cpHashSetBin *bin = set->table[i];
-		while(bin){
-			cpHashSetBin *next = bin->next;
-			free(bin);
-			bin = next;
-		}
-	}
-	
-	// Free the table.
 	free(set->table);
 }
 
@@ -59,7 +69,8 @@ cpHashSetAlloc(void)
 cpHashSet *
 cpHashSetInit(cpHashSet *set, int size, cpHashSetEqlFunc eqlFunc, cpHashSetTransFunc trans)
 {
-	set->size = next_prime(size);
+	// Leave room for size elements under the maximum load.
+	allocTable(set, size*4/3 > MIN_SIZE ? size*4/3 : MIN_SIZE);
 	set->entries = 0;
 	
 	set->eql = eqlFunc;
@@ -67,8 +78,6 @@ cpHashSetInit(cpHashSet *set, int size, cpHashSetEqlFunc eqlFunc, cpHashSetTrans
 	
 	set->default_value = NULL;
 	
-	set->table = (cpHashSetBin **)calloc(set->size, sizeof(cpHashSetBin *));
-	
 	return set;
 }
 
@@ -78,142 +87,136 @@ cpHashSetNew(int size, cpHashSetEqlFunc eqlFunc, cpHashSetTransFunc trans)
 	return cpHashSetInit(cpHashSetAlloc(), size, eqlFunc, trans);
 }
 
+// Linear probing gets slow as the table fills up, so keep it under 3/4 full.
 static int
 setIsFull(cpHashSet *set)
 {
-	return (set->entries >= set->size);
+	return (set->entries*4 >= set->size*3);
 }
 
 static void
 cpHashSetResize(cpHashSet *set)
 {
-	// Get the next approximate doubled prime.
-	int newSize = next_prime(set->size + 1);
-	// Allocate a new table.
-	cpHashSetBin **newTable = (cpHashSetBin **)calloc(newSize, sizeof(cpHashSetBin *));
+	int oldSize = set->size;
+	cpHashSetBin *oldTable = set->table;
+	allocTable(set, oldSize*2);
 	
-	// Iterate over the chains.
-	for(int i=0; i<set->size; i++){
-		// Rehash the bins into the new table.
-		cpHashSetBin *bin = set->table[i];
-		while(bin){
-			cpHashSetBin *next = bin->next;
-			
-			int index = bin->hash%newSize;
-			bin->next = newTable[index];
-			newTable[index] = bin;
-			
-			bin = next;
-		}
+	// The elements are known to be unique, so they can be placed
+	// using only their stored hashes.
+	int mask = set->size - 1;
+	for(int i=0; i<oldSize; i++){
+		cpHashSetBin *bin = &oldTable[i];
+		if(!bin->elt) continue;
+		
+		int index = homeSlot(set, bin->hash);
+		while(set->table[index].elt) index = (index + 1)&mask;
+		set->table[index] = *bin;
 	}
 	
-	free(set->table);
-	
-	set->table = newTable;
-	set->size = newSize;
+	free(oldTable);
 }
 
-void *
-cpHashSetInsert(cpHashSet *set, unsigned int hash, void *ptr, void *data)
+// Returns the slot holding the matching element or the empty slot that ends its probe run.
+static inline int
+findSlot(cpHashSet *set, unsigned int hash, void *ptr)
 {
-	int index = hash%set->size;
+	int mask = set->size - 1;
+	cpHashSetBin *table = set->table;
 	
-	// Find the bin with the matching element.
-	cpHashSetBin *bin = set->table[index];
-	while(bin && !set->eql(ptr, bin->elt))
-		bin = bin->next;
+	int index = homeSlot(set, hash);
+	while(table[index].elt && !(table[index].hash == hash && set->eql(ptr, table[index].elt)))
+		index = (index + 1)&mask;
 	
-	// Create it necessary.
-	if(!bin){
-		bin = (cpHashSetBin *)malloc(sizeof(cpHashSetBin));
-		bin->hash = hash;
-		bin->elt = set->trans(ptr, data); // Transform the pointer.
-		
-		bin->next = set->table[index];
-		set->table[index] = bin;
-		
-		set->entries++;
-		
-		// Resize the set if it's full.
-		if(setIsFull(set))
-			cpHashSetResize(set);
+	return index;
+}
+
+// Empty a slot by shifting the rest of its probe run back into the hole.
+static void
+removeSlot(cpHashSet *set, int hole)
+{
+	int mask = set->size - 1;
+	cpHashSetBin *table = set->table;
+	
+	for(int i = (hole + 1)&mask; table[i].elt; i = (i + 1)&mask){
+		// An element can only move back as far as its home slot.
+		int home = homeSlot(set, table[i].hash);
+		if(((i - home)&mask) >= ((i - hole)&mask)){
+			table[hole] = table[i];
+			hole = i;
+		}
 	}
 	
-	return bin->elt;
+	table[hole].elt = NULL;
+	set->entries--;
 }
 
 void *
-cpHashSetRemove(cpHashSet *set, unsigned int hash, void *ptr)
+cpHashSetInsert(cpHashSet *set, unsigned int hash, void *ptr, void *data)
 {
-	int index = hash%set->size;
+	int index = findSlot(set, hash, ptr);
+	cpHashSetBin *bin = &set->table[index];
+	if(bin->elt) return bin->elt;
 	
-	// Pointer to the previous bin pointer.
-	cpHashSetBin **prev_ptr = &set->table[index];
-	// Pointer the the current bin.
-	cpHashSetBin *bin = set->table[index];
+	// Create the element in the empty slot that ended the search.
+	void *elt = set->trans(ptr, data);
+	bin->elt = elt;
+	bin->hash = hash;
+	set->entries++;
 	
-	// Find the bin
-	while(bin && !set->eql(ptr, bin->elt)){
-		prev_ptr = &bin->next;
-		bin = bin->next;
-	}
+	// Resize the set if it's full.
+	if(setIsFull(set))
+		cpHashSetResize(set);
 	
-	// Remove it if it exists.
-	if(bin){
-		// Update the previos bin pointer to point to the next bin.
-		(*prev_ptr) = bin->next;
-		set->entries--;
-		
-		void *return_value = bin->elt;
-		free(bin);
-		return return_value;
-	}
+	return elt;
+}
+
+void *
+cpHashSetRemove(cpHashSet *set, unsigned int hash, void *ptr)
+{
+	int index = findSlot(set, hash, ptr);
+	void *elt = set->table[index].elt;
+	if(elt) removeSlot(set, index);
 	
-	return NULL;
+	return elt;
 }
 
 void *
 cpHashSetFind(cpHashSet *set, unsigned int hash, void *ptr)
-{	
-	int index = hash%set->size;
-	cpHashSetBin *bin = set->table[index];
-	while(bin && !set->eql(ptr, bin->elt))
-		bin = bin->next;
-		
-	return (bin ? bin->elt : set->default_value);
+{
+	void *elt = set->table[findSlot(set, hash, ptr)].elt;
+	return (elt ? elt : set->default_value);
 }
 
 void
 cpHashSetEach(cpHashSet *set, cpHashSetIterFunc func, void *data)
 {
+	cpHashSetBin *table = set->table;
 	for(int i=0; i<set->size; i++){
-		cpHashSetBin *bin;
-		for(bin = set->table[i]; bin; bin = bin->next)
-			func(bin->elt, data);
+		if(table[i].elt) func(table[i].elt, data);
 	}
 }
 
 void
 cpHashSetReject(cpHashSet *set, cpHashSetRejectFunc func, void *data)
 {
-	// Iterate over all the chains.
-	for(int i=0; i<set->size; i++){
-		// The rest works similarly to cpHashSetRemove() above.
-		cpHashSetBin **prev_ptr = &set->table[i];
-		cpHashSetBin *bin = set->table[i];
-		while(bin){
-			cpHashSetBin *next = bin->next;
-			
-			if(func(bin->elt, data)){
-				prev_ptr = &bin->next;
-			} else {
-				(*prev_ptr) = next;
-
-				set->entries--;
-				free(bin);
-			}
-			
-			bin = next;
+	if(!set->entries) return;
+	
+	int mask = set->size - 1;
+	cpHashSetBin *table = set->table;
+	
+	// Start just after an empty slot. Removing an element only shifts back
+	// elements from later in its probe run, and no run can wrap past the
+	// empty slot. So every element is passed to func() exactly once.
+	int start = 0;
+	while(table[start].elt) start++;
+	
+	int i = (start + 1)&mask;
+	while(i != start){
+		if(table[i].elt && !func(table[i].elt, data)){
+			// Check the slot again, the next element in the run may have moved into it.
+			removeSlot(set, i);
+		} else {
+			i = (i + 1)&mask;
 		}
 	}
 }
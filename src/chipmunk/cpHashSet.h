@@ -19,17 +19,21 @@
  * SOFTWARE.
  */
  
-// cpHashSet uses a chained hashtable implementation.
-// Other than the transformation functions, there is nothing fancy going on.
+// cpHashSet is an open addressing hashtable with linear probing.
+// The table size is a power of two, and each slot stores the hash of its
+// element so that most probes never call the equality function.
+// Removal shifts the rest of the probe run back instead of leaving
+// tombstones, so lookups never slow down as elements come and go.
+// Elements must not be NULL, an empty slot has a NULL element.
+// Slots are picked from the low bits of the hash, so hashes of pointers
+// should go through cpHashMix() or CP_HASH_PAIR().
 
-// cpHashSetBin's form the linked lists in the chained hash table.
+// A slot in the table.
 typedef struct cpHashSetBin {
 	// Pointer to the element.
 	void *elt;
 	// Hash value of the element.
 	unsigned int hash;
-	// Next element in the chain.
-	struct cpHashSetBin *next;
 } cpHashSetBin;
 
 // Equality function. Returns true if ptr is equal to elt.
@@ -38,13 +42,13 @@ typedef int (*cpHashSetEqlFunc)(void *ptr, void *elt);
 typedef void *(*cpHashSetTransFunc)(void *ptr, void *data);
 // Iterator function for a hashset.
 typedef void (*cpHashSetIterFunc)(void *elt, void *data);
-// Reject function. Returns true if elt should be dropped.
+// Reject function. Returns false if elt should be dropped.
 typedef int (*cpHashSetRejectFunc)(void *elt, void *data);
 
 typedef struct cpHashSet {
 	// Number of elements stored in the table.
 	int entries;
-	// Number of cells in the table.
+	// Number of slots in the table. Always a power of two.
 	int size;
 	
 	cpHashSetEqlFunc eql;
@@ -54,7 +58,7 @@ typedef struct cpHashSet {
 	// Defaults to NULL.
 	void *default_value;
 	
-	cpHashSetBin **table;
+	cpHashSetBin *table;
 } cpHashSet;
 
 // Basic allocation/destruction functions.
@@ -75,5 +79,6 @@ void *cpHashSetFind(cpHashSet *set, unsigned int hash, void *ptr);
 
 // Iterate over a hashset.
 void cpHashSetEach(cpHashSet *set, cpHashSetIterFunc func, void *data);
-// Iterate over a hashset while rejecting certain elements.
+// Iterate over a hashset, dropping the elements func() returns false for.
+// The rejected elements are dropped in the same pass without any freeing.
 void cpHashSetReject(cpHashSet *set, cpHashSetRejectFunc func, void *data);
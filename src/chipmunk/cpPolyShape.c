@@ -24,11 +24,27 @@
 #include <math.h>
 
 #include "chipmunk.h"
+#include "cpSIMD.h"
+
+#define LANES CP_SIMD_LANES
+
+// Length of the SIMD copies of the vertex and axis lists.
+static inline int
+paddedCount(int numVerts)
+{
+	return (LANES > 1 ? (numVerts + LANES - 1)/LANES*LANES : 0);
+}
+
+size_t
+cpPolyShapeSize(int numVerts)
+{
+	return sizeof(cpPolyShape) + numVerts*2*(sizeof(cpVect) + sizeof(cpPolyShapeAxis)) + paddedCount(numVerts)*5*sizeof(cpFloat);
+}
 
 cpPolyShape *
-cpPolyShapeAlloc(void)
+cpPolyShapeAlloc(int numVerts)
 {
-	return (cpPolyShape *)calloc(1, sizeof(cpPolyShape));
+	return (cpPolyShape *)calloc(1, cpPolyShapeSize(numVerts));
 }
 
 static void
@@ -39,6 +55,13 @@ cpPolyShapeTransformVerts(cpPolyShape *poly, cpVect p, cpVect rot)
 	
 	for(int i=0; i<poly->numVerts; i++)
 		dst[i] = cpvadd(p, cpvrotate(src[i], rot));
+	
+	if(!poly->xs) return;
+	for(int i=0; i<paddedCount(poly->numVerts); i++){
+		cpVect v = dst[i < poly->numVerts ? i : 0];
+		poly->xs[i] = v.x;
+		poly->ys[i] = v.y;
+	}
 }
 
 static void
@@ -52,6 +75,14 @@ cpPolyShapeTransformAxes(cpPolyShape *poly, cpVect p, cpVect rot)
 		dst[i].n = n;
 		dst[i].d = cpvdot(p, n) + src[i].d;
 	}
+	
+	if(!poly->nxs) return;
+	for(int i=0; i<paddedCount(poly->numVerts); i++){
+		cpPolyShapeAxis axis = dst[i < poly->numVerts ? i : 0];
+		poly->nxs[i] = axis.n.x;
+		poly->nys[i] = axis.n.y;
+		poly->ds[i] = axis.d;
+	}
 }
 
 static cpBB
@@ -81,27 +112,28 @@ cpPolyShapeCacheData(cpShape *shape, cpVect p, cpVect rot)
 	return cpBBNew(l, b, r, t);
 }
 
-static void
-cpPolyShapeDestroy(cpShape *shape)
-{
-	cpPolyShape *poly = (cpPolyShape *)shape;
-	
-	free(poly->verts);
-	free(poly->tVerts);
-	
-	free(poly->axes);
-	free(poly->tAxes);
-}
-
 cpPolyShape *
 cpPolyShapeInit(cpPolyShape *poly, cpBody *body, int numVerts, cpVect *verts, cpVect offset)
 {	
 	poly->numVerts = numVerts;
 
-	poly->verts = (cpVect *)calloc(numVerts, sizeof(cpVect));
-	poly->tVerts = (cpVect *)calloc(numVerts, sizeof(cpVect));
-	poly->axes = (cpPolyShapeAxis *)calloc(numVerts, sizeof(cpPolyShapeAxis));
-	poly->tAxes = (cpPolyShapeAxis *)calloc(numVerts, sizeof(cpPolyShapeAxis));
+	// Point the lists into the space after the struct.
+	poly->axes = (cpPolyShapeAxis *)(poly + 1);
+	poly->tAxes = poly->axes + numVerts;
+	poly->verts = (cpVect *)(poly->tAxes + numVerts);
+	poly->tVerts = poly->verts + numVerts;
+	
+	int padded = paddedCount(numVerts);
+	if(padded){
+		poly->xs = (cpFloat *)(poly->tVerts + numVerts);
+		poly->ys = poly->xs + padded;
+		poly->nxs = poly->ys + padded;
+		poly->nys = poly->nxs + padded;
+		poly->ds = poly->nys + padded;
+	} else {
+		poly->xs = poly->ys = NULL;
+		poly->nxs = poly->nys = poly->ds = NULL;
+	}
 	
 	for(int i=0; i<numVerts; i++){
 		cpVect a = cpvadd(offset, verts[i]);
@@ -114,7 +146,7 @@ cpPolyShapeInit(cpPolyShape *poly, cpBody *body, int numVerts, cpVect *verts, cp
 	}
 	
 	poly->shape.cacheData = &cpPolyShapeCacheData;
-	poly->shape.destroy = &cpPolyShapeDestroy;
+	poly->shape.destroy = NULL;
 	cpShapeInit((cpShape *)poly, CP_POLY_SHAPE, body);
 
 	return poly;
@@ -123,5 +155,161 @@ cpPolyShapeInit(cpPolyShape *poly, cpBody *body, int numVerts, cpVect *verts, cp
 cpShape *
 cpPolyShapeNew(cpBody *body, int numVerts, cpVect *verts, cpVect offset)
 {
-	return (cpShape *)cpPolyShapeInit(cpPolyShapeAlloc(), body, numVerts, verts, offset);
-}
\ No newline at end of file
+	return (cpShape *)cpPolyShapeInit(cpPolyShapeAlloc(numVerts), body, numVerts, verts, offset);
+}
+#if LANES > 1
+// The SIMD versions work on LANES vertexes or axes at a time. The padding
+// repeats the first vertex or axis, which doesn't change the results.
+
+cpFloat
+cpPolyShapeValueOnAxis(const cpPolyShape *poly, const cpVect n, const cpFloat d)
+{
+	cpLanes nx = cpLanesSet(n.x), ny = cpLanesSet(n.y);
+	cpLanes min = cpLanesAdd(cpLanesMul(nx, cpLanesLoad(poly->xs)), cpLanesMul(ny, cpLanesLoad(poly->ys)));
+	
+	for(int i=LANES; i<poly->numVerts; i+=LANES){
+		cpLanes dot = cpLanesAdd(cpLanesMul(nx, cpLanesLoad(poly->xs + i)), cpLanesMul(ny, cpLanesLoad(poly->ys + i)));
+		min = cpLanesMin(min, dot);
+	}
+	
+	cpFloat values[LANES];
+	cpLanesStore(values, min);
+	
+	cpFloat value = values[0];
+	for(int i=1; i<LANES; i++) value = cpfmin(value, values[i]);
+	
+	return value - d;
+}
+
+int
+cpPolyShapeFindMSA(const cpPolyShape *poly, const cpPolyShape *axisPoly, cpFloat *min_out)
+{
+	const cpFloat *xs = poly->xs, *ys = poly->ys;
+	int numAxes = axisPoly->numVerts;
+	
+	int min_index = 0;
+	cpFloat min = 0.0f;
+	
+	for(int i=0; i<numAxes; i+=LANES){
+		// Project every vertex onto LANES axes at once.
+		cpLanes nx = cpLanesLoad(axisPoly->nxs + i), ny = cpLanesLoad(axisPoly->nys + i);
+		cpLanes dots = cpLanesAdd(cpLanesMul(nx, cpLanesSet(xs[0])), cpLanesMul(ny, cpLanesSet(ys[0])));
+		
+		for(int j=1; j<poly->numVerts; j++){
+			cpLanes dot = cpLanesAdd(cpLanesMul(nx, cpLanesSet(xs[j])), cpLanesMul(ny, cpLanesSet(ys[j])));
+			dots = cpLanesMin(dots, dot);
+		}
+		
+		cpFloat values[LANES];
+		cpLanesStore(values, cpLanesSub(dots, cpLanesLoad(axisPoly->ds + i)));
+		
+		int count = (numAxes - i < LANES ? numAxes - i : LANES);
+		for(int k=0; k<count; k++){
+			cpFloat dist = values[k];
+			if(dist > 0.0f){
+				return -1;
+			} else if(i + k == 0 || dist > min){
+				min = dist;
+				min_index = i + k;
+			}
+		}
+	}
+	
+	(*min_out) = min;
+	return min_index;
+}
+
+int
+cpPolyShapeFindPointAxis(const cpPolyShape *poly, const cpVect v, const cpFloat r, cpFloat *max_out)
+{
+	cpLanes x = cpLanesSet(v.x), y = cpLanesSet(v.y), rl = cpLanesSet(r);
+	int numAxes = poly->numVerts;
+	
+	int max_index = 0;
+	cpFloat max = 0.0f;
+	
+	for(int i=0; i<numAxes; i+=LANES){
+		cpLanes dots = cpLanesAdd(cpLanesMul(cpLanesLoad(poly->nxs + i), x), cpLanesMul(cpLanesLoad(poly->nys + i), y));
+		
+		cpFloat values[LANES];
+		cpLanesStore(values, cpLanesSub(cpLanesSub(dots, cpLanesLoad(poly->ds + i)), rl));
+		
+		int count = (numAxes - i < LANES ? numAxes - i : LANES);
+		for(int k=0; k<count; k++){
+			cpFloat dist = values[k];
+			if(dist > 0.0f){
+				return -1;
+			} else if(i + k == 0 || dist > max){
+				max = dist;
+				max_index = i + k;
+			}
+		}
+	}
+	
+	(*max_out) = max;
+	return max_index;
+}
+#else
+cpFloat
+cpPolyShapeValueOnAxis(const cpPolyShape *poly, const cpVect n, const cpFloat d)
+{
+	cpVect *verts = poly->tVerts;
+	cpFloat min = cpvdot(n, verts[0]);
+	
+	for(int i=1; i<poly->numVerts; i++)
+		min = cpfmin(min, cpvdot(n, verts[i]));
+	
+	return min - d;
+}
+
+int
+cpPolyShapeFindMSA(const cpPolyShape *poly, const cpPolyShape *axisPoly, cpFloat *min_out)
+{
+	cpPolyShapeAxis *axes = axisPoly->tAxes;
+	
+	int min_index = 0;
+	cpFloat min = cpPolyShapeValueOnAxis(poly, axes->n, axes->d);
+	if(min > 0.0f) return -1;
+	
+	for(int i=1; i<axisPoly->numVerts; i++){
+		cpFloat dist = cpPolyShapeValueOnAxis(poly, axes[i].n, axes[i].d);
+		if(dist > 0.0f) {
+			return -1;
+		} else if(dist > min){
+			min = dist;
+			min_index = i;
+		}
+	}
+	
+	(*min_out) = min;
+	return min_index;
+}
+
+int
+cpPolyShapeFindPointAxis(const cpPolyShape *poly, const cpVect v, const cpFloat r, cpFloat *max_out)
+{
+	cpPolyShapeAxis *axes = poly->tAxes;
+	
+	int max_index = 0;
+	cpFloat max = cpvdot(axes->n, v) - axes->d - r;
+	for(int i=0; i<poly->numVerts; i++){
+		cpFloat dist = cpvdot(axes[i].n, v) - axes[i].d - r;
+		if(dist > 0.0f){
+			return -1;
+		} else if(dist > max) {
+			max = dist;
+			max_index = i;
+		}
+	}
+	
+	(*max_out) = max;
+	return max_index;
+}
+#endif
+
+int
+cpPolyShapeContainsVert(const cpPolyShape *poly, const cpVect v)
+{
+	cpFloat dist;
+	return (cpPolyShapeFindPointAxis(poly, v, 0.0f, &dist) != -1);
+}
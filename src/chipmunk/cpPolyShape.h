@@ -32,6 +32,7 @@ typedef struct cpPolyShape{
 	cpShape shape;
 	
 	// Vertex and axis lists.
+	// They are stored right after the struct in the same allocation.
 	int numVerts;
 	cpVect *verts;
 	cpPolyShapeAxis *axes;
@@ -39,36 +40,34 @@ typedef struct cpPolyShape{
 	// Transformed vertex and axis lists.
 	cpVect *tVerts;
 	cpPolyShapeAxis *tAxes;
+	
+	// Copy of the transformed lists split into arrays of the vertex x and y
+	// and the axis n.x, n.y and d values for the SIMD kernels below. They are
+	// padded to a multiple of the SIMD width by repeating the first vertex and
+	// axis. NULL when built without SIMD support.
+	cpFloat *xs, *ys;
+	cpFloat *nxs, *nys, *ds;
 } cpPolyShape;
 
+// Size of a poly shape and its vertex and axis lists.
+size_t cpPolyShapeSize(int numVerts);
+
 // Basic allocation functions.
-cpPolyShape *cpPolyShapeAlloc(void);
+// The shape needs room for the vertex and axis lists, so it must be
+// allocated for at least numVerts vertexes.
+cpPolyShape *cpPolyShapeAlloc(int numVerts);
 cpPolyShape *cpPolyShapeInit(cpPolyShape *poly, cpBody *body, int numVerts, cpVect *verts, cpVect offset);
 cpShape *cpPolyShapeNew(cpBody *body, int numVerts, cpVect *verts, cpVect offset);
 
 // Returns the minimum distance of the polygon to the axis.
-static inline cpFloat
-cpPolyShapeValueOnAxis(const cpPolyShape *poly, const cpVect n, const cpFloat d)
-{
-	cpVect *verts = poly->tVerts;
-	cpFloat min = cpvdot(n, verts[0]);
-	
-	for(int i=1; i<poly->numVerts; i++)
-		min = cpfmin(min, cpvdot(n, verts[i]));
-	
-	return min - d;
-}
-
+cpFloat cpPolyShapeValueOnAxis(const cpPolyShape *poly, const cpVect n, const cpFloat d);
 // Returns true if the polygon contains the vertex.
-static inline int
-cpPolyShapeContainsVert(cpPolyShape *poly, cpVect v)
-{
-	cpPolyShapeAxis *axes = poly->tAxes;
-	
-	for(int i=0; i<poly->numVerts; i++){
-		cpFloat dist = cpvdot(axes[i].n, v) - axes[i].d;
-		if(dist > 0.0) return 0;
-	}
-	
-	return 1;
-}
+int cpPolyShapeContainsVert(const cpPolyShape *poly, const cpVect v);
+
+// Find the axis of axisPoly with the largest cpPolyShapeValueOnAxis() for poly.
+// Returns the index of the axis and stores the value in min_out, or returns -1
+// as soon as a separating axis (a positive value) is found.
+int cpPolyShapeFindMSA(const cpPolyShape *poly, const cpPolyShape *axisPoly, cpFloat *min_out);
+// Find the axis with the largest cpvdot(n, v) - d - r. Returns the index of the
+// axis and stores the value in max_out, or returns -1 as soon as a positive value is found.
+int cpPolyShapeFindPointAxis(const cpPolyShape *poly, const cpVect v, const cpFloat r, cpFloat *max_out);
@@ -0,0 +1,167 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Thin wrapper over the SIMD instruction sets used by the solver and the
+// cpPolyShape separating axis kernels.
+// Only included by the files that use it, not by chipmunk.h.
+// CP_SIMD_LANES is the number of cpFloats in a cpLanes vector.
+// It's 1 when there is no SIMD support or CP_NO_SIMD is defined,
+// in which case only the scalar code paths are used. The kernels are
+// written for float, so fixed point and double builds always use the
+// scalar paths.
+// 
+// cpLanesLoadRows() loads 8 cpFloats from each of CP_SIMD_LANES rows and
+// transposes them so that cols[i] holds the i-th cpFloat of every row.
+// cpLanesStoreRows() does the reverse.
+
+#if (defined(CP_USE_FIXED) || defined(CP_USE_DOUBLE)) && !defined(CP_NO_SIMD)
+	#define CP_NO_SIMD
+#endif
+
+#if !defined(CP_NO_SIMD) && defined(__AVX__)
+	#include <immintrin.h>
+	#define CP_SIMD_LANES 8
+	typedef __m256 cpLanes;
+	
+	static inline cpLanes cpLanesLoad(const cpFloat *p){return _mm256_loadu_ps(p);}
+	static inline void cpLanesStore(cpFloat *p, cpLanes a){_mm256_storeu_ps(p, a);}
+	static inline cpLanes cpLanesSet(cpFloat f){return _mm256_set1_ps(f);}
+	static inline cpLanes cpLanesAdd(cpLanes a, cpLanes b){return _mm256_add_ps(a, b);}
+	static inline cpLanes cpLanesSub(cpLanes a, cpLanes b){return _mm256_sub_ps(a, b);}
+	static inline cpLanes cpLanesMul(cpLanes a, cpLanes b){return _mm256_mul_ps(a, b);}
+	static inline cpLanes cpLanesMin(cpLanes a, cpLanes b){return _mm256_min_ps(a, b);}
+	static inline cpLanes cpLanesMax(cpLanes a, cpLanes b){return _mm256_max_ps(a, b);}
+	
+	static inline void
+	cpLanesTranspose(cpLanes m[8])
+	{
+		__m256 t0 = _mm256_unpacklo_ps(m[0], m[1]), t1 = _mm256_unpackhi_ps(m[0], m[1]);
+		__m256 t2 = _mm256_unpacklo_ps(m[2], m[3]), t3 = _mm256_unpackhi_ps(m[2], m[3]);
+		__m256 t4 = _mm256_unpacklo_ps(m[4], m[5]), t5 = _mm256_unpackhi_ps(m[4], m[5]);
+		__m256 t6 = _mm256_unpacklo_ps(m[6], m[7]), t7 = _mm256_unpackhi_ps(m[6], m[7]);
+		
+		__m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1,0,1,0)), s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3,2,3,2));
+		__m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1,0,1,0)), s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3,2,3,2));
+		__m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1,0,1,0)), s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3,2,3,2));
+		__m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1,0,1,0)), s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3,2,3,2));
+		
+		m[0] = _mm256_permute2f128_ps(s0, s4, 0x20); m[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+		m[1] = _mm256_permute2f128_ps(s1, s5, 0x20); m[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+		m[2] = _mm256_permute2f128_ps(s2, s6, 0x20); m[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+		m[3] = _mm256_permute2f128_ps(s3, s7, 0x20); m[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+	}
+	
+	static inline void
+	cpLanesLoadRows(cpLanes cols[8], cpFloat *const rows[8])
+	{
+		for(int i=0; i<8; i++) cols[i] = _mm256_loadu_ps(rows[i]);
+		cpLanesTranspose(cols);
+	}
+	
+	static inline void
+	cpLanesStoreRows(cpFloat *const rows[8], const cpLanes cols[8])
+	{
+		cpLanes m[8];
+		for(int i=0; i<8; i++) m[i] = cols[i];
+		cpLanesTranspose(m);
+		for(int i=0; i<8; i++) _mm256_storeu_ps(rows[i], m[i]);
+	}
+#elif !defined(CP_NO_SIMD) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+	#include <xmmintrin.h>
+	#define CP_SIMD_LANES 4
+	typedef __m128 cpLanes;
+	
+	static inline cpLanes cpLanesLoad(const cpFloat *p){return _mm_loadu_ps(p);}
+	static inline void cpLanesStore(cpFloat *p, cpLanes a){_mm_storeu_ps(p, a);}
+	static inline cpLanes cpLanesSet(cpFloat f){return _mm_set1_ps(f);}
+	static inline cpLanes cpLanesAdd(cpLanes a, cpLanes b){return _mm_add_ps(a, b);}
+	static inline cpLanes cpLanesSub(cpLanes a, cpLanes b){return _mm_sub_ps(a, b);}
+	static inline cpLanes cpLanesMul(cpLanes a, cpLanes b){return _mm_mul_ps(a, b);}
+	static inline cpLanes cpLanesMin(cpLanes a, cpLanes b){return _mm_min_ps(a, b);}
+	static inline cpLanes cpLanesMax(cpLanes a, cpLanes b){return _mm_max_ps(a, b);}
+	
+	static inline void
+	cpLanesLoadRows(cpLanes cols[8], cpFloat *const rows[4])
+	{
+		// Transpose the two 4x4 halves separately.
+		for(int half=0; half<8; half+=4){
+			__m128 r0 = _mm_loadu_ps(rows[0] + half), r1 = _mm_loadu_ps(rows[1] + half);
+			__m128 r2 = _mm_loadu_ps(rows[2] + half), r3 = _mm_loadu_ps(rows[3] + half);
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			cols[half + 0] = r0; cols[half + 1] = r1;
+			cols[half + 2] = r2; cols[half + 3] = r3;
+		}
+	}
+	
+	static inline void
+	cpLanesStoreRows(cpFloat *const rows[4], const cpLanes cols[8])
+	{
+		for(int half=0; half<8; half+=4){
+			__m128 r0 = cols[half + 0], r1 = cols[half + 1];
+			__m128 r2 = cols[half + 2], r3 = cols[half + 3];
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			_mm_storeu_ps(rows[0] + half, r0); _mm_storeu_ps(rows[1] + half, r1);
+			_mm_storeu_ps(rows[2] + half, r2); _mm_storeu_ps(rows[3] + half, r3);
+		}
+	}
+#elif !defined(CP_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+	#include <arm_neon.h>
+	#define CP_SIMD_LANES 4
+	typedef float32x4_t cpLanes;
+	
+	static inline cpLanes cpLanesLoad(const cpFloat *p){return vld1q_f32(p);}
+	static inline void cpLanesStore(cpFloat *p, cpLanes a){vst1q_f32(p, a);}
+	static inline cpLanes cpLanesSet(cpFloat f){return vdupq_n_f32(f);}
+	static inline cpLanes cpLanesAdd(cpLanes a, cpLanes b){return vaddq_f32(a, b);}
+	static inline cpLanes cpLanesSub(cpLanes a, cpLanes b){return vsubq_f32(a, b);}
+	static inline cpLanes cpLanesMul(cpLanes a, cpLanes b){return vmulq_f32(a, b);}
+	static inline cpLanes cpLanesMin(cpLanes a, cpLanes b){return vminq_f32(a, b);}
+	static inline cpLanes cpLanesMax(cpLanes a, cpLanes b){return vmaxq_f32(a, b);}
+	
+	static inline void
+	cpLanesLoadRows(cpLanes cols[8], cpFloat *const rows[4])
+	{
+		for(int half=0; half<8; half+=4){
+			// Interleave pairs of rows, then pairs of the 64 bit halves.
+			float32x4x2_t p01 = vtrnq_f32(vld1q_f32(rows[0] + half), vld1q_f32(rows[1] + half));
+			float32x4x2_t p23 = vtrnq_f32(vld1q_f32(rows[2] + half), vld1q_f32(rows[3] + half));
+			cols[half + 0] = vcombine_f32(vget_low_f32(p01.val[0]), vget_low_f32(p23.val[0]));
+			cols[half + 1] = vcombine_f32(vget_low_f32(p01.val[1]), vget_low_f32(p23.val[1]));
+			cols[half + 2] = vcombine_f32(vget_high_f32(p01.val[0]), vget_high_f32(p23.val[0]));
+			cols[half + 3] = vcombine_f32(vget_high_f32(p01.val[1]), vget_high_f32(p23.val[1]));
+		}
+	}
+	
+	static inline void
+	cpLanesStoreRows(cpFloat *const rows[4], const cpLanes cols[8])
+	{
+		for(int half=0; half<8; half+=4){
+			float32x4x2_t p01 = vtrnq_f32(cols[half + 0], cols[half + 1]);
+			float32x4x2_t p23 = vtrnq_f32(cols[half + 2], cols[half + 3]);
+			vst1q_f32(rows[0] + half, vcombine_f32(vget_low_f32(p01.val[0]), vget_low_f32(p23.val[0])));
+			vst1q_f32(rows[1] + half, vcombine_f32(vget_low_f32(p01.val[1]), vget_low_f32(p23.val[1])));
+			vst1q_f32(rows[2] + half, vcombine_f32(vget_high_f32(p01.val[0]), vget_high_f32(p23.val[0])));
+			vst1q_f32(rows[3] + half, vcombine_f32(vget_high_f32(p01.val[1]), vget_high_f32(p23.val[1])));
+		}
+	}
+#else
+	#define CP_SIMD_LANES 1
+#endif
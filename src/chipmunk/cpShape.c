@@ -23,24 +23,16 @@
 
 #include "chipmunk.h"
 
-unsigned int SHAPE_ID_COUNTER = 0;
-
-void
-cpResetShapeIdCounter(void)
-{
-	SHAPE_ID_COUNTER = 0;
-}
-
-
 cpShape*
 cpShapeInit(cpShape *shape, cpShapeType type, cpBody *body)
 {
 	shape->type = type;
 	
-	shape->id = SHAPE_ID_COUNTER;
-	SHAPE_ID_COUNTER++;
+	// Assigned by the space the shape is added to.
+	shape->id = 0;
 	
 	shape->body = body;
+	shape->next = NULL;
 	
 	shape->e = 0.0f;
 	shape->u = 0.0f;
@@ -63,11 +55,25 @@ cpShapeDestroy(cpShape *shape)
 	if(shape->destroy) shape->destroy(shape);
 }
 
+// Size of the memory block holding the shape.
+static size_t
+shapeSize(cpShape *shape)
+{
+	switch(shape->type){
+		case CP_CIRCLE_SHAPE: return sizeof(cpCircleShape);
+		case CP_SEGMENT_SHAPE: return sizeof(cpSegmentShape);
+		case CP_POLY_SHAPE: return cpPolyShapeSize(((cpPolyShape *)shape)->numVerts);
+		default: return 0;
+	}
+}
+
 void
 cpShapeFree(cpShape *shape)
 {
-	if(shape) cpShapeDestroy(shape);
-	free(shape);
+	if(!shape) return;
+	
+	cpShapeDestroy(shape);
+	cpAllocatorFree(shape->allocator, shape, shapeSize(shape));
 }
 
 cpBB
@@ -19,9 +19,6 @@
  * SOFTWARE.
  */
 
-// For determinism, you can reset the shape id counter.
-void cpResetShapeIdCounter(void);
-
 // Enumeration of shape types.
 typedef enum cpShapeType{
 	CP_CIRCLE_SHAPE,
@@ -39,7 +36,7 @@ typedef struct cpShape{
 	// Called to by cpShapeDestroy().
 	void (*destroy)(struct cpShape *shape);
 	
-	// Unique id used as the hash value.
+	// Id used as the hash value. Unique within the space the shape is in.
 	unsigned int id;
 	// Cached BBox for the shape.
 	cpBB bb;
@@ -56,6 +53,11 @@ typedef struct cpShape{
 	
 	// cpBody that the shape is attached to.
 	cpBody *body;
+	// Next shape on the same body. (Only for shapes added with cpSpaceAddShape())
+	struct cpShape *next;
+	
+	// Allocator the shape is returned to by cpShapeFree(). (NULL for the heap)
+	cpAllocator *allocator;
 	
 	// Coefficient of restitution. (elasticity)
 	cpFloat e;
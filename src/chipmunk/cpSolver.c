@@ -0,0 +1,683 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ 
+#include <stdlib.h>
+#include <string.h>
+
+#include "chipmunk.h"
+#include "cpSIMD.h"
+
+#define LANES CP_SIMD_LANES
+
+// Contact arrays are sized in multiples of this to keep them aligned.
+#define CONTACT_GRANULARITY 8
+
+cpSolver*
+cpSolverInit(cpSolver *solver)
+{
+	solver->numBodies = 0;
+	solver->maxBodies = 0;
+	solver->bodies = NULL;
+	solver->bodyRefs = NULL;
+	solver->bodyBatch = NULL;
+	solver->bodyColors = NULL;
+	
+	solver->numContacts = 0;
+	solver->maxContacts = 0;
+	solver->contactData = NULL;
+	
+	solver->numGroups = 0;
+	solver->serialGroup = -1;
+	solver->groupStart[0] = 0;
+	
+	solver->maxScratch = 0;
+	solver->slots = NULL;
+	
+	return solver;
+}
+
+void
+cpSolverDestroy(cpSolver *solver)
+{
+	free(solver->bodies);
+	free(solver->bodyRefs);
+	free(solver->bodyBatch);
+	free(solver->bodyColors);
+	free(solver->contactData);
+	free(solver->slots);
+}
+
+// Make room for count packed contacts. The old contents are not kept.
+static void
+reserveContacts(cpSolver *solver, int count)
+{
+	if(count <= solver->maxContacts) return;
+	
+	int max = (count + count/2 + CONTACT_GRANULARITY - 1)&~(CONTACT_GRANULARITY - 1);
+	solver->maxContacts = max;
+	
+	cpFloat **floats[] = {
+		&solver->r1x, &solver->r1y, &solver->r2x, &solver->r2y,
+		&solver->nx, &solver->ny,
+		&solver->nMass, &solver->tMass, &solver->bias, &solver->bounce,
+		&solver->u, &solver->tvx, &solver->tvy,
+		&solver->jnAcc, &solver->jtAcc, &solver->jBias,
+	};
+	int numFloats = sizeof(floats)/sizeof(*floats);
+	
+	free(solver->contactData);
+	size_t size = max*(numFloats*sizeof(cpFloat) + sizeof(cpContact *) + 2*sizeof(int));
+	char *data = (char *)malloc(size);
+	solver->contactData = data;
+	
+	// The float arrays go first to keep them aligned.
+	for(int i=0; i<numFloats; i++){
+		*floats[i] = (cpFloat *)data;
+		data += max*sizeof(cpFloat);
+	}
+	
+	solver->contacts = (cpContact **)data; data += max*sizeof(cpContact *);
+	solver->a = (int *)data; data += max*sizeof(int);
+	solver->b = (int *)data;
+}
+
+// Make room for count bodies and the dummy body. The old contents are not kept.
+static void
+reserveBodies(cpSolver *solver, int count)
+{
+	if(count + 1 <= solver->maxBodies) return;
+	
+	int max = count + count/2 + 1;
+	solver->maxBodies = max;
+	
+	free(solver->bodies);
+	free(solver->bodyRefs);
+	free(solver->bodyBatch);
+	free(solver->bodyColors);
+	solver->bodies = (cpSolverBody *)malloc(max*sizeof(cpSolverBody));
+	solver->bodyRefs = (cpBody **)malloc(max*sizeof(cpBody *));
+	solver->bodyBatch = (int *)malloc(max*sizeof(int));
+	solver->bodyColors = (unsigned long long *)malloc(max*sizeof(unsigned long long));
+}
+
+// Make room to batch count contacts. The old contents are not kept.
+static void
+reserveScratch(cpSolver *solver, int count)
+{
+	if(solver->slots && count <= solver->maxScratch) return;
+	
+	int max = count + count/2;
+	solver->maxScratch = max;
+	
+	// There can be one batch per contact plus the sentinel.
+	free(solver->slots);
+	solver->slots = (int *)malloc((4*max + 1)*sizeof(int));
+	solver->groups = solver->slots + max;
+	solver->batchFill = solver->groups + max;
+	solver->nextOpen = solver->batchFill + max;
+}
+
+// Get the index of a body, packing it the first time it's seen.
+static inline int
+bodyIndex(cpSolver *solver, cpBody *body)
+{
+	if(body->solverIndex < 0){
+		int index = solver->numBodies++;
+		
+		cpSolverBody *packed = &solver->bodies[index];
+		packed->v = body->v;
+		packed->v_bias = body->v_bias;
+		packed->w = body->w;
+		packed->w_bias = body->w_bias;
+		packed->m_inv = body->m_inv;
+		packed->i_inv = body->i_inv;
+		
+		solver->bodyRefs[index] = body;
+		// Bodies with infinite mass can be shared within a batch.
+		solver->bodyBatch[index] = (body->m_inv == 0.0f && body->i_inv == 0.0f ? -2 : -1);
+		solver->bodyColors[index] = 0;
+		body->solverIndex = index;
+	}
+	
+	return body->solverIndex;
+}
+
+// Find the first batch at or after batch that still has an open slot.
+// Full batches point past themselves, so this is a union-find lookup
+// with path halving. numBatches is the sentinel for a new batch.
+static inline int
+findOpenBatch(int *nextOpen, int batch)
+{
+	while(nextOpen[batch] != batch){
+		nextOpen[batch] = nextOpen[nextOpen[batch]];
+		batch = nextOpen[batch];
+	}
+	
+	return batch;
+}
+
+// Pick the slot for a contact between the bodies with indexes a and b.
+// The batch comes after the last batch that used either body so that each
+// body's contacts stay in order.
+static inline int
+batchContact(cpSolver *solver, int *numBatches, int a, int b)
+{
+	int *bodyBatch = solver->bodyBatch;
+	int *batchFill = solver->batchFill;
+	int *nextOpen = solver->nextOpen;
+	
+	int after = bodyBatch[a] > bodyBatch[b] ? bodyBatch[a] : bodyBatch[b];
+	int batch = findOpenBatch(nextOpen, (after < 0 ? 0 : after + 1));
+	
+	if(batch == *numBatches){
+		// Open a new batch and move the sentinel.
+		batchFill[batch] = 0;
+		(*numBatches)++;
+		nextOpen[*numBatches] = *numBatches;
+	}
+	
+	int slot = batch*LANES + batchFill[batch];
+	if(++batchFill[batch] == LANES) nextOpen[batch] = batch + 1;
+	
+	if(bodyBatch[a] != -2) bodyBatch[a] = batch;
+	if(bodyBatch[b] != -2) bodyBatch[b] = batch;
+	
+	return slot;
+}
+
+// Pick the lowest color that neither body's contacts use yet.
+// Returns -1 if they use all of them.
+static inline int
+colorContact(cpSolver *solver, int a, int b)
+{
+	unsigned long long *bodyColors = solver->bodyColors;
+	
+	// Bodies with infinite mass can share a color.
+	int sharedA = (solver->bodyBatch[a] == -2);
+	int sharedB = (solver->bodyBatch[b] == -2);
+	unsigned long long used = (sharedA ? 0 : bodyColors[a]) | (sharedB ? 0 : bodyColors[b]);
+	if(used == ~0ull) return -1;
+	
+	int color = 0;
+	while(used & (1ull << color)) color++;
+	
+	if(!sharedA) bodyColors[a] |= 1ull << color;
+	if(!sharedB) bodyColors[b] |= 1ull << color;
+	
+	return color;
+}
+
+// Turn a slot into padding: a contact that does nothing to the dummy body.
+static inline void
+padSlot(cpSolver *solver, int k)
+{
+	int dummy = solver->numBodies;
+	
+	solver->contacts[k] = NULL;
+	solver->a[k] = dummy;
+	solver->b[k] = dummy;
+	
+	solver->r1x[k] = 0.0f; solver->r1y[k] = 0.0f;
+	solver->r2x[k] = 0.0f; solver->r2y[k] = 0.0f;
+	solver->nx[k] = 0.0f; solver->ny[k] = 0.0f;
+	
+	solver->nMass[k] = 0.0f;
+	solver->tMass[k] = 0.0f;
+	solver->bias[k] = 0.0f;
+	solver->bounce[k] = 0.0f;
+	
+	solver->u[k] = 0.0f;
+	solver->tvx[k] = 0.0f;
+	solver->tvy[k] = 0.0f;
+	
+	solver->jnAcc[k] = 0.0f;
+	solver->jtAcc[k] = 0.0f;
+	solver->jBias[k] = 0.0f;
+}
+
+void
+cpSolverLoad(cpSolver *solver, cpArray *arbiters, int colored)
+{
+	// Count the contacts and clear the body indexes.
+	int count = 0;
+	for(int i=0; i<arbiters->num; i++){
+		cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+		arb->a->body->solverIndex = -1;
+		arb->b->body->solverIndex = -1;
+		count += arb->numContacts;
+	}
+	
+	reserveBodies(solver, 2*arbiters->num);
+	reserveScratch(solver, count);
+	solver->numBodies = 0;
+	
+	// Pack the bodies in the order the contacts first use them
+	// and pick a group and a slot within it for each contact.
+	int colorCount[CP_SOLVER_COLORS] = {0};
+	int numColors = 0;
+	int numBatches = 0;
+	solver->nextOpen[0] = 0;
+	
+	for(int i=0, k=0; i<arbiters->num; i++){
+		cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+		int a = bodyIndex(solver, arb->a->body);
+		int b = bodyIndex(solver, arb->b->body);
+		
+		for(int j=0; j<arb->numContacts; j++, k++){
+			int color = (colored ? colorContact(solver, a, b) : -1);
+			
+			if(color >= 0){
+				solver->groups[k] = color;
+				solver->slots[k] = colorCount[color]++;
+				if(color >= numColors) numColors = color + 1;
+			} else {
+				solver->groups[k] = -1;
+				solver->slots[k] = (LANES == 1 ? numBatches++ : batchContact(solver, &numBatches, a, b));
+			}
+		}
+	}
+	
+	// Lay out the groups, rounding each one up to whole batches.
+	int numContacts = 0;
+	for(int i=0; i<numColors; i++){
+		solver->groupStart[i] = numContacts;
+		numContacts += (colorCount[i] + LANES - 1)/LANES*LANES;
+	}
+	
+	solver->numGroups = numColors;
+	solver->serialGroup = -1;
+	if(numBatches){
+		solver->serialGroup = solver->numGroups++;
+		solver->groupStart[numColors] = numContacts;
+		numContacts += numBatches*LANES;
+	}
+	solver->groupStart[solver->numGroups] = numContacts;
+	
+	reserveContacts(solver, numContacts);
+	solver->numContacts = numContacts;
+	
+	// Fill the padding at the end of each color and in the serial batches.
+	memset(&solver->bodies[solver->numBodies], 0, sizeof(cpSolverBody));
+	
+	for(int i=0; i<numColors; i++){
+		for(int k=solver->groupStart[i] + colorCount[i]; k<solver->groupStart[i + 1]; k++)
+			padSlot(solver, k);
+	}
+	
+	if(LANES > 1 && numBatches){
+		int start = solver->groupStart[numColors];
+		for(int batch=0; batch<numBatches; batch++){
+			for(int lane=solver->batchFill[batch]; lane<LANES; lane++)
+				padSlot(solver, start + batch*LANES + lane);
+		}
+	}
+	
+	// Pack the contacts into their slots.
+	for(int i=0, n=0; i<arbiters->num; i++){
+		cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+		int a = arb->a->body->solverIndex;
+		int b = arb->b->body->solverIndex;
+		
+		for(int j=0; j<arb->numContacts; j++, n++){
+			cpContact *con = &arb->contacts[j];
+			int group = solver->groups[n];
+			int k = solver->groupStart[group < 0 ? numColors : group] + solver->slots[n];
+			
+			solver->contacts[k] = con;
+			solver->a[k] = a;
+			solver->b[k] = b;
+			
+			solver->r1x[k] = con->r1.x; solver->r1y[k] = con->r1.y;
+			solver->r2x[k] = con->r2.x; solver->r2y[k] = con->r2.y;
+			solver->nx[k] = con->n.x; solver->ny[k] = con->n.y;
+			
+			solver->nMass[k] = con->nMass;
+			solver->tMass[k] = con->tMass;
+			solver->bias[k] = con->bias;
+			solver->bounce[k] = con->bounce;
+			
+			solver->u[k] = arb->u;
+			solver->tvx[k] = arb->target_v.x;
+			solver->tvy[k] = arb->target_v.y;
+			
+			solver->jnAcc[k] = con->jnAcc;
+			solver->jtAcc[k] = con->jtAcc;
+			solver->jBias[k] = con->jBias;
+		}
+	}
+}
+
+// Bodies with infinite mass can be in many lanes or threads at once.
+// Their velocities don't change, so they are never written to.
+static inline int
+isInfinite(cpSolverBody *body)
+{
+	return (body->m_inv == 0.0f && body->i_inv == 0.0f);
+}
+
+#if LANES > 1
+
+// The bodies of a batch with each field in its own vector.
+// The fields are in the same order as cpSolverBody so that they can be
+// loaded and stored with a transpose.
+typedef struct laneBodies{
+	cpLanes vx, vy, vbx, vby, w, wb, m_inv, i_inv;
+} laneBodies;
+
+static inline void
+gatherBodies(laneBodies *lanes, cpSolverBody *bodies, const int *index)
+{
+	cpFloat *rows[LANES];
+	for(int i=0; i<LANES; i++) rows[i] = (cpFloat *)&bodies[index[i]];
+	
+	cpLanesLoadRows((cpLanes *)lanes, rows);
+}
+
+static inline void
+scatterBodies(laneBodies *lanes, cpSolverBody *bodies, const int *index)
+{
+	cpSolverBody junk;
+	cpFloat *rows[LANES];
+	for(int i=0; i<LANES; i++){
+		cpSolverBody *body = &bodies[index[i]];
+		rows[i] = (cpFloat *)(isInfinite(body) ? &junk : body);
+	}
+	
+	cpLanesStoreRows(rows, (cpLanes *)lanes);
+}
+
+// Apply the impulse (jx, jy) at offset (rx, ry) to the velocity (vx, vy, w).
+static inline void
+applyLanes(cpLanes *vx, cpLanes *vy, cpLanes *w, cpLanes m_inv, cpLanes i_inv, cpLanes jx, cpLanes jy, cpLanes rx, cpLanes ry)
+{
+	*vx = cpLanesAdd(*vx, cpLanesMul(jx, m_inv));
+	*vy = cpLanesAdd(*vy, cpLanesMul(jy, m_inv));
+	*w = cpLanesAdd(*w, cpLanesMul(i_inv, cpLanesSub(cpLanesMul(rx, jy), cpLanesMul(ry, jx))));
+}
+
+// The scalar math from applyImpulsesScalar(), one batch at a time.
+static void
+applyImpulsesLanes(cpSolver *solver, int start, int end)
+{
+	cpSolverBody *bodies = solver->bodies;
+	cpLanes zero = cpLanesSet(0.0f);
+	
+	for(int i=start; i<end; i+=LANES){
+		laneBodies a, b;
+		gatherBodies(&a, bodies, solver->a + i);
+		gatherBodies(&b, bodies, solver->b + i);
+		
+		cpLanes nx = cpLanesLoad(solver->nx + i), ny = cpLanesLoad(solver->ny + i);
+		cpLanes r1x = cpLanesLoad(solver->r1x + i), r1y = cpLanesLoad(solver->r1y + i);
+		cpLanes r2x = cpLanesLoad(solver->r2x + i), r2y = cpLanesLoad(solver->r2y + i);
+		cpLanes nMass = cpLanesLoad(solver->nMass + i);
+		
+		// Calculate the relative bias velocities.
+		cpLanes vb1x = cpLanesSub(a.vbx, cpLanesMul(r1y, a.wb));
+		cpLanes vb1y = cpLanesAdd(a.vby, cpLanesMul(r1x, a.wb));
+		cpLanes vb2x = cpLanesSub(b.vbx, cpLanesMul(r2y, b.wb));
+		cpLanes vb2y = cpLanesAdd(b.vby, cpLanesMul(r2x, b.wb));
+		cpLanes vbn = cpLanesAdd(cpLanesMul(cpLanesSub(vb2x, vb1x), nx), cpLanesMul(cpLanesSub(vb2y, vb1y), ny));
+		
+		// Calculate and clamp the bias impulse.
+		cpLanes jbn = cpLanesMul(cpLanesSub(cpLanesLoad(solver->bias + i), vbn), nMass);
+		cpLanes jbnOld = cpLanesLoad(solver->jBias + i);
+		cpLanes jBias = cpLanesMax(cpLanesAdd(jbnOld, jbn), zero);
+		cpLanesStore(solver->jBias + i, jBias);
+		jbn = cpLanesSub(jBias, jbnOld);
+		
+		// Apply the bias impulse.
+		cpLanes jbx = cpLanesMul(nx, jbn), jby = cpLanesMul(ny, jbn);
+		applyLanes(&a.vbx, &a.vby, &a.wb, a.m_inv, a.i_inv, cpLanesSub(zero, jbx), cpLanesSub(zero, jby), r1x, r1y);
+		applyLanes(&b.vbx, &b.vby, &b.wb, b.m_inv, b.i_inv, jbx, jby, r2x, r2y);
+		
+		// Calculate the relative velocity.
+		cpLanes vrx = cpLanesSub(cpLanesSub(b.vx, cpLanesMul(r2y, b.w)), cpLanesSub(a.vx, cpLanesMul(r1y, a.w)));
+		cpLanes vry = cpLanesSub(cpLanesAdd(b.vy, cpLanesMul(r2x, b.w)), cpLanesAdd(a.vy, cpLanesMul(r1x, a.w)));
+		cpLanes vrn = cpLanesAdd(cpLanesMul(vrx, nx), cpLanesMul(vry, ny));
+		
+		// Calculate and clamp the normal impulse.
+		cpLanes jn = cpLanesMul(cpLanesSub(zero, cpLanesAdd(cpLanesLoad(solver->bounce + i), vrn)), nMass);
+		cpLanes jnOld = cpLanesLoad(solver->jnAcc + i);
+		cpLanes jnAcc = cpLanesMax(cpLanesAdd(jnOld, jn), zero);
+		cpLanesStore(solver->jnAcc + i, jnAcc);
+		jn = cpLanesSub(jnAcc, jnOld);
+		
+		// Calculate the relative tangent velocity. (t = perp(n))
+		cpLanes tvx = cpLanesAdd(vrx, cpLanesLoad(solver->tvx + i));
+		cpLanes tvy = cpLanesAdd(vry, cpLanesLoad(solver->tvy + i));
+		cpLanes vrt = cpLanesSub(cpLanesMul(tvy, nx), cpLanesMul(tvx, ny));
+		
+		// Calculate and clamp the friction impulse.
+		cpLanes jtMax = cpLanesMul(cpLanesLoad(solver->u + i), jnAcc);
+		cpLanes jt = cpLanesMul(cpLanesSub(zero, vrt), cpLanesLoad(solver->tMass + i));
+		cpLanes jtOld = cpLanesLoad(solver->jtAcc + i);
+		cpLanes jtAcc = cpLanesMin(cpLanesMax(cpLanesAdd(jtOld, jt), cpLanesSub(zero, jtMax)), jtMax);
+		cpLanesStore(solver->jtAcc + i, jtAcc);
+		jt = cpLanesSub(jtAcc, jtOld);
+		
+		// Apply the final impulse.
+		cpLanes jx = cpLanesSub(cpLanesMul(nx, jn), cpLanesMul(ny, jt));
+		cpLanes jy = cpLanesAdd(cpLanesMul(ny, jn), cpLanesMul(nx, jt));
+		applyLanes(&a.vx, &a.vy, &a.w, a.m_inv, a.i_inv, cpLanesSub(zero, jx), cpLanesSub(zero, jy), r1x, r1y);
+		applyLanes(&b.vx, &b.vy, &b.w, b.m_inv, b.i_inv, jx, jy, r2x, r2y);
+		
+		scatterBodies(&a, bodies, solver->a + i);
+		scatterBodies(&b, bodies, solver->b + i);
+	}
+}
+
+#else
+
+static inline void
+applyImpulse(cpSolverBody *body, cpVect j, cpVect r)
+{
+	cpVect dv = cpvmult(j, body->m_inv);
+	body->v = cpv(cpfadd(body->v.x, dv.x), cpfadd(body->v.y, dv.y));
+	body->w = cpfadd(body->w, cpfmul(body->i_inv, cpvcross(r, j)));
+}
+
+static inline void
+applyBiasImpulse(cpSolverBody *body, cpVect j, cpVect r)
+{
+	cpVect dv = cpvmult(j, body->m_inv);
+	body->v_bias = cpv(cpfadd(body->v_bias.x, dv.x), cpfadd(body->v_bias.y, dv.y));
+	body->w_bias = cpfadd(body->w_bias, cpfmul(body->i_inv, cpvcross(r, j)));
+}
+
+// Same math as cpArbiterApplyImpulse().
+static void
+applyImpulsesScalar(cpSolver *solver, int start, int end)
+{
+	cpSolverBody *bodies = solver->bodies;
+	
+	for(int i=start; i<end; i++){
+		cpSolverBody *a = &bodies[solver->a[i]];
+		cpSolverBody *b = &bodies[solver->b[i]];
+		
+		// Work on copies of the bodies that must not be written to.
+		cpSolverBody copyA, copyB;
+		if(isInfinite(a)){copyA = *a; a = &copyA;}
+		if(isInfinite(b)){copyB = *b; b = &copyB;}
+		
+		cpVect n = cpv(solver->nx[i], solver->ny[i]);
+		cpVect r1 = cpv(solver->r1x[i], solver->r1y[i]);
+		cpVect r2 = cpv(solver->r2x[i], solver->r2y[i]);
+		cpFloat nMass = solver->nMass[i];
+		
+		// Calculate the relative bias velocities.
+		cpVect vb1 = cpvadd(a->v_bias, cpvmult(cpvperp(r1), a->w_bias));
+		cpVect vb2 = cpvadd(b->v_bias, cpvmult(cpvperp(r2), b->w_bias));
+		cpFloat vbn = cpvdot(cpvsub(vb2, vb1), n);
+		
+		// Calculate and clamp the bias impulse.
+		cpFloat jbn = cpfmul(solver->bias[i] - vbn, nMass);
+		cpFloat jbnOld = solver->jBias[i];
+		cpFloat jBias = cpfmax(cpfadd(jbnOld, jbn), 0.0f);
+		solver->jBias[i] = jBias;
+		jbn = cpfsub(jBias, jbnOld);
+		
+		// Apply the bias impulse.
+		cpVect jb = cpvmult(n, jbn);
+		applyBiasImpulse(a, cpvneg(jb), r1);
+		applyBiasImpulse(b, jb, r2);
+		
+		// Calculate the relative velocity.
+		cpVect v1 = cpvadd(a->v, cpvmult(cpvperp(r1), a->w));
+		cpVect v2 = cpvadd(b->v, cpvmult(cpvperp(r2), b->w));
+		cpVect vr = cpvsub(v2, v1);
+		cpFloat vrn = cpvdot(vr, n);
+		
+		// Calculate and clamp the normal impulse.
+		cpFloat jn = cpfmul(-(solver->bounce[i] + vrn), nMass);
+		cpFloat jnOld = solver->jnAcc[i];
+		cpFloat jnAcc = cpfmax(cpfadd(jnOld, jn), 0.0f);
+		solver->jnAcc[i] = jnAcc;
+		jn = cpfsub(jnAcc, jnOld);
+		
+		// Calculate the relative tangent velocity.
+		cpVect t = cpvperp(n);
+		cpFloat vrt = cpvdot(cpvadd(vr, cpv(solver->tvx[i], solver->tvy[i])), t);
+		
+		// Calculate and clamp the friction impulse.
+		cpFloat jtMax = cpfmul(solver->u[i], jnAcc);
+		cpFloat jt = cpfmul(-vrt, solver->tMass[i]);
+		cpFloat jtOld = solver->jtAcc[i];
+		cpFloat jtAcc = cpfmin(cpfmax(cpfadd(jtOld, jt), -jtMax), jtMax);
+		solver->jtAcc[i] = jtAcc;
+		jt = cpfsub(jtAcc, jtOld);
+		
+		// Apply the final impulse.
+		cpVect j = cpvadd(cpvmult(n, jn), cpvmult(t, jt));
+		applyImpulse(a, cpvneg(j), r1);
+		applyImpulse(b, j, r2);
+	}
+}
+
+#endif
+
+#if LANES > 1
+	#define applyImpulses applyImpulsesLanes
+#else
+	#define applyImpulses applyImpulsesScalar
+#endif
+
+void
+cpSolverApplyImpulses(cpSolver *solver)
+{
+	// The groups are contiguous, so they can be solved in one go.
+	applyImpulses(solver, 0, solver->numContacts);
+}
+
+// Number of batches of a color handed out at once by parallelFor().
+#define BATCH_GRAIN 16
+
+typedef struct solveContext{
+	cpSolver *solver;
+	int iterations;
+	cpJobSystem *jobs;
+	// First contact of the color being solved by solveBatches().
+	int start;
+} solveContext;
+
+static void
+solveTeam(void *data, int thread, int count)
+{
+	solveContext *context = (solveContext *)data;
+	cpSolver *solver = context->solver;
+	
+	for(int i=0; i<context->iterations; i++){
+		for(int group=0; group<solver->numGroups; group++){
+			int start = solver->groupStart[group];
+			int end = solver->groupStart[group + 1];
+			
+			if(group == solver->serialGroup){
+				if(thread == 0) applyImpulses(solver, start, end);
+			} else {
+				// Split the color into runs of whole batches.
+				int batches = (end - start)/LANES;
+				int first = start + batches*thread/count*LANES;
+				int last = start + batches*(thread + 1)/count*LANES;
+				applyImpulses(solver, first, last);
+			}
+			
+			context->jobs->barrier(context->jobs);
+		}
+	}
+}
+
+static void
+solveBatches(void *data, int start, int end, int thread)
+{
+	solveContext *context = (solveContext *)data;
+	applyImpulses(context->solver, context->start + start*LANES, context->start + end*LANES);
+}
+
+void
+cpSolverSolve(cpSolver *solver, int iterations, cpJobSystem *jobs)
+{
+	solveContext context = {solver, iterations, jobs, 0};
+	
+	if(!jobs || jobs->threadCount == 1){
+		for(int i=0; i<iterations; i++)
+			applyImpulses(solver, 0, solver->numContacts);
+	} else if(jobs->runTeam && jobs->barrier){
+		jobs->runTeam(jobs, solveTeam, &context);
+	} else {
+		// One parallelFor() per color.
+		for(int i=0; i<iterations; i++){
+			for(int group=0; group<solver->numGroups; group++){
+				int start = solver->groupStart[group];
+				int end = solver->groupStart[group + 1];
+				
+				if(group == solver->serialGroup){
+					applyImpulses(solver, start, end);
+				} else {
+					context.start = start;
+					jobs->parallelFor(jobs, (end - start)/LANES, BATCH_GRAIN, solveBatches, &context);
+				}
+			}
+		}
+	}
+}
+
+void
+cpSolverStore(cpSolver *solver)
+{
+	for(int i=0; i<solver->numContacts; i++){
+		cpContact *con = solver->contacts[i];
+		if(!con) continue;
+		
+		con->jnAcc = solver->jnAcc[i];
+		con->jtAcc = solver->jtAcc[i];
+		con->jBias = solver->jBias[i];
+	}
+	
+	for(int i=0; i<solver->numBodies; i++){
+		cpBody *body = solver->bodyRefs[i];
+		cpSolverBody *packed = &solver->bodies[i];
+		
+		body->v = packed->v;
+		body->v_bias = packed->v_bias;
+		body->w = packed->w;
+		body->w_bias = packed->w_bias;
+	}
+}
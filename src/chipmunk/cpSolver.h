@@ -0,0 +1,107 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Solver body. The velocities of a body packed next to its inverse mass
+// so the solver never has to chase a pointer back to the cpBody.
+// The SIMD solver loads it as 8 cpFloats, so don't add fields.
+typedef struct cpSolverBody{
+	cpVect v, v_bias;
+	cpFloat w, w_bias;
+	cpFloat m_inv, i_inv;
+} cpSolverBody;
+
+// Most colors cpSolverLoad() will use for the contact graph.
+// Contacts that don't fit go into a group that is solved on one thread.
+#define CP_SOLVER_COLORS 64
+
+// Structure of arrays holding the contact constraints of a step.
+// The constraints are packed after cpArbiterPreStep() by cpSolverLoad(),
+// solved against the packed bodies and written back by cpSolverStore().
+// 
+// The contacts are grouped into batches of CP_SIMD_LANES contacts so that
+// a whole batch can be solved at once. No two contacts in a batch share a
+// body unless its mass is infinite. Unused slots in a batch are padding
+// that points at a dummy body and applies no impulse.
+// 
+// The batches are laid out in groups that are solved one after another.
+// When the contacts are colored, each color is a group whose contacts
+// share no bodies at all, so it can be split up between threads. Otherwise,
+// and for contacts that didn't get a color, there is a single serial group
+// in which each body's contacts are solved in the order they were packed.
+typedef struct cpSolver{
+	// Packed bodies and the cpBody each one is written back to.
+	// The dummy body used by the padding comes right after the last one.
+	int numBodies, maxBodies;
+	cpSolverBody *bodies;
+	cpBody **bodyRefs;
+	// Last batch that used each body while batching.
+	int *bodyBatch;
+	// Colors used by each body's contacts while coloring. (one bit per color)
+	unsigned long long *bodyColors;
+	
+	// Packed contacts (including the padding) and the cpContact each one
+	// is written back to. (NULL for padding)
+	int numContacts, maxContacts;
+	cpContact **contacts;
+	// Indexes of the two bodies in the bodies array.
+	int *a, *b;
+	// Offsets, normal and the values calculated by cpArbiterPreStep().
+	cpFloat *r1x, *r1y, *r2x, *r2y;
+	cpFloat *nx, *ny;
+	cpFloat *nMass, *tMass, *bias, *bounce;
+	// Friction and surface velocity of the contact's arbiter.
+	cpFloat *u, *tvx, *tvy;
+	// Accumulated impulses.
+	cpFloat *jnAcc, *jtAcc, *jBias;
+	
+	// All of the contact arrays are carved out of this block.
+	void *contactData;
+	
+	// Group i covers the contacts in [groupStart[i], groupStart[i+1]).
+	// serialGroup is the index of the serial group, or -1 if there is none.
+	// It's always the last group.
+	int numGroups, serialGroup;
+	int groupStart[CP_SOLVER_COLORS + 2];
+	
+	// Scratch space used while packing. Holds the slot and group of each
+	// contact and the fill count and next batch with an open slot for each
+	// batch of the serial group.
+	int maxScratch;
+	int *slots, *groups, *batchFill, *nextOpen;
+} cpSolver;
+
+// Basic allocation/destruction functions.
+cpSolver *cpSolverInit(cpSolver *solver);
+void cpSolverDestroy(cpSolver *solver);
+
+// Pack the contacts of the arbiters and their bodies.
+// The arbiters must be prestepped already. If colored is true, the
+// contacts are colored so that they can be solved by several threads.
+// Colored contacts are solved in a different order, so the results are
+// a little different, but they don't depend on the number of threads.
+void cpSolverLoad(cpSolver *solver, cpArray *arbiters, int colored);
+// Run an iteration of the solver on all of the contacts.
+void cpSolverApplyImpulses(cpSolver *solver);
+// Run the given number of iterations, splitting up the colors between
+// the job system's threads. jobs can be NULL to run them on the calling thread.
+void cpSolverSolve(cpSolver *solver, int iterations, cpJobSystem *jobs);
+// Write the accumulated impulses and the velocities back.
+void cpSolverStore(cpSolver *solver);
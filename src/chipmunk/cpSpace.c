@@ -22,10 +22,46 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
+#include <assert.h>
 
 #include "chipmunk.h"
 
-int cp_contact_persistence = 3;
+
+#ifdef CP_STEP_STATS
+#ifndef CP_STEP_STATS_CLOCK
+#include <time.h>
+
+static double
+stepStatsClock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+#define CP_STEP_STATS_CLOCK stepStatsClock
+#endif
+
+// Start timing a step and clear the counters from the last one.
+#define STATS_BEGIN(space) \
+	cpSpaceStepStats *stats = &(space)->stepStats; \
+	stats->pairs = stats->narrowPhase = stats->collisions = stats->pairCacheHits = 0; \
+	double stepStart = CP_STEP_STATS_CLOCK(); \
+	double phaseStart = stepStart
+// Record the time since the previous phase ended.
+#define STATS_PHASE(phase) { \
+	double phaseEnd = CP_STEP_STATS_CLOCK(); \
+	stats->phaseTime[phase] = phaseEnd - phaseStart; \
+	phaseStart = phaseEnd; \
+}
+#define STATS_END(space) stepStatsFinish(space, phaseStart - stepStart)
+#define STATS_COUNT(space, counter) ((space)->stepStats.counter++)
+#else
+#define STATS_BEGIN(space) ((void)0)
+#define STATS_PHASE(phase) ((void)0)
+#define STATS_END(space) ((void)0)
+#define STATS_COUNT(space, counter) ((void)0)
+#endif
 
 // Equal function for contactSet.
 static int
@@ -50,7 +86,16 @@ contactSetTrans(void *ptr, void *data)
 	
 	cpSpace *space = (cpSpace *)data;
 	
-	return cpArbiterNew(a, b, space->stamp);
+	cpArbiter *arb = (cpArbiter *)cpAllocatorAlloc(space->allocator, sizeof(cpArbiter));
+	return cpArbiterInit(arb, a, b, space->stamp);
+}
+
+// Give an arbiter back to the space's allocator.
+static void
+arbiterFree(cpSpace *space, cpArbiter *arb)
+{
+	cpArbiterDestroy(arb);
+	cpAllocatorFree(space->allocator, arb, sizeof(cpArbiter));
 }
 
 // Collision pair function wrapper struct.
@@ -106,8 +151,39 @@ bbfunc(void *ptr)
 // Iterator functions for destructors.
 static void        freeWrap(void *ptr, void *unused){          free(             ptr);}
 static void   shapeFreeWrap(void *ptr, void *unused){   cpShapeFree((cpShape *)  ptr);}
-static void arbiterFreeWrap(void *ptr, void *unused){ cpArbiterFree((cpArbiter *)ptr);}
-static void    bodyFreeWrap(void *ptr, void *unused){    cpBodyFree((cpBody *)   ptr);}
+static void arbiterFreeWrap(void *ptr, void *data){ arbiterFree((cpSpace *)data, (cpArbiter *)ptr);}
+static void    bodyFreeIter(cpBody *body, void *unused){ cpBodyFree(body);}
+
+// Make sure there is a contact buffer for each of count threads.
+static void
+reserveContactBuffers(cpSpace *space, int count)
+{
+	int old = space->numContactBuffers;
+	if(count <= old) return;
+	
+	cpContactBuffer *buffers = (cpContactBuffer *)malloc(count*sizeof(cpContactBuffer));
+	if(old) memcpy(buffers, space->contactBuffers, old*sizeof(cpContactBuffer));
+	free(space->contactBuffers);
+	
+	for(int i=old; i<count; i++){
+		cpContactBufferInit(&buffers[i]);
+		buffers[i].allocator = space->allocator;
+	}
+	
+	space->contactBuffers = buffers;
+	space->numContactBuffers = count;
+}
+
+static void
+freeContactBuffers(cpSpace *space)
+{
+	for(int i=0; i<space->numContactBuffers; i++)
+		cpContactBufferDestroy(&space->contactBuffers[i]);
+	
+	free(space->contactBuffers);
+	space->contactBuffers = NULL;
+	space->numContactBuffers = 0;
+}
 
 cpSpace*
 cpSpaceAlloc(void)
@@ -115,7 +191,7 @@ cpSpaceAlloc(void)
 	return (cpSpace *)calloc(1, sizeof(cpSpace));
 }
 
-#define DEFAULT_DIM_SIZE 100.0f
+#define DEFAULT_DIM_SIZE CP_FLOAT(100.0f)
 #define DEFAULT_COUNT 1000
 #define DEFAULT_ITERATIONS 10
 
@@ -123,24 +199,56 @@ cpSpace*
 cpSpaceInit(cpSpace *space)
 {
 	space->iterations = DEFAULT_ITERATIONS;
-//	space->sleepTicks = 300;
+	space->sleepTicks = 0;
+	space->idleSpeedThreshold = 0.0f;
 	
 	space->gravity = cpvzero;
-	space->damping = 1.0f;
+	space->damping = CP_FLOAT(1.0f);
+	
+	space->collisionSlop = CP_FLOAT(0.1);
+	space->collisionBias = CP_FLOAT(0.1);
+	space->contactPersistence = 3;
+	space->pairCacheTolerance = 0.0f;
 	
 	space->stamp = 0;
+	space->shapeIDCounter = 0;
+	space->hashTuneTicks = 0;
 
-	space->staticShapes = cpSpaceHashNew(DEFAULT_DIM_SIZE, DEFAULT_COUNT, &bbfunc);
-	space->activeShapes = cpSpaceHashNew(DEFAULT_DIM_SIZE, DEFAULT_COUNT, &bbfunc);
+	space->staticShapes = (cpSpatialIndex *)cpSpaceHashNew(DEFAULT_DIM_SIZE, DEFAULT_COUNT, &bbfunc);
+	space->activeShapes = (cpSpatialIndex *)cpSpaceHashNew(DEFAULT_DIM_SIZE, DEFAULT_COUNT, &bbfunc);
 	
 	space->bodies = cpArrayNew(0);
+	space->sleepingIslands = cpArrayNew(0);
+	space->rousedIslands = cpArrayNew(0);
+	space->locked = 0;
 	space->arbiters = cpArrayNew(0);
 	space->contactSet = cpHashSetNew(0, contactSetEql, contactSetTrans);
+	space->contactBuffers = NULL;
+	space->numContactBuffers = 0;
+	space->stepBuffers = NULL;
+	space->pairs = NULL;
+	space->numPairs = space->maxPairs = 0;
+	space->activeList = cpArrayNew(0);
+	cpSolverInit(&space->solver);
+	
+	space->jobs = NULL;
+	space->threads = NULL;
+	space->deterministic = 0;
 	
 	cpCollPairFunc pairFunc = {0, 0, alwaysCollide, NULL};
 	space->defaultPairFunc = pairFunc;
 	space->collFuncSet = cpHashSetNew(0, collFuncSetEql, collFuncSetTrans);
 	space->collFuncSet->default_value = &space->defaultPairFunc;
+	space->collFuncTable = NULL;
+	space->collFuncTableSize = 0;
+	
+	cpPoolAllocatorInit(&space->pool, NULL);
+	space->allocator = NULL;
+	cpSpaceSetAllocator(space, &space->pool.allocator);
+	
+#ifdef CP_STEP_STATS
+	memset(&space->stepStats, 0, sizeof(cpSpaceStepStats));
+#endif
 	
 	return space;
 }
@@ -154,19 +262,29 @@ cpSpaceNew(void)
 void
 cpSpaceDestroy(cpSpace *space)
 {
-	cpSpaceHashFree(space->staticShapes);
-	cpSpaceHashFree(space->activeShapes);
+	cpSpatialIndexFree(space->staticShapes);
+	cpSpatialIndexFree(space->activeShapes);
 	
 	cpArrayFree(space->bodies);
+	cpArrayFree(space->sleepingIslands);
+	cpArrayFree(space->rousedIslands);
 	
 	if(space->contactSet)
-		cpHashSetEach(space->contactSet, &arbiterFreeWrap, NULL);
+		cpHashSetEach(space->contactSet, &arbiterFreeWrap, space);
 	cpHashSetFree(space->contactSet);
 	cpArrayFree(space->arbiters);
+	freeContactBuffers(space);
+	free(space->pairs);
+	cpArrayFree(space->activeList);
+	cpSolverDestroy(&space->solver);
+	cpThreadsFree(space->threads);
 	
 	if(space->collFuncSet)
 		cpHashSetEach(space->collFuncSet, &freeWrap, NULL);
 	cpHashSetFree(space->collFuncSet);
+	free(space->collFuncTable);
+	
+	cpPoolAllocatorDestroy(&space->pool);
 }
 
 void
@@ -179,9 +297,148 @@ cpSpaceFree(cpSpace *space)
 void
 cpSpaceFreeChildren(cpSpace *space)
 {
-	cpSpaceHashEach(space->staticShapes, &shapeFreeWrap, NULL);
-	cpSpaceHashEach(space->activeShapes, &shapeFreeWrap, NULL);
-	cpArrayEach(space->bodies, &bodyFreeWrap, NULL);
+	cpSpatialIndexEach(space->staticShapes, &shapeFreeWrap, NULL);
+	cpSpatialIndexEach(space->activeShapes, &shapeFreeWrap, NULL);
+	cpSpaceEachBody(space, &bodyFreeIter, NULL);
+}
+
+// Point the spatial index at the space's allocator if it's a spatial hash.
+static void
+setHashAllocator(cpSpace *space, cpSpatialIndex *index)
+{
+	if(index->klass == cpSpaceHashGetClass())
+		cpSpaceHashSetAllocator((cpSpaceHash *)index, space->allocator);
+}
+
+void
+cpSpaceSetAllocator(cpSpace *space, cpAllocator *allocator)
+{
+	// The allocator can only be changed while the space is empty.
+	assert(!space->locked);
+	assert(space->bodies->num == 0 && space->sleepingIslands->num == 0 && space->contactSet->entries == 0);
+	
+	space->allocator = allocator;
+	
+	setHashAllocator(space, space->staticShapes);
+	setHashAllocator(space, space->activeShapes);
+	
+	// The buffers may still be holding blocks from the old allocator.
+	freeContactBuffers(space);
+	reserveContactBuffers(space, 1);
+}
+
+cpBody *
+cpSpaceAllocBody(cpSpace *space)
+{
+	cpBody *body = (cpBody *)cpAllocatorAlloc(space->allocator, sizeof(cpBody));
+	body->allocator = space->allocator;
+	
+	return body;
+}
+
+cpCircleShape *
+cpSpaceAllocCircleShape(cpSpace *space)
+{
+	cpCircleShape *circle = (cpCircleShape *)cpAllocatorAlloc(space->allocator, sizeof(cpCircleShape));
+	memset(circle, 0, sizeof(cpCircleShape));
+	circle->shape.allocator = space->allocator;
+	
+	return circle;
+}
+
+cpSegmentShape *
+cpSpaceAllocSegmentShape(cpSpace *space)
+{
+	cpSegmentShape *seg = (cpSegmentShape *)cpAllocatorAlloc(space->allocator, sizeof(cpSegmentShape));
+	memset(seg, 0, sizeof(cpSegmentShape));
+	seg->shape.allocator = space->allocator;
+	
+	return seg;
+}
+
+cpPolyShape *
+cpSpaceAllocPolyShape(cpSpace *space, int numVerts)
+{
+	size_t size = cpPolyShapeSize(numVerts);
+	cpPolyShape *poly = (cpPolyShape *)cpAllocatorAlloc(space->allocator, size);
+	memset(poly, 0, size);
+	poly->shape.allocator = space->allocator;
+	
+	return poly;
+}
+
+void
+cpSpaceSetJobSystem(cpSpace *space, cpJobSystem *jobs)
+{
+	assert(!space->locked);
+	
+	cpThreadsFree(space->threads);
+	space->threads = NULL;
+	space->jobs = jobs;
+}
+
+void
+cpSpaceSetThreads(cpSpace *space, int count)
+{
+	cpSpaceSetJobSystem(space, NULL);
+	
+	if(count > 1){
+		space->threads = cpThreadsNew(count);
+		space->jobs = cpThreadsGetJobSystem(space->threads);
+	}
+}
+
+// Grow the dense collision function table to fit collision type n.
+static void
+growCollFuncTable(cpSpace *space, unsigned int n)
+{
+	int old = space->collFuncTableSize;
+	int size = (old ? old : 8);
+	while(size <= (int)n) size *= 2;
+	if(size > CP_DENSE_COLLISION_TYPES) size = CP_DENSE_COLLISION_TYPES;
+	if(size == old) return;
+	
+	cpCollPairFunc **table = (cpCollPairFunc **)malloc(size*size*sizeof(cpCollPairFunc *));
+	for(int i=0; i<size*size; i++) table[i] = &space->defaultPairFunc;
+	
+	for(int i=0; i<old; i++)
+		memcpy(&table[i*size], &space->collFuncTable[i*old], old*sizeof(cpCollPairFunc *));
+	
+	free(space->collFuncTable);
+	space->collFuncTable = table;
+	space->collFuncTableSize = size;
+}
+
+// Point both orderings of a type pair at func if they fit in the dense table.
+static void
+setCollFuncTable(cpSpace *space, unsigned int a, unsigned int b, cpCollPairFunc *func)
+{
+	unsigned int size = space->collFuncTableSize;
+	if(a >= size || b >= size) return;
+	
+	space->collFuncTable[a*size + b] = func;
+	space->collFuncTable[b*size + a] = func;
+}
+
+// Find the collision pair function for two collision types.
+static inline cpCollPairFunc *
+findCollPairFunc(cpSpace *space, unsigned int a, unsigned int b)
+{
+	unsigned int size = space->collFuncTableSize;
+	if(a < size && b < size) return space->collFuncTable[a*size + b];
+	
+	// Pairs that would fit in the table but are outside of it use the default.
+	if(a < CP_DENSE_COLLISION_TYPES && b < CP_DENSE_COLLISION_TYPES) return &space->defaultPairFunc;
+	
+	unsigned int ids[] = {a, b};
+	return (cpCollPairFunc *)cpHashSetFind(space->collFuncSet, CP_HASH_PAIR(a, b), ids);
+}
+
+// Clear the collision pair functions cached on the arbiters.
+static void
+clearArbiterFunc(void *ptr, void *unused)
+{
+	((cpArbiter *)ptr)->func = NULL;
 }
 
 void
@@ -194,7 +451,12 @@ cpSpaceAddCollisionPairFunc(cpSpace *space, unsigned int a, unsigned int b,
 	cpSpaceRemoveCollisionPairFunc(space, a, b);
 		
 	collFuncData funcData = {func, data};
-	cpHashSetInsert(space->collFuncSet, hash, ids, &funcData);
+	cpCollPairFunc *pair = (cpCollPairFunc *)cpHashSetInsert(space->collFuncSet, hash, ids, &funcData);
+	
+	if(a < CP_DENSE_COLLISION_TYPES && b < CP_DENSE_COLLISION_TYPES){
+		growCollFuncTable(space, (a > b ? a : b));
+		setCollFuncTable(space, a, b, pair);
+	}
 }
 
 void
@@ -204,6 +466,10 @@ cpSpaceRemoveCollisionPairFunc(cpSpace *space, unsigned int a, unsigned int b)
 	unsigned int hash = CP_HASH_PAIR(a, b);
 	cpCollPairFunc *old_pair = (cpCollPairFunc *)cpHashSetRemove(space->collFuncSet, hash, ids);
 	free(old_pair);
+	
+	setCollFuncTable(space, a, b, &space->defaultPairFunc);
+	// The arbiters may still point at the old function.
+	cpHashSetEach(space->contactSet, &clearArbiterFunc, NULL);
 }
 
 void
@@ -216,37 +482,58 @@ cpSpaceSetDefaultCollisionPairFunc(cpSpace *space, cpCollFunc func, void *data)
 void
 cpSpaceAddShape(cpSpace *space, cpShape *shape)
 {
-	cpSpaceHashInsert(space->activeShapes, shape, shape->id, shape->bb);
+	cpBody *body = shape->body;
+	cpBodyActivate(body);
+	
+	shape->next = body->shapesList;
+	body->shapesList = shape;
+	
+	shape->id = space->shapeIDCounter++;
+	cpSpatialIndexInsert(space->activeShapes, shape, shape->id, shape->bb);
 }
 
 void
 cpSpaceAddStaticShape(cpSpace *space, cpShape *shape)
 {
-	cpSpaceHashInsert(space->staticShapes, shape, shape->id, shape->bb);
+	shape->id = space->shapeIDCounter++;
+	cpSpatialIndexInsert(space->staticShapes, shape, shape->id, shape->bb);
 }
 
 void
 cpSpaceAddBody(cpSpace *space, cpBody *body)
 {
+	body->space = space;
+	body->idleTicks = 0;
 	cpArrayPush(space->bodies, body);
 }
 
 void
 cpSpaceRemoveShape(cpSpace *space, cpShape *shape)
 {
-	cpSpaceHashRemove(space->activeShapes, shape, shape->id);
+	cpBody *body = shape->body;
+	cpBodyActivate(body);
+	
+	// Unlink the shape from the body's list.
+	cpShape **prev = &body->shapesList;
+	while(*prev && *prev != shape) prev = &(*prev)->next;
+	if(*prev) *prev = shape->next;
+	shape->next = NULL;
+	
+	cpSpatialIndexRemove(space->activeShapes, shape, shape->id);
 }
 
 void
 cpSpaceRemoveStaticShape(cpSpace *space, cpShape *shape)
 {
-	cpSpaceHashRemove(space->staticShapes, shape, shape->id);
+	cpSpatialIndexRemove(space->staticShapes, shape, shape->id);
 }
 
 void
 cpSpaceRemoveBody(cpSpace *space, cpBody *body)
 {
+	cpBodyActivate(body);
 	cpArrayDeleteObj(space->bodies, body);
+	body->space = NULL;
 }
 
 void
@@ -256,6 +543,17 @@ cpSpaceEachBody(cpSpace *space, cpSpaceBodyIterator func, void *data)
 	
 	for(int i=0; i<bodies->num; i++)
 		func((cpBody *)bodies->arr[i], data);
+	
+	cpArray *islands = space->sleepingIslands;
+	for(int i=0; i<islands->num; i++){
+		// Grab the next body first in case func frees the body.
+		cpBody *body = (cpBody *)islands->arr[i];
+		while(body){
+			cpBody *next = body->islandNext;
+			func(body, data);
+			body = next;
+		}
+	}
 }
 
 // Iterator function used for updating shape BBoxes.
@@ -266,24 +564,138 @@ updateBBCache(void *ptr, void *unused)
 	cpShapeCacheBB(shape);
 }
 
+// Iterator function used for listing the active shapes.
+static void
+collectShape(void *ptr, void *data)
+{
+	cpArrayPush((cpArray *)data, ptr);
+}
+
+// Job functions for the parallel parts of the step.
+typedef struct stepContext{
+	cpSpace *space;
+	cpFloat dt, dt_inv, damping;
+} stepContext;
+
+static void
+updateVelocities(void *data, int start, int end, int thread)
+{
+	stepContext *context = (stepContext *)data;
+	cpSpace *space = context->space;
+	void **bodies = space->bodies->arr;
+	
+	for(int i=start; i<end; i++)
+		cpBodyUpdateVelocity((cpBody *)bodies[i], space->gravity, context->damping, context->dt);
+}
+
+static void
+updatePositions(void *data, int start, int end, int thread)
+{
+	stepContext *context = (stepContext *)data;
+	void **bodies = context->space->bodies->arr;
+	
+	for(int i=start; i<end; i++)
+		cpBodyUpdatePosition((cpBody *)bodies[i], context->dt);
+}
+
+static void
+cacheBBs(void *data, int start, int end, int thread)
+{
+	stepContext *context = (stepContext *)data;
+	void **shapes = context->space->activeList->arr;
+	
+	for(int i=start; i<end; i++)
+		cpShapeCacheBB((cpShape *)shapes[i]);
+}
+
+static void
+prestepArbiters(void *data, int start, int end, int thread)
+{
+	stepContext *context = (stepContext *)data;
+	cpSpace *space = context->space;
+	void **arbiters = space->arbiters->arr;
+	
+	for(int i=start; i<end; i++)
+		cpArbiterPreStep((cpArbiter *)arbiters[i], context->dt_inv, space->collisionSlop, space->collisionBias);
+}
+
+// Iterator function used for moving shapes to a new index.
+static void
+copyShapeWrap(void *ptr, void *data)
+{
+	cpShape *shape = (cpShape *)ptr;
+	cpSpatialIndexInsert((cpSpatialIndex *)data, shape, shape->id, shape->bb);
+}
+
+// Move the contents of *slot to index and free the old index.
+static void
+replaceIndex(cpSpatialIndex **slot, cpSpatialIndex *index)
+{
+	index->bbfunc = &bbfunc;
+	cpSpatialIndexEach(*slot, &copyShapeWrap, index);
+	
+	cpSpatialIndexFree(*slot);
+	(*slot) = index;
+}
+
+// Resize the spatial hash in *slot, making a new one if necessary.
+static void
+resizeHash(cpSpace *space, cpSpatialIndex **slot, cpFloat dim, int count)
+{
+	if((*slot)->klass == cpSpaceHashGetClass()){
+		cpSpaceHashResize((cpSpaceHash *)*slot, dim, count);
+	} else {
+		cpSpaceHash *hash = cpSpaceHashNew(dim, count, &bbfunc);
+		cpSpaceHashSetAllocator(hash, space->allocator);
+		replaceIndex(slot, (cpSpatialIndex *)hash);
+	}
+}
+
 void
 cpSpaceResizeStaticHash(cpSpace *space, cpFloat dim, int count)
 {
-	cpSpaceHashResize(space->staticShapes, dim, count);
-	cpSpaceHashRehash(space->staticShapes);
+	resizeHash(space, &space->staticShapes, dim, count);
+	cpSpatialIndexRehash(space->staticShapes);
 }
 
 void
 cpSpaceResizeActiveHash(cpSpace *space, cpFloat dim, int count)
 {
-	cpSpaceHashResize(space->activeShapes, dim, count);
+	resizeHash(space, &space->activeShapes, dim, count);
+}
+
+// Retune an index if it's a spatial hash.
+static void
+tuneHash(cpSpatialIndex *index)
+{
+	if(index->klass == cpSpaceHashGetClass())
+		cpSpaceHashTune((cpSpaceHash *)index);
 }
 
 void 
 cpSpaceRehashStatic(cpSpace *space)
 {
-	cpSpaceHashEach(space->staticShapes, &updateBBCache, NULL);
-	cpSpaceHashRehash(space->staticShapes);
+	cpSpatialIndexEach(space->staticShapes, &updateBBCache, NULL);
+	cpSpatialIndexRehash(space->staticShapes);
+}
+
+void
+cpSpaceSetStaticIndex(cpSpace *space, cpSpatialIndex *index)
+{
+	replaceIndex(&space->staticShapes, index);
+}
+
+void
+cpSpaceSetActiveIndex(cpSpace *space, cpSpatialIndex *index)
+{
+	replaceIndex(&space->activeShapes, index);
+}
+
+void
+cpSpaceUseBBTree(cpSpace *space)
+{
+	cpSpaceSetStaticIndex(space, (cpSpatialIndex *)cpBBTreeNew(&bbfunc));
+	cpSpaceSetActiveIndex(space, (cpSpatialIndex *)cpBBTreeNew(&bbfunc));
 }
 
 static inline int
@@ -300,74 +712,213 @@ queryReject(cpShape *a, cpShape *b)
 	   || !(a->layers & b->layers);
 }
 
-// Callback from the spatial hash.
-// TODO: Refactor this into separate functions?
+// Shape pair found by the broadphase. The narrow phase fills in the contacts.
+typedef struct cpCollisionPair{
+	cpShape *a, *b;
+	cpCollPairFunc *func;
+	// Arbiter from the last time the shapes touched, or NULL.
+	cpArbiter *arb;
+	// True if the arbiter's contacts were reused instead of running the narrow phase.
+	int cached;
+	
+	cpContact *contacts;
+	int numContacts;
+} cpCollisionPair;
+
+// Callback from the spatial indexes. Records the pairs that need to go
+// through the narrow phase.
 static int
-queryFunc(void *p1, void *p2, void *data)
+collectFunc(void *p1, void *p2, void *data)
 {
 	// Cast the generic pointers from the spatial hash back to usefull types
 	cpShape *a = (cpShape *)p1;
 	cpShape *b = (cpShape *)p2;
 	cpSpace *space = (cpSpace *)data;
+	STATS_COUNT(space, pairs);
 	
 	// Reject any of the simple cases
 	if(queryReject(a,b)) return 0;
 	
 	// Shape 'a' should have the lower shape type. (required by cpCollideShapes() )
-	if(a->type > b->type){
+	// Shapes of the same type are ordered by id so the contact feature ids
+	// come out the same way every step.
+	if(a->type > b->type || (a->type == b->type && a->id > b->id)){
 		cpShape *temp = a;
 		a = b;
 		b = temp;
 	}
 	
-	// Find the collision pair function for the shapes.
-	unsigned int ids[] = {a->collision_type, b->collision_type};
-	unsigned int hash = CP_HASH_PAIR(a->collision_type, b->collision_type);
-	cpCollPairFunc *pairFunc = (cpCollPairFunc *)cpHashSetFind(space->collFuncSet, hash, ids);
+	// Shapes that touched recently already have an arbiter with the
+	// collision pair function cached on it.
+	cpShape *shape_pair[] = {a, b};
+	cpArbiter *arb = (cpArbiter *)cpHashSetFind(space->contactSet, CP_HASH_PAIR(a, b), shape_pair);
+	cpCollPairFunc *pairFunc = (arb && arb->func ? arb->func : findCollPairFunc(space, a->collision_type, b->collision_type));
 	if(!pairFunc->func) return 0; // A NULL pair function means don't collide at all.
 	
-	// Narrow-phase collision detection.
-	cpContact *contacts = NULL;
-	int numContacts = cpCollideShapes(a, b, &contacts);
-	if(!numContacts) return 0; // Shapes are not colliding.
+	if(space->numPairs == space->maxPairs){
+		space->maxPairs = (space->maxPairs ? 2*space->maxPairs : 16);
+		space->pairs = (cpCollisionPair *)realloc(space->pairs, space->maxPairs*sizeof(cpCollisionPair));
+	}
+	
+	cpCollisionPair *pair = &space->pairs[space->numPairs++];
+	pair->a = a;
+	pair->b = b;
+	pair->func = pairFunc;
+	pair->arb = arb;
+	
+	return 0;
+}
+
+// Upper bound on the distance from a shape's body to any point of the shape.
+static inline cpFloat
+shapeReach(cpShape *shape)
+{
+	cpBB bb = shape->bb;
+	cpVect p = shape->body->p;
+	
+	return cpvlength(cpv(
+		cpfmax(cpfabs(bb.l - p.x), cpfabs(bb.r - p.x)),
+		cpfmax(cpfabs(bb.b - p.y), cpfabs(bb.t - p.y))
+	));
+}
+
+// Check if any point of the shape may have moved more than tol since its
+// body was at position p with angle a.
+static inline int
+shapeMoved(cpShape *shape, cpVect p, cpFloat a, cpFloat tol)
+{
+	cpBody *body = shape->body;
+	
+	// Turning by da moves a point at distance r from the body by at most r*da.
+	cpFloat turn = cpfmul(shapeReach(shape), cpfabs(body->a - a));
+	return (cpfadd(cpvlength(cpvsub(body->p, p)), turn) > tol);
+}
+
+// Check if the contacts of the pair's arbiter can be reused.
+static int
+pairCacheHit(cpSpace *space, cpCollisionPair *pair)
+{
+	cpArbiter *arb = pair->arb;
+	cpFloat tol = space->pairCacheTolerance;
+	
+	// The normals point from a to b, so the shapes must be in the same order.
+	if(!tol || !arb || !arb->numContacts || arb->a != pair->a || arb->b != pair->b) return 0;
+	// Only reuse contacts that were found last step.
+	if(arb->stamp != space->stamp - 1) return 0;
+	
+	return (
+		!shapeMoved(pair->a, arb->cacheP[0], arb->cacheA[0], tol) &&
+		!shapeMoved(pair->b, arb->cacheP[1], arb->cacheA[1], tol)
+	);
+}
+
+// Narrow-phase collision detection for a range of the pairs.
+// Each thread writes the contacts to its own buffer.
+static void
+narrowPhase(void *data, int start, int end, int thread)
+{
+	cpSpace *space = (cpSpace *)data;
+	cpContactBuffer *buffer = &space->stepBuffers[thread];
+	
+	for(int i=start; i<end; i++){
+		cpCollisionPair *pair = &space->pairs[i];
+		pair->cached = pairCacheHit(space, pair);
+		
+		if(pair->cached){
+			// Copy the last step's contacts since cpArbiterInject() overwrites them.
+			cpArbiter *arb = pair->arb;
+			int count = arb->numContacts;
+			cpContact *contacts = cpContactBufferReserve(buffer, count);
+			for(int j=0; j<count; j++){
+				cpContact *old = &arb->contacts[j];
+				cpContactInit(&contacts[j], old->p, old->n, old->dist, old->id);
+			}
+			
+			pair->contacts = contacts;
+			pair->numContacts = count;
+		} else {
+			pair->contacts = NULL;
+			pair->numContacts = cpCollideShapes(pair->a, pair->b, space->collisionSlop, buffer, &pair->contacts);
+		}
+		
+		cpContactBufferCommit(buffer, pair->numContacts);
+	}
+}
+
+// Turn a colliding pair into an arbiter. This runs on the calling thread in
+// the order the pairs were found so the results don't depend on the threads.
+static void
+mergePair(cpSpace *space, cpCollisionPair *pair)
+{
+	STATS_COUNT(space, narrowPhase);
+	if(!pair->numContacts) return; // Shapes are not colliding.
+	STATS_COUNT(space, collisions);
+	if(pair->cached) STATS_COUNT(space, pairCacheHits);
+	
+	cpShape *a = pair->a;
+	cpShape *b = pair->b;
+	cpCollPairFunc *pairFunc = pair->func;
+	
+	// Touching a sleeping body wakes up its island. The pair is found again
+	// by the active shape query once the island's shapes are moved back.
+	if(a->body->sleeping || b->body->sleeping){
+		cpSpaceActivateBody(space, a->body);
+		cpSpaceActivateBody(space, b->body);
+		return;
+	}
 	
 	// The collision pair function requires objects to be ordered by their collision types.
 	cpShape *pair_a = a;
 	cpShape *pair_b = b;
-	cpFloat normal_coef = 1.0f;
+	cpFloat normal_coef = CP_FLOAT(1.0f);
 	
 	// Swap them if necessary.
 	if(pair_a->collision_type != pairFunc->a){
 		cpShape *temp = pair_a;
 		pair_a = pair_b;
 		pair_b = temp;
-		normal_coef = -1.0f;
+		normal_coef = CP_FLOAT(-1.0f);
 	}
 	
-	if(pairFunc->func(pair_a, pair_b, contacts, numContacts, normal_coef, pairFunc->data)){
-		// The collision pair function OKed the collision. Record the contact information.
-		
-		// Get an arbiter from space->contactSet for the two shapes.
-		// This is where the persistant contact magic comes from.
+	// A rejected collision just leaves its contacts unused in the buffer.
+	if(!pairFunc->func(pair_a, pair_b, pair->contacts, pair->numContacts, normal_coef, pairFunc->data)) return;
+	
+	// The collision pair function OKed the collision. Record the contact information.
+	
+	// Get an arbiter from space->contactSet for the two shapes unless the
+	// broadphase already found one. This is where the persistant contact magic comes from.
+	cpArbiter *arb = pair->arb;
+	if(!arb){
 		cpShape *shape_pair[] = {a, b};
-		cpArbiter *arb = (cpArbiter *)cpHashSetInsert(space->contactSet, CP_HASH_PAIR(a, b), shape_pair, space);
-		
-		// Timestamp the arbiter.
-		arb->stamp = space->stamp;
-		arb->a = a; arb->b = b; // TODO: Investigate why this is still necessary?
-		// Inject the new contact points into the arbiter.
-		cpArbiterInject(arb, contacts, numContacts);
-		
-		// Add the arbiter to the list of active arbiters.
-		cpArrayPush(space->arbiters, arb);
-		
-		return numContacts;
-	} else {
-		// The collision pair function rejected the collision.
-		
-		free(contacts);
-		return 0;
+		arb = (cpArbiter *)cpHashSetInsert(space->contactSet, CP_HASH_PAIR(a, b), shape_pair, space);
 	}
+	
+	// Timestamp the arbiter.
+	arb->stamp = space->stamp;
+	arb->a = a; arb->b = b; // TODO: Investigate why this is still necessary?
+	arb->func = pairFunc;
+	// Remember where the bodies were when the contacts were found.
+	if(!pair->cached){
+		arb->cacheP[0] = a->body->p; arb->cacheA[0] = a->body->a;
+		arb->cacheP[1] = b->body->p; arb->cacheA[1] = b->body->a;
+	}
+	// Inject the contacts into the arbiter.
+	cpArbiterInject(arb, pair->contacts, pair->numContacts);
+	
+	// Add the arbiter to the list of active arbiters.
+	cpArrayPush(space->arbiters, arb);
+}
+
+// Run the narrow phase on the collected pairs and merge the results.
+static void
+collidePairs(cpSpace *space)
+{
+	cpJobSystemParallelFor(space->jobs, space->numPairs, 32, &narrowPhase, space);
+	
+	for(int i=0; i<space->numPairs; i++)
+		mergePair(space, &space->pairs[i]);
+	
+	space->numPairs = 0;
 }
 
 // Iterator for active/static hash collisions.
@@ -376,7 +927,7 @@ active2staticIter(void *ptr, void *data)
 {
 	cpShape *shape = (cpShape *)ptr;
 	cpSpace *space = (cpSpace *)data;
-	cpSpaceHashQuery(space->staticShapes, shape, shape->bb, &queryFunc, space);
+	cpSpatialIndexQuery(space->staticShapes, shape, shape->bb, &collectFunc, space);
 }
 
 // Hashset reject func to throw away old arbiters.
@@ -386,57 +937,333 @@ contactSetReject(void *ptr, void *data)
 	cpArbiter *arb = (cpArbiter *)ptr;
 	cpSpace *space = (cpSpace *)data;
 	
-	if((space->stamp - arb->stamp) > cp_contact_persistence){
-		cpArbiterFree(arb);
+	if((space->stamp - arb->stamp) > space->contactPersistence){
+		arbiterFree(space, arb);
 		return 0;
 	}
 	
 	return 1;
 }
 
+// Find the root of a body's island. (Union-find with path halving)
+static inline cpBody *
+islandRoot(cpBody *body)
+{
+	while(body->islandParent != body){
+		body->islandParent = body->islandParent->islandParent;
+		body = body->islandParent;
+	}
+	
+	return body;
+}
+
+// Move a sleeping island back into the simulation.
+static void
+wakeIsland(cpSpace *space, cpBody *root)
+{
+	if(!root->sleeping) return;
+	
+	for(cpBody *body = root; body; body = body->islandNext){
+		body->sleeping = 0;
+		body->idleTicks = 0;
+		cpArrayPush(space->bodies, body);
+		
+		for(cpShape *shape = body->shapesList; shape; shape = shape->next){
+			cpSpatialIndexRemove(space->staticShapes, shape, shape->id);
+			cpSpatialIndexInsert(space->activeShapes, shape, shape->id, shape->bb);
+		}
+	}
+	
+	cpArrayDeleteObj(space->sleepingIslands, root);
+}
+
+void
+cpSpaceActivateBody(cpSpace *space, cpBody *body)
+{
+	if(!body->sleeping) return;
+	
+	// The indexes can't be changed while they are being queried.
+	if(space->locked){
+		cpArrayPush(space->rousedIslands, body->islandParent);
+	} else {
+		wakeIsland(space, body->islandParent);
+	}
+}
+
+// Wake the islands that were touched during the step. If collide is true,
+// the woken shapes are checked against the static shapes since they missed
+// the active to static pass. That can wake up even more islands.
+static void
+processRoused(cpSpace *space, int collide)
+{
+	cpArray *roused = space->rousedIslands;
+	
+	for(int i=0; i<roused->num; i++){
+		cpBody *root = (cpBody *)roused->arr[i];
+		if(!root->sleeping) continue;
+		
+		wakeIsland(space, root);
+		if(!collide) continue;
+		
+		for(cpBody *body = root; body; body = body->islandNext){
+			for(cpShape *shape = body->shapesList; shape; shape = shape->next)
+				cpSpatialIndexQuery(space->staticShapes, shape, shape->bb, &collectFunc, space);
+		}
+		
+		// Collide now so the islands this one runs into get woken in this pass too.
+		collidePairs(space);
+	}
+	
+	roused->num = 0;
+}
+
+// Put the islands of touching bodies to sleep once all of their bodies have
+// been idle for space->sleepTicks steps. Their shapes are moved to the
+// static index so they are only checked against the active shapes.
+static void
+sleepIslands(cpSpace *space, cpFloat dt)
+{
+	cpArray *bodies = space->bodies;
+	cpArray *arbiters = space->arbiters;
+	int stamp = space->stamp;
+	int sleepTicks = space->sleepTicks;
+	
+	cpFloat dvsq = space->idleSpeedThreshold;
+	if(dvsq){
+		dvsq = cpfmul(dvsq, dvsq);
+	} else {
+		dvsq = cpvlengthsq(cpvmult(space->gravity, dt));
+	}
+	
+	// Update the idle counts and make each body its own island.
+	for(int i=0; i<bodies->num; i++){
+		cpBody *body = (cpBody *)bodies->arr[i];
+		cpBodyMarkLowEnergy(body, dvsq, sleepTicks);
+		
+		body->islandParent = body;
+		body->islandNext = NULL;
+		body->islandStamp = stamp;
+	}
+	
+	// Join the islands of the bodies that are touching.
+	for(int i=0; i<arbiters->num; i++){
+		cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+		cpBody *a = arb->a->body;
+		cpBody *b = arb->b->body;
+		
+		int aAwake = (a->islandStamp == stamp);
+		int bAwake = (b->islandStamp == stamp);
+		
+		if(aAwake && bAwake){
+			cpBody *rootA = islandRoot(a);
+			cpBody *rootB = islandRoot(b);
+			if(rootA != rootB) rootA->islandParent = rootB;
+		} else if(aAwake || bAwake){
+			// Static bodies don't join islands, but a rogue body moving
+			// around keeps the bodies it touches awake.
+			cpBody *body = (aAwake ? a : b);
+			cpBody *other = (aAwake ? b : a);
+			if(cpvdot(other->v, other->v) > dvsq || other->w != 0.0f) body->idleTicks = 0;
+		}
+	}
+	
+	// Find the shortest idle count of each island.
+	for(int i=0; i<bodies->num; i++){
+		cpBody *body = (cpBody *)bodies->arr[i];
+		body->islandIdle = body->idleTicks;
+	}
+	
+	for(int i=0; i<bodies->num; i++){
+		cpBody *body = (cpBody *)bodies->arr[i];
+		cpBody *root = islandRoot(body);
+		if(body->idleTicks < root->islandIdle) root->islandIdle = body->idleTicks;
+	}
+	
+	// Pull the bodies of the idle islands out of the body list.
+	int num = 0;
+	for(int i=0; i<bodies->num; i++){
+		cpBody *body = (cpBody *)bodies->arr[i];
+		cpBody *root = islandRoot(body);
+		
+		if(root->islandIdle < sleepTicks){
+			bodies->arr[num++] = body;
+			continue;
+		}
+		
+		if(body == root){
+			cpArrayPush(space->sleepingIslands, root);
+		} else {
+			body->islandNext = root->islandNext;
+			root->islandNext = body;
+		}
+		
+		body->islandParent = root;
+		body->sleeping = 1;
+		body->v = cpvzero;
+		body->w = 0.0f;
+		
+		for(cpShape *shape = body->shapesList; shape; shape = shape->next){
+			cpShapeCacheBB(shape);
+			cpSpatialIndexRemove(space->activeShapes, shape, shape->id);
+			cpSpatialIndexInsert(space->staticShapes, shape, shape->id, shape->bb);
+		}
+	}
+	bodies->num = num;
+}
+
+#ifdef CP_STEP_STATS
+// Histogram bucket for a step time.
+static int
+stepStatsBucket(double time)
+{
+	double usec = time*1e6;
+	
+	int bucket = 0;
+	for(double limit = 1.0; usec >= limit && bucket < CP_STEP_STATS_BUCKETS - 1; limit *= 2.0)
+		bucket++;
+	
+	return bucket;
+}
+
+// Fill in the per step counts and update the totals and histogram.
+static void
+stepStatsFinish(cpSpace *space, double stepTime)
+{
+	cpSpaceStepStats *stats = &space->stepStats;
+	cpArray *arbiters = space->arbiters;
+	
+	stats->stepTime = stepTime;
+	stats->bodies = space->bodies->num;
+	stats->arbiters = arbiters->num;
+	stats->contacts = 0;
+	for(int i=0; i<arbiters->num; i++)
+		stats->contacts += ((cpArbiter *)arbiters->arr[i])->numContacts;
+	
+	stats->steps++;
+	stats->totalStepTime += stepTime;
+	for(int i=0; i<CP_NUM_PHASES; i++)
+		stats->totalPhaseTime[i] += stats->phaseTime[i];
+	
+	// Evict the oldest sample once the window is full.
+	int slot = stats->windowCount%CP_STEP_STATS_WINDOW;
+	if(stats->windowCount >= CP_STEP_STATS_WINDOW)
+		stats->histogram[stats->window[slot]]--;
+	
+	int bucket = stepStatsBucket(stepTime);
+	stats->window[slot] = bucket;
+	stats->histogram[bucket]++;
+	stats->windowCount++;
+	
+	// Keep the counter from overflowing while preserving the slot position.
+	if(stats->windowCount == 2*CP_STEP_STATS_WINDOW)
+		stats->windowCount = CP_STEP_STATS_WINDOW;
+}
+
+const cpSpaceStepStats *
+cpSpaceGetStepStats(cpSpace *space)
+{
+	return &space->stepStats;
+}
+
+void
+cpSpaceResetStepStats(cpSpace *space)
+{
+	memset(&space->stepStats, 0, sizeof(cpSpaceStepStats));
+}
+#endif
+
 void
 cpSpaceStep(cpSpace *space, cpFloat dt)
+{
+	cpSpaceStepWithScratch(space, dt, &space->solver, NULL);
+}
+
+void
+cpSpaceStepWithScratch(cpSpace *space, cpFloat dt, cpSolver *solver, cpContactBuffer *contacts)
 {
 	if(!dt) return; // prevents div by zero.
-	cpFloat dt_inv = 1.0f/dt;
+	cpFloat dt_inv = cpfdiv(CP_FLOAT(1.0f), dt);
 
 	cpArray *bodies = space->bodies;
 	cpArray *arbiters = space->arbiters;
+	cpJobSystem *jobs = space->jobs;
+	
+	cpFloat damping = CP_FLOAT(1.0f);// pow(1.0f/space->damping, -dt);
+	stepContext context = {space, dt, dt_inv, damping};
 	
-	// Empty the arbiter list.
+	STATS_BEGIN(space);
+	space->locked = 1;
+	
+	// Empty the arbiter list and the contact buffers.
 	cpHashSetReject(space->contactSet, &contactSetReject, space);
 	space->arbiters->num = 0;
+	int numBuffers = 1;
+	if(contacts){
+		assert(!jobs);
+	} else {
+		reserveContactBuffers(space, jobs ? jobs->threadCount : 1);
+		contacts = space->contactBuffers;
+		numBuffers = space->numContactBuffers;
+	}
+	for(int i=0; i<numBuffers; i++)
+		cpContactBufferReset(&contacts[i]);
+	space->stepBuffers = contacts;
+	STATS_PHASE(CP_PHASE_CONTACT_REJECT);
 	
 	// Integrate velocities.
-	cpFloat damping = 1;// pow(1.0f/space->damping, -dt);
-	for(int i=0; i<bodies->num; i++)
-		cpBodyUpdateVelocity((cpBody *)bodies->arr[i], space->gravity, damping, dt);
+	cpJobSystemParallelFor(jobs, bodies->num, 256, &updateVelocities, &context);
+	STATS_PHASE(CP_PHASE_INTEGRATE_VELOCITY);
 	
 	// Pre-cache BBoxes and shape data.
-	cpSpaceHashEach(space->activeShapes, &updateBBCache, NULL);
+	cpArray *activeList = space->activeList;
+	activeList->num = 0;
+	cpSpatialIndexEach(space->activeShapes, &collectShape, activeList);
+	cpJobSystemParallelFor(jobs, activeList->num, 256, &cacheBBs, &context);
+	STATS_PHASE(CP_PHASE_CACHE_BB);
 	
-	// Collide!
-	cpSpaceHashEach(space->activeShapes, &active2staticIter, space);
-	cpSpaceHashQueryRehash(space->activeShapes, &queryFunc, space);
+	// Collide! The broadphase runs on this thread and collects the pairs,
+	// then collidePairs() spreads the narrow phase across the threads.
+	cpSpatialIndexEach(space->activeShapes, &active2staticIter, space);
+	collidePairs(space);
+	// Add the islands the active shapes ran into back before rehashing.
+	processRoused(space, 1);
+	STATS_PHASE(CP_PHASE_ACTIVE_TO_STATIC);
+	cpSpatialIndexQueryRehash(space->activeShapes, &collectFunc, space);
+	collidePairs(space);
+	STATS_PHASE(CP_PHASE_QUERY_REHASH);
 	
-	// Prestep the arbiters.
+	// Prestep the arbiters, then apply the cached impulses. Arbiters share
+	// bodies, so the impulses can't be applied in parallel.
+	cpJobSystemParallelFor(jobs, arbiters->num, 64, &prestepArbiters, &context);
 	for(int i=0; i<arbiters->num; i++)
-		cpArbiterPreStep((cpArbiter *)arbiters->arr[i], dt_inv);
+		cpArbiterApplyCachedImpulse((cpArbiter *)arbiters->arr[i]);
+	STATS_PHASE(CP_PHASE_PRESTEP);
 
-	// Run the impulse solver.
-	for(int i=0; i<space->iterations; i++){
-		for(int j=0; j<arbiters->num; j++)
-			cpArbiterApplyImpulse((cpArbiter *)arbiters->arr[j]);
-	}
-
-//	cpFloat dvsq = cpvdot(space->gravity, space->gravity);
-//	dvsq *= dt*dt * space->damping*space->damping;
-//	for(int i=0; i<bodies->num; i++)
-//		cpBodyMarkLowEnergy(bodies->arr[i], dvsq, space->sleepTicks);
+	// Run the impulse solver on a packed copy of the contacts.
+	int colored = (space->deterministic || (jobs && jobs->threadCount > 1));
+	cpSolverLoad(solver, arbiters, colored);
+	cpSolverSolve(solver, space->iterations, jobs);
+	cpSolverStore(solver);
+	STATS_PHASE(CP_PHASE_SOLVE);
 
 	// Integrate positions.
-	for(int i=0; i<bodies->num; i++)
-		cpBodyUpdatePosition((cpBody *)bodies->arr[i], dt);
+	cpJobSystemParallelFor(jobs, bodies->num, 256, &updatePositions, &context);
+	STATS_PHASE(CP_PHASE_INTEGRATE_POSITION);
+	
+	space->locked = 0;
+	// Wake any islands touched by the collision callbacks.
+	processRoused(space, 0);
+	if(space->sleepTicks) sleepIslands(space, dt);
+	STATS_PHASE(CP_PHASE_SLEEP);
+	
+	STATS_END(space);
+	
+	// Periodically adapt the spatial hashes to the shapes in them.
+	int ticks = space->hashTuneTicks;
+	if(ticks && space->stamp%ticks == 0){
+		tuneHash(space->staticShapes);
+		tuneHash(space->activeShapes);
+	}
 	
 	// Increment the stamp.
 	space->stamp++;
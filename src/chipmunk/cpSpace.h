@@ -19,9 +19,6 @@
  * SOFTWARE.
  */
  
-// Number of frames that contact information should persist.
-extern int cp_contact_persistence;
-
 // User collision pair function.
 typedef int (*cpCollFunc)(cpShape *a, cpShape *b, cpContact *contacts, int numContacts, cpFloat normal_coef, void *data);
 
@@ -34,28 +31,145 @@ typedef struct cpCollPairFunc {
 	void *data;
 } cpCollPairFunc;
 
+// Collision types below this are looked up in a dense table instead of
+// the collFuncSet hash. The table takes up to this squared pointers.
+#ifndef CP_DENSE_COLLISION_TYPES
+#define CP_DENSE_COLLISION_TYPES 64
+#endif
+
+#ifdef CP_STEP_STATS
+// Optional per phase profiling of cpSpaceStep().
+// Compile everything with CP_STEP_STATS defined to enable it.
+// Define CP_STEP_STATS_CLOCK to a function returning seconds as a double
+// to replace the default clock_gettime() based timer. (Embedded targets)
+
+// The phases of cpSpaceStep() in the order they are run.
+typedef enum cpStepPhase{
+	CP_PHASE_CONTACT_REJECT,
+	CP_PHASE_INTEGRATE_VELOCITY,
+	CP_PHASE_CACHE_BB,
+	CP_PHASE_ACTIVE_TO_STATIC,
+	CP_PHASE_QUERY_REHASH,
+	CP_PHASE_PRESTEP,
+	CP_PHASE_SOLVE,
+	CP_PHASE_INTEGRATE_POSITION,
+	CP_PHASE_SLEEP,
+	CP_NUM_PHASES
+} cpStepPhase;
+
+// Number of steps covered by the rolling histogram.
+#define CP_STEP_STATS_WINDOW 128
+// Bucket i holds steps that took less than 2^i microseconds.
+// The last bucket holds everything slower than that.
+#define CP_STEP_STATS_BUCKETS 16
+
+typedef struct cpSpaceStepStats{
+	// Wall time in seconds spent in each phase during the last step.
+	double phaseTime[CP_NUM_PHASES];
+	// Wall time of the whole last step.
+	double stepTime;
+	
+	// Counts from the last step.
+	int bodies;
+	// Candidate pairs passed to the collision callback by the spatial hashes.
+	int pairs;
+	// Pairs that made it to the narrow phase, and ones that had contacts.
+	int narrowPhase, collisions;
+	// Pairs that reused their last contacts. (see pairCacheTolerance)
+	int pairCacheHits;
+	// Active arbiters and total number of contacts they hold.
+	int arbiters, contacts;
+	
+	// Running totals since the space was created. (or since cpSpaceResetStepStats())
+	int steps;
+	double totalPhaseTime[CP_NUM_PHASES];
+	double totalStepTime;
+	
+	// Rolling histogram of the step times of the last CP_STEP_STATS_WINDOW steps.
+	int histogram[CP_STEP_STATS_BUCKETS];
+	// Ring buffer of the histogram buckets used to evict old samples.
+	unsigned char window[CP_STEP_STATS_WINDOW];
+	int windowCount;
+} cpSpaceStepStats;
+#endif
+
 typedef struct cpSpace{
 	// Number of iterations to use in the impulse solver.
 	int iterations;
-//	int sleepTicks;
+	// Number of steps a group of touching bodies has to stay idle before
+	// it's put to sleep. (0 disables sleeping)
+	int sleepTicks;
+	// Speed below which a body is idle. If 0, the speed gravity adds in one step is used.
+	cpFloat idleSpeedThreshold;
 	
 	// Self explanatory.
 	cpVect gravity;
 	cpFloat damping;
 	
+	// Amount of allowed penetration. Used to reduce vibrating contacts.
+	cpFloat collisionSlop;
+	// Determines how fast penetrations resolve themselves.
+	cpFloat collisionBias;
+	// Number of frames that contact information should persist.
+	int contactPersistence;
+	// When no point of either shape of a touching pair can have moved more
+	// than this distance (in world units, counting both the translation and
+	// the rotation of its body) since the narrow phase last ran on the pair,
+	// the last step's contacts are reused instead. (0 disables)
+	cpFloat pairCacheTolerance;
+	
 	// Time stamp. Is incremented on every call to cpSpaceStep().
 	int stamp;
+	// Next id to give to an added shape. Shapes are numbered per space so
+	// that the results don't depend on other spaces.
+	unsigned int shapeIDCounter;
+	
+	// Number of steps between automatically retuning the cell size and table
+	// size of the spatial hashes. See cpSpaceHashTune(). (0 disables)
+	int hashTuneTicks;
 
-	// The static and active shape spatial hashes.
-	cpSpaceHash *staticShapes;
-	cpSpaceHash *activeShapes;
+	// The static and active shape spatial indexes.
+	// cpSpaceHashes by default, see cpSpaceSetStaticIndex() and friends.
+	cpSpatialIndex *staticShapes;
+	cpSpatialIndex *activeShapes;
 	
-	// List of bodies in the system.
+	// List of awake bodies in the system.
 	cpArray *bodies;
+	// Root bodies of the sleeping islands. Their shapes are kept in the static index.
+	cpArray *sleepingIslands;
+	// Islands woken up during a step. They are added back before the active shapes are rehashed.
+	cpArray *rousedIslands;
+	// True while cpSpaceStep() is running.
+	int locked;
 	// List of active arbiters for the impulse solver.
 	cpArray *arbiters;
 	// Persistant contact set.
 	cpHashSet *contactSet;
+	// Scratch space for the contacts found by the narrow phase until they are
+	// copied into the arbiters. Each thread of the narrow phase has its own buffer.
+	cpContactBuffer *contactBuffers;
+	int numContactBuffers;
+	// Buffers used by the current step. Either the ones above or the ones
+	// passed to cpSpaceStepWithScratch().
+	cpContactBuffer *stepBuffers;
+	// Candidate pairs found by the broadphase that are waiting for the narrow phase.
+	struct cpCollisionPair *pairs;
+	int numPairs, maxPairs;
+	// Scratch list of the active shapes so they can be updated in parallel.
+	cpArray *activeList;
+	// Packed copy of the contacts that the impulse solver runs on.
+	cpSolver solver;
+	
+	// Job system used to run the step on several threads. (NULL when single
+	// threaded) See cpSpaceSetThreads() and cpSpaceSetJobSystem().
+	cpJobSystem *jobs;
+	// Thread pool created by cpSpaceSetThreads().
+	cpThreads *threads;
+	// When using more than one thread, the solver works on the contacts in
+	// graph colored order, which gives slightly different results. If this
+	// is true, that order is used even with one thread so that the results
+	// don't depend on the thread count.
+	int deterministic;
 	
 	// List of joints in the system.
 	cpArray *joints;
@@ -64,6 +178,22 @@ typedef struct cpSpace{
 	cpHashSet *collFuncSet;
 	// Default collision pair function.
 	cpCollPairFunc defaultPairFunc;
+	// Dense copy of collFuncSet for collision types below
+	// CP_DENSE_COLLISION_TYPES, indexed by [a*collFuncTableSize + b].
+	// Pairs without a function point to defaultPairFunc. The table is only
+	// allocated once a function is added and grows to fit the largest type.
+	cpCollPairFunc **collFuncTable;
+	int collFuncTableSize;
+	
+	// Allocator for the arbiters and spatial hash handles,
+	// and for the objects made with cpSpaceAllocBody() and friends.
+	// Points to pool unless replaced with cpSpaceSetAllocator().
+	cpAllocator *allocator;
+	cpPoolAllocator pool;
+	
+#ifdef CP_STEP_STATS
+	cpSpaceStepStats stepStats;
+#endif
 } cpSpace;
 
 // Basic allocation/destruction functions.
@@ -77,6 +207,18 @@ void cpSpaceFree(cpSpace *space);
 // Convenience function. Frees all referenced entities. (bodies, shapes and joints)
 void cpSpaceFreeChildren(cpSpace *space);
 
+// Replace the space's allocator. Can only be called while the space is empty.
+// The default pool allocator is destroyed along with the space, so objects
+// made by cpSpaceAllocBody() and friends must be freed before the space is.
+void cpSpaceSetAllocator(cpSpace *space, cpAllocator *allocator);
+
+// Allocate objects from the space's allocator. Use them with the normal
+// init functions. cpBodyFree() and cpShapeFree() give them back to the space.
+cpBody *cpSpaceAllocBody(cpSpace *space);
+cpCircleShape *cpSpaceAllocCircleShape(cpSpace *space);
+cpSegmentShape *cpSpaceAllocSegmentShape(cpSpace *space);
+cpPolyShape *cpSpaceAllocPolyShape(cpSpace *space, int numVerts);
+
 // Collision pair function management functions.
 void cpSpaceAddCollisionPairFunc(cpSpace *space, unsigned int a, unsigned int b,
                                  cpCollFunc func, void *data);
@@ -92,14 +234,47 @@ void cpSpaceRemoveShape(cpSpace *space, cpShape *shape);
 void cpSpaceRemoveStaticShape(cpSpace *space, cpShape *shape);
 void cpSpaceRemoveBody(cpSpace *space, cpBody *body);
 
-// Iterator function for iterating the bodies in a space.
+// Wake up the island the body belongs to. (see cpBodyActivate())
+void cpSpaceActivateBody(cpSpace *space, cpBody *body);
+
+// Iterator function for iterating the bodies in a space. (including sleeping ones)
 typedef void (*cpSpaceBodyIterator)(cpBody *body, void *data);
 void cpSpaceEachBody(cpSpace *space, cpSpaceBodyIterator func, void *data);
 
 // Spatial hash management functions.
+// If the index isn't a spatial hash, it's replaced with one.
+// The sizes are retuned over time if hashTuneTicks is set.
 void cpSpaceResizeStaticHash(cpSpace *space, cpFloat dim, int count);
 void cpSpaceResizeActiveHash(cpSpace *space, cpFloat dim, int count);
 void cpSpaceRehashStatic(cpSpace *space);
 
+// Replace the spatial index for the static or active shapes.
+// The shapes in the old index are moved over and the old index is freed.
+// The space takes ownership of the index and sets its bbfunc.
+void cpSpaceSetStaticIndex(cpSpace *space, cpSpatialIndex *index);
+void cpSpaceSetActiveIndex(cpSpace *space, cpSpatialIndex *index);
+// Use cpBBTrees for both the static and active shapes.
+void cpSpaceUseBBTree(cpSpace *space);
+
+// Set the number of threads used to step the space, including the calling
+// thread. Has no effect unless Chipmunk was compiled with CP_USE_PTHREADS.
+void cpSpaceSetThreads(cpSpace *space, int count);
+// Step the space using an external job system instead. (NULL for none)
+// The space doesn't take ownership of it. Collision pair functions are
+// always called from the thread calling cpSpaceStep().
+void cpSpaceSetJobSystem(cpSpace *space, cpJobSystem *jobs);
+
 // Update the space.
 void cpSpaceStep(cpSpace *space, cpFloat dt);
+// Update the space using the caller's solver and contact buffer instead of
+// the space's own. Both are only scratch memory, so spaces that are stepped
+// one after another can share them. The space must not have a job system
+// since the narrow phase only gets the one buffer. (see cpSpaceBatch)
+void cpSpaceStepWithScratch(cpSpace *space, cpFloat dt, cpSolver *solver, cpContactBuffer *contacts);
+
+#ifdef CP_STEP_STATS
+// Profiling information for the last step. Only valid until the next step.
+const cpSpaceStepStats *cpSpaceGetStepStats(cpSpace *space);
+// Clear the running totals and the histogram.
+void cpSpaceResetStepStats(cpSpace *space);
+#endif
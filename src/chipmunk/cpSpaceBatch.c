@@ -0,0 +1,153 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ 
+ 
+#include <stdlib.h>
+#include <assert.h>
+
+#include "chipmunk.h"
+
+cpSpaceBatch*
+cpSpaceBatchAlloc(void)
+{
+	return (cpSpaceBatch *)calloc(1, sizeof(cpSpaceBatch));
+}
+
+cpSpaceBatch*
+cpSpaceBatchInit(cpSpaceBatch *batch)
+{
+	batch->spaces = cpArrayNew(0);
+	
+	batch->jobs = NULL;
+	batch->threads = NULL;
+	
+	batch->solvers = NULL;
+	batch->contactBuffers = NULL;
+	batch->numThreads = 0;
+	
+	batch->dt = 0.0f;
+	
+	return batch;
+}
+
+cpSpaceBatch*
+cpSpaceBatchNew(void)
+{
+	return cpSpaceBatchInit(cpSpaceBatchAlloc());
+}
+
+void
+cpSpaceBatchDestroy(cpSpaceBatch *batch)
+{
+	cpArrayFree(batch->spaces);
+	cpThreadsFree(batch->threads);
+	
+	for(int i=0; i<batch->numThreads; i++){
+		cpSolverDestroy(&batch->solvers[i]);
+		cpContactBufferDestroy(&batch->contactBuffers[i]);
+	}
+	free(batch->solvers);
+	free(batch->contactBuffers);
+}
+
+void
+cpSpaceBatchFree(cpSpaceBatch *batch)
+{
+	if(batch) cpSpaceBatchDestroy(batch);
+	free(batch);
+}
+
+void
+cpSpaceBatchSetJobSystem(cpSpaceBatch *batch, cpJobSystem *jobs)
+{
+	cpThreadsFree(batch->threads);
+	batch->threads = NULL;
+	batch->jobs = jobs;
+}
+
+void
+cpSpaceBatchSetThreads(cpSpaceBatch *batch, int count)
+{
+	cpSpaceBatchSetJobSystem(batch, NULL);
+	
+	if(count > 1){
+		batch->threads = cpThreadsNew(count);
+		batch->jobs = cpThreadsGetJobSystem(batch->threads);
+	}
+}
+
+void
+cpSpaceBatchAddSpace(cpSpaceBatch *batch, cpSpace *space)
+{
+	// The job systems can't run jobs from inside of a job.
+	assert(!space->jobs);
+	assert(!cpArrayContains(batch->spaces, space));
+	
+	cpArrayPush(batch->spaces, space);
+}
+
+void
+cpSpaceBatchRemoveSpace(cpSpaceBatch *batch, cpSpace *space)
+{
+	cpArrayDeleteObj(batch->spaces, space);
+}
+
+// Make sure there is scratch memory for each of count threads.
+static void
+reserveScratch(cpSpaceBatch *batch, int count)
+{
+	int old = batch->numThreads;
+	if(count <= old) return;
+	
+	batch->solvers = (cpSolver *)realloc(batch->solvers, count*sizeof(cpSolver));
+	batch->contactBuffers = (cpContactBuffer *)realloc(batch->contactBuffers, count*sizeof(cpContactBuffer));
+	for(int i=old; i<count; i++){
+		cpSolverInit(&batch->solvers[i]);
+		cpContactBufferInit(&batch->contactBuffers[i]);
+	}
+	
+	batch->numThreads = count;
+}
+
+// Job function that steps a range of the spaces.
+static void
+stepSpaces(void *data, int start, int end, int thread)
+{
+	cpSpaceBatch *batch = (cpSpaceBatch *)data;
+	void **spaces = batch->spaces->arr;
+	cpSolver *solver = &batch->solvers[thread];
+	cpContactBuffer *contacts = &batch->contactBuffers[thread];
+	
+	for(int i=start; i<end; i++)
+		cpSpaceStepWithScratch((cpSpace *)spaces[i], batch->dt, solver, contacts);
+}
+
+void
+cpSpaceBatchStep(cpSpaceBatch *batch, cpFloat dt)
+{
+	cpJobSystem *jobs = batch->jobs;
+	reserveScratch(batch, jobs ? jobs->threadCount : 1);
+	
+	batch->dt = dt;
+	// Spaces can take very different amounts of time, so hand them out one
+	// at a time and let the threads steal.
+	cpJobSystemParallelFor(jobs, batch->spaces->num, 1, &stepSpaces, batch);
+}
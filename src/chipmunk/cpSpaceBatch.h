@@ -0,0 +1,72 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+// Steps many independent spaces at once, one space per job. Each space is
+// stepped on a single thread, so the spaces in a batch must not have their
+// own job system. (see cpSpaceSetThreads())
+//
+// The spaces only keep their arbiters between steps. The solver and the
+// narrow phase's contact buffer are scratch memory that is shared between
+// the spaces stepped on the same thread, so it doesn't grow with the number
+// of spaces.
+typedef struct cpSpaceBatch{
+	// Spaces to step.
+	cpArray *spaces;
+	
+	// Job system used to step the spaces. (NULL when single threaded)
+	cpJobSystem *jobs;
+	// Thread pool created by cpSpaceBatchSetThreads().
+	cpThreads *threads;
+	
+	// Solver and contact buffer scratch for each thread.
+	cpSolver *solvers;
+	cpContactBuffer *contactBuffers;
+	int numThreads;
+	
+	// Timestep of the current cpSpaceBatchStep() call.
+	cpFloat dt;
+} cpSpaceBatch;
+
+// Basic allocation/destruction functions.
+cpSpaceBatch* cpSpaceBatchAlloc(void);
+cpSpaceBatch* cpSpaceBatchInit(cpSpaceBatch *batch);
+cpSpaceBatch* cpSpaceBatchNew(void);
+
+void cpSpaceBatchDestroy(cpSpaceBatch *batch);
+void cpSpaceBatchFree(cpSpaceBatch *batch);
+
+// Set the number of threads used to step the spaces, including the calling
+// thread. Has no effect unless Chipmunk was compiled with CP_USE_PTHREADS.
+void cpSpaceBatchSetThreads(cpSpaceBatch *batch, int count);
+// Step the spaces using an external job system instead. (NULL for none)
+// The batch doesn't take ownership of it.
+void cpSpaceBatchSetJobSystem(cpSpaceBatch *batch, cpJobSystem *jobs);
+
+// Add and remove spaces. The batch doesn't take ownership of them.
+// A space should only be in one batch.
+void cpSpaceBatchAddSpace(cpSpaceBatch *batch, cpSpace *space);
+void cpSpaceBatchRemoveSpace(cpSpaceBatch *batch, cpSpace *space);
+
+// Step all of the spaces by dt and wait for them to finish. Collision pair
+// functions may be called from any of the threads, but only one space's
+// functions run on a thread at a time.
+void cpSpaceBatchStep(cpSpaceBatch *batch, cpFloat dt);
@@ -21,6 +21,7 @@
  
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <assert.h>
 
@@ -28,45 +29,31 @@
 #include "prime.h"
 
 static cpHandle*
-cpHandleAlloc(void)
+cpHandleAlloc(cpAllocator *allocator)
 {
-	return (cpHandle *)malloc(sizeof(cpHandle));
+	return (cpHandle *)cpAllocatorAlloc(allocator, sizeof(cpHandle));
 }
 
 static cpHandle*
 cpHandleInit(cpHandle *hand, void *obj)
 {
 	hand->obj = obj;
-	hand->retain = 0;
-	hand->stamp = 0;
+	hand->bb = cpBBNew(0.0f, 0.0f, 0.0f, 0.0f);
+	hand->index = -1;
 	
 	return hand;
 }
 
 static cpHandle*
-cpHandleNew(void *obj)
+cpHandleNew(cpAllocator *allocator, void *obj)
 {
-	return cpHandleInit(cpHandleAlloc(), obj);
+	return cpHandleInit(cpHandleAlloc(allocator), obj);
 }
 
 static inline void
-cpHandleRetain(cpHandle *hand)
+cpHandleFree(cpAllocator *allocator, cpHandle *hand)
 {
-	hand->retain++;
-}
-
-static inline void
-cpHandleFree(cpHandle *hand)
-{
-	free(hand);
-}
-
-static inline void
-cpHandleRelease(cpHandle *hand)
-{
-	hand->retain--;
-	if(hand->retain == 0)
-		cpHandleFree(hand);
+	cpAllocatorFree(allocator, hand, sizeof(cpHandle));
 }
 
 
@@ -76,14 +63,17 @@ cpSpaceHashAlloc(void)
 	return (cpSpaceHash *)calloc(1, sizeof(cpSpaceHash));
 }
 
-// Frees the old table, and allocates a new one.
+// Frees the old cell table, and allocates a new one.
 static void
 cpSpaceHashAllocTable(cpSpaceHash *hash, int numcells)
 {
-	free(hash->table);
+	free(hash->cellStart);
+	free(hash->cellCount);
 	
 	hash->numcells = numcells;
-	hash->table = (cpSpaceHashBin **)calloc(numcells, sizeof(cpSpaceHashBin *));
+	hash->cellStart = (int *)calloc(numcells + 1, sizeof(int));
+	hash->cellCount = (int *)calloc(numcells, sizeof(int));
+	hash->dirty = 1;
 }
 
 // Equality function for the handleset.
@@ -96,24 +86,34 @@ handleSetEql(void *obj, void *elt)
 
 // Transformation function for the handleset.
 static void *
-handleSetTrans(void *obj, void *unused)
+handleSetTrans(void *obj, void *data)
 {
-	cpHandle *hand = cpHandleNew(obj);
-	cpHandleRetain(hand);
-	
-	return hand;
+	cpSpaceHash *hash = (cpSpaceHash *)data;
+	return cpHandleNew(hash->allocator, obj);
 }
 
 cpSpaceHash*
 cpSpaceHashInit(cpSpaceHash *hash, cpFloat celldim, int numcells, cpSpaceHashBBFunc bbfunc)
 {
+	hash->index.klass = cpSpaceHashGetClass();
+	hash->index.bbfunc = bbfunc;
+	
 	cpSpaceHashAllocTable(hash, next_prime(numcells));
 	hash->celldim = celldim;
-	hash->bbfunc = bbfunc;
 	
-	hash->bins = NULL;
+	hash->allocator = NULL;
 	hash->handleSet = cpHashSetNew(0, &handleSetEql, &handleSetTrans);
 	
+	hash->numItems = 0;
+	hash->maxItems = 0;
+	hash->items = NULL;
+	
+	hash->maxCellItems = 0;
+	hash->cellItems = NULL;
+	
+	hash->incremental = 0;
+	hash->numRemoved = 0;
+	
 	hash->stamp = 1;
 	
 	return hash;
@@ -125,64 +125,25 @@ cpSpaceHashNew(cpFloat celldim, int cells, cpSpaceHashBBFunc bbfunc)
 	return cpSpaceHashInit(cpSpaceHashAlloc(), celldim, cells, bbfunc);
 }
 
-static inline void
-clearHashCell(cpSpaceHash *hash, int index)
-{
-	cpSpaceHashBin *bin = hash->table[index];
-	while(bin){
-		cpSpaceHashBin *next = bin->next;
-		
-		// Release the lock on the handle.
-		cpHandleRelease(bin->handle);
-		// Recycle the bin.
-		bin->next = hash->bins;
-		hash->bins = bin;
-		
-		bin = next;
-	}
-	
-	hash->table[index] = NULL;
-}
-
-// Clear all cells in the hashtable.
-static void
-clearHash(cpSpaceHash *hash)
-{
-	for(int i=0; i<hash->numcells; i++)
-		clearHashCell(hash, i);
-}
-
-// Free the recycled hash bins.
-static void
-freeBins(cpSpaceHash *hash)
-{
-	cpSpaceHashBin *bin = hash->bins;
-	while(bin){
-		cpSpaceHashBin *next = bin->next;
-		free(bin);
-		bin = next;
-	}
-}
-
 // Hashset iterator function to free the handles.
 static void
-handleFreeWrap(void *elt, void *unused)
+handleFreeWrap(void *elt, void *data)
 {
 	cpHandle *hand = (cpHandle *)elt;
-	cpHandleFree(hand);
+	cpHandleFree((cpAllocator *)data, hand);
 }
 
 void
 cpSpaceHashDestroy(cpSpaceHash *hash)
 {
-	clearHash(hash);
-	freeBins(hash);
-	
 	// Free the handles.
-	cpHashSetEach(hash->handleSet, &handleFreeWrap, NULL);
+	cpHashSetEach(hash->handleSet, &handleFreeWrap, hash->allocator);
 	cpHashSetFree(hash->handleSet);
 	
-	free(hash->table);
+	free(hash->items);
+	free(hash->cellStart);
+	free(hash->cellCount);
+	free(hash->cellItems);
 }
 
 void
@@ -196,36 +157,25 @@ cpSpaceHashFree(cpSpaceHash *hash)
 void
 cpSpaceHashResize(cpSpaceHash *hash, cpFloat celldim, int numcells)
 {
-	// Clear the hash to release the old handle locks.
-	clearHash(hash);
-	
 	hash->celldim = celldim;
 	cpSpaceHashAllocTable(hash, next_prime(numcells));
 }
 
-// Return true if the chain contains the handle.
-static inline int
-containsHandle(cpSpaceHashBin *bin, cpHandle *hand)
+void
+cpSpaceHashSetAllocator(cpSpaceHash *hash, cpAllocator *allocator)
 {
-	while(bin){
-		if(bin->handle == hand) return 1;
-		bin = bin->next;
-	}
+	// The handles would be freed with the wrong allocator.
+	assert(hash->handleSet->entries == 0);
 	
-	return 0;
+	hash->allocator = allocator;
 }
 
-// Get a recycled or new bin.
-static inline cpSpaceHashBin *
-getEmptyBin(cpSpaceHash *hash)
+void
+cpSpaceHashSetIncremental(cpSpaceHash *hash, int incremental)
 {
-	cpSpaceHashBin *bin = hash->bins;
-	
-	// Make a new one if necessary.
-	if(bin == NULL) return (cpSpaceHashBin *)malloc(sizeof(cpSpaceHashBin));
-
-	hash->bins = bin->next;
-	return bin;
+	hash->incremental = incremental;
+	// The runs need to be rebuilt with (or without) slack.
+	hash->dirty = 1;
 }
 
 // The hash function itself.
@@ -235,74 +185,266 @@ hash_func(unsigned int x, unsigned int y, unsigned int n)
 	return (x*2185031351ul ^ y*4232417593ul) % n;
 }
 
-static inline void
-hashHandle(cpSpaceHash *hash, cpHandle *hand, cpBB bb)
+// NOTE: Two cells of a large BBox can hash to the same index, so an item
+// may be stored twice in a cell. The query stamps take care of that.
+static inline cpSpaceHashRange
+getCellRange(cpSpaceHash *hash, cpBB bb)
 {
-	// Find the dimensions in cell coordinates.
 	cpFloat dim = hash->celldim;
-	int l = bb.l/dim;
-	int r = bb.r/dim;
-	int b = bb.b/dim;
-	int t = bb.t/dim;
+	cpSpaceHashRange range = {
+		cpftoint(cpfdiv(bb.l, dim)), cpftoint(cpfdiv(bb.r, dim)),
+		cpftoint(cpfdiv(bb.b, dim)), cpftoint(cpfdiv(bb.t, dim)),
+	};
+	return range;
+}
+
+static inline int
+rangeEql(cpSpaceHashRange a, cpSpaceHashRange b)
+{
+	return (a.l == b.l && a.r == b.r && a.b == b.b && a.t == b.t);
+}
+
+// Number of slots to reserve for a cell holding count items.
+static inline int
+cellCapacity(cpSpaceHash *hash, int count)
+{
+	// Leave room for a few objects to move in before the next rebuild.
+	return (hash->incremental ? count + count/2 + 2 : count);
+}
+
+// Used by rebuild() to copy the handles into the item array.
+typedef struct fillPair {
+	cpSpaceHash *hash;
+	int refresh;
+} fillPair;
+
+static void
+fillItemsHelper(void *elt, void *data)
+{
+	cpHandle *hand = (cpHandle *)elt;
+	fillPair *pair = (fillPair *)data;
+	cpSpaceHash *hash = pair->hash;
+	
+	if(pair->refresh) hand->bb = hash->index.bbfunc(hand->obj);
+	
+	hand->index = hash->numItems;
+	cpSpaceHashItem *item = &hash->items[hash->numItems++];
+	item->obj = hand->obj;
+	item->stamp = 0;
+	item->range = getCellRange(hash, hand->bb);
+}
+
+// Bucket all of the objects into the cells using a counting sort.
+// If refresh is true, the BBoxes are updated using the bbfunc first.
+static void
+rebuild(cpSpaceHash *hash, int refresh)
+{
+	int entries = hash->handleSet->entries;
+	if(entries > hash->maxItems){
+		hash->maxItems = entries*2;
+		free(hash->items);
+		hash->items = (cpSpaceHashItem *)malloc(hash->maxItems*sizeof(cpSpaceHashItem));
+	}
+	
+	hash->numItems = 0;
+	fillPair pair = {hash, refresh};
+	cpHashSetEach(hash->handleSet, &fillItemsHelper, &pair);
+	
+	cpSpaceHashItem *items = hash->items;
+	int numItems = hash->numItems;
+	int *cellStart = hash->cellStart;
+	int *cellCount = hash->cellCount;
+	
+	int n = hash->numcells;
+	
+	// Count the items in each cell.
+	memset(cellCount, 0, n*sizeof(int));
+	for(int item=0; item<numItems; item++){
+		cpSpaceHashRange range = items[item].range;
+		for(int i=range.l; i<=range.r; i++){
+			for(int j=range.b; j<=range.t; j++)
+				cellCount[hash_func(i,j,n)]++;
+		}
+	}
+	
+	// Turn the counts into the start of each cell's run.
+	int sum = 0;
+	for(int i=0; i<n; i++){
+		cellStart[i] = sum;
+		sum += cellCapacity(hash, cellCount[i]);
+		cellCount[i] = 0;
+	}
+	cellStart[n] = sum;
+	
+	if(sum > hash->maxCellItems){
+		hash->maxCellItems = sum*2;
+		free(hash->cellItems);
+		hash->cellItems = (int *)malloc(hash->maxCellItems*sizeof(int));
+	}
+	
+	// Fill the runs front to back so each run is sorted by item index.
+	int *cellItems = hash->cellItems;
+	for(int item=0; item<numItems; item++){
+		cpSpaceHashRange range = items[item].range;
+		for(int i=range.l; i<=range.r; i++){
+			for(int j=range.b; j<=range.t; j++){
+				int index = hash_func(i,j,n);
+				cellItems[cellStart[index] + cellCount[index]++] = item;
+			}
+		}
+	}
 	
+	hash->numRemoved = 0;
+	hash->dirty = 0;
+}
+
+// Remove one occurance of the item from each of the cells in the range.
+static void
+unlinkItem(cpSpaceHash *hash, int item, cpSpaceHashRange range)
+{
+	int *cellItems = hash->cellItems;
 	int n = hash->numcells;
-	for(int i=l; i<=r; i++){
-		for(int j=b; j<=t; j++){
+	
+	for(int i=range.l; i<=range.r; i++){
+		for(int j=range.b; j<=range.t; j++){
 			int index = hash_func(i,j,n);
-			cpSpaceHashBin *bin = hash->table[index];
+			int *run = cellItems + hash->cellStart[index];
+			int count = hash->cellCount[index];
 			
-			// Don't add an object twice to the same cell.
-			if(containsHandle(bin, hand)) continue;
-
-			cpHandleRetain(hand);
-			// Insert a new bin for the handle in this cell.
-			cpSpaceHashBin *newBin = getEmptyBin(hash);
-			newBin->handle = hand;
-			newBin->next = bin;
-			hash->table[index] = newBin;
+			int k = 0;
+			while(run[k] != item) k++;
+			memmove(run + k, run + k + 1, (count - k - 1)*sizeof(int));
+			hash->cellCount[index]--;
 		}
 	}
 }
 
-void
-cpSpaceHashInsert(cpSpaceHash *hash, void *obj, unsigned int id, cpBB bb)
+// Insert the item into each of the cells in the range keeping the runs sorted.
+// Returns false if a run ran out of room. The cells are left in an
+// inconsistent state and must be rebuilt.
+static int
+linkItem(cpSpaceHash *hash, int item, cpSpaceHashRange range)
 {
-	cpHandle *hand = (cpHandle *)cpHashSetInsert(hash->handleSet, id, obj, NULL);
-	hashHandle(hash, hand, bb);
+	int *cellItems = hash->cellItems;
+	int n = hash->numcells;
+	
+	for(int i=range.l; i<=range.r; i++){
+		for(int j=range.b; j<=range.t; j++){
+			int index = hash_func(i,j,n);
+			int *run = cellItems + hash->cellStart[index];
+			int count = hash->cellCount[index];
+			if(hash->cellStart[index] + count == hash->cellStart[index + 1]) return 0;
+			
+			int k = count;
+			while(k > 0 && run[k - 1] > item){
+				run[k] = run[k - 1];
+				k--;
+			}
+			run[k] = item;
+			hash->cellCount[index]++;
+		}
+	}
+	
+	return 1;
 }
 
-void
-cpSpaceHashRehashObject(cpSpaceHash *hash, void *obj, unsigned int id)
+// Move an item to the cells of a new BBox if they changed.
+static inline int
+relinkItem(cpSpaceHash *hash, int item, cpBB bb)
 {
-	cpHandle *hand = (cpHandle *)cpHashSetFind(hash->handleSet, id, obj);
-	hashHandle(hash, hand, hash->bbfunc(obj));
+	cpSpaceHashItem *ptr = &hash->items[item];
+	cpSpaceHashRange range = getCellRange(hash, bb);
+	if(rangeEql(range, ptr->range)) return 1;
+	
+	unlinkItem(hash, item, ptr->range);
+	ptr->range = range;
+	return linkItem(hash, item, range);
 }
 
-// Hashset iterator function for rehashing the spatial hash. (hash hash hash hash?)
+// Used by incrementalUpdate() to relink the handles.
+typedef struct updatePair {
+	cpSpaceHash *hash;
+	int ok;
+} updatePair;
+
 static void
-handleRehashHelper(void *elt, void *data)
+updateHelper(void *elt, void *data)
 {
 	cpHandle *hand = (cpHandle *)elt;
-	cpSpaceHash *hash = (cpSpaceHash *)data;
+	updatePair *pair = (updatePair *)data;
+	cpSpaceHash *hash = pair->hash;
+	
+	// Give up once a run overflowed, it's all getting rebuilt anyway.
+	if(!pair->ok) return;
 	
-	hashHandle(hash, hand, hash->bbfunc(hand->obj));
+	hand->bb = hash->index.bbfunc(hand->obj);
+	pair->ok = relinkItem(hash, hand->index, hand->bb);
+}
+
+static int
+incrementalUpdate(cpSpaceHash *hash)
+{
+	updatePair pair = {hash, 1};
+	cpHashSetEach(hash->handleSet, &updateHelper, &pair);
+	
+	return pair.ok;
+}
+
+// Update the BBoxes of all the objects and rebucket them.
+static void
+refresh(cpSpaceHash *hash)
+{
+	// Rebuild from scratch if objects were added, the table was resized,
+	// lots of objects were removed or a run ran out of room.
+	if(
+		!hash->incremental || hash->dirty
+		|| hash->numRemoved*4 > hash->numItems
+		|| !incrementalUpdate(hash)
+	) rebuild(hash, 1);
 }
 
 void
-cpSpaceHashRehash(cpSpaceHash *hash)
+cpSpaceHashInsert(cpSpaceHash *hash, void *obj, unsigned int id, cpBB bb)
+{
+	cpHandle *hand = (cpHandle *)cpHashSetInsert(hash->handleSet, id, obj, hash);
+	hand->bb = bb;
+	hash->dirty = 1;
+}
+
+void
+cpSpaceHashRehashObject(cpSpaceHash *hash, void *obj, unsigned int id)
 {
-	clearHash(hash);
+	cpHandle *hand = (cpHandle *)cpHashSetFind(hash->handleSet, id, obj);
+	if(!hand) return;
 	
-	// Rehash all of the handles.
-	cpHashSetEach(hash->handleSet, &handleRehashHelper, hash);
+	hand->bb = hash->index.bbfunc(obj);
+	if(hash->incremental && !hash->dirty && hand->index >= 0){
+		if(!relinkItem(hash, hand->index, hand->bb)) hash->dirty = 1;
+	} else {
+		hash->dirty = 1;
+	}
+}
+
+void
+cpSpaceHashRehash(cpSpaceHash *hash)
+{
+	refresh(hash);
 }
 
 void
 cpSpaceHashRemove(cpSpaceHash *hash, void *obj, unsigned int id)
 {
 	cpHandle *hand = (cpHandle *)cpHashSetRemove(hash->handleSet, id, obj);
-	hand->obj = NULL;
-	cpHandleRelease(hand);
+	if(!hand) return;
+	
+	// Blank out the item so the queries skip it until the next rebuild.
+	int index = hand->index;
+	if(index >= 0 && index < hash->numItems && hash->items[index].obj == obj){
+		hash->items[index].obj = NULL;
+		hash->numRemoved++;
+	}
+	
+	cpHandleFree(hash->allocator, hand);
 }
 
 // Used by the cpSpaceHashEach() iterator.
@@ -331,48 +473,44 @@ cpSpaceHashEach(cpSpaceHash *hash, cpSpaceHashIterator func, void *data)
 	cpHashSetEach(hash->handleSet, &eachHelper, &pair);
 }
 
-// Calls the callback function for the objects in a given chain.
-static inline void
-query(cpSpaceHash *hash, cpSpaceHashBin *bin, void *obj, cpSpaceHashQueryFunc func, void *data)
-{
-	for(; bin; bin = bin->next){
-		cpHandle *hand = bin->handle;
-		void *other = hand->obj;
-		
-		// Skip over certain conditions
-		if(
-		   // Have we already tried this pair in this query?
-		   hand->stamp == hash->stamp
-		   // Is obj the same as other?
-		   || obj == other 
-		   // Has other been removed since the last rehash?
-		   || !other
-		   ) continue;
-		
-		func(obj, other, data);
-
-		// Stamp that the handle was checked already against this object.
-		hand->stamp = hash->stamp;
-	}
-}
-
 void
 cpSpaceHashQuery(cpSpaceHash *hash, void *obj, cpBB bb, cpSpaceHashQueryFunc func, void *data)
 {
-	// Get the dimensions in cell coordinates.
-	cpFloat dim = hash->celldim;
-	int l = bb.l/dim;
-	int r = bb.r/dim;
-	int b = bb.b/dim;
-	int t = bb.t/dim;
+	if(hash->dirty) rebuild(hash, 0);
 	
+	cpSpaceHashItem *items = hash->items;
+	int *cellStart = hash->cellStart;
+	int *cellCount = hash->cellCount;
+	int *cellItems = hash->cellItems;
+	int stamp = hash->stamp;
 	int n = hash->numcells;
 	
 	// Iterate over the cells and query them.
-	for(int i=l; i<=r; i++){
-		for(int j=b; j<=t; j++){
+	cpSpaceHashRange range = getCellRange(hash, bb);
+	for(int i=range.l; i<=range.r; i++){
+		for(int j=range.b; j<=range.t; j++){
 			int index = hash_func(i,j,n);
-			query(hash, hash->table[index], obj, func, data);
+			int *run = cellItems + cellStart[index];
+			
+			for(int k=0; k<cellCount[index]; k++){
+				cpSpaceHashItem *item = &items[run[k]];
+				void *other = item->obj;
+				
+				// Skip over certain conditions
+				if(
+				   // Have we already tried this pair in this query?
+				   item->stamp == stamp
+				   // Is obj the same as other?
+				   || obj == other
+				   // Has other been removed since the last rehash?
+				   || !other
+				   ) continue;
+				
+				func(obj, other, data);
+				
+				// Stamp that the item was checked already against this object.
+				item->stamp = stamp;
+			}
 		}
 	}
 	
@@ -380,60 +518,210 @@ cpSpaceHashQuery(cpSpaceHash *hash, void *obj, cpBB bb, cpSpaceHashQueryFunc fun
 	hash->stamp++;
 }
 
-// Similar to struct eachPair above.
-typedef struct queryRehashPair {
-	cpSpaceHash *hash;
-	cpSpaceHashQueryFunc func;
-	void *data;
-} queryRehashPair;
-
-// Hashset iterator func used with cpSpaceHashQueryRehash().
-static void
-handleQueryRehashHelper(void *elt, void *data)
+void
+cpSpaceHashQueryRehash(cpSpaceHash *hash, cpSpaceHashQueryFunc func, void *data)
 {
-	cpHandle *hand = (cpHandle *)elt;
+	refresh(hash);
 	
-	// Unpack the user callback data.
-	queryRehashPair *pair = (queryRehashPair *)data;
-	cpSpaceHash *hash = pair->hash;
-	cpSpaceHashQueryFunc func = pair->func;
-
-	cpFloat dim = hash->celldim;
+	cpSpaceHashItem *items = hash->items;
+	int *cellStart = hash->cellStart;
+	int *cellCount = hash->cellCount;
+	int *cellItems = hash->cellItems;
+	
+	// Query each item against the items before it so each pair is found once.
+	// The runs are sorted, so each cell can stop at the first later item.
 	int n = hash->numcells;
+	
+	for(int current=0; current<hash->numItems; current++){
+		void *obj = items[current].obj;
+		int stamp = hash->stamp;
+		
+		// Removed items are still linked into their cells until the next rebuild.
+		if(!obj) continue;
+		
+		cpSpaceHashRange range = items[current].range;
+		for(int i=range.l; i<=range.r; i++){
+			for(int j=range.b; j<=range.t; j++){
+				int index = hash_func(i,j,n);
+				int *run = cellItems + cellStart[index];
+				
+				for(int k=0; k<cellCount[index]; k++){
+					int other_index = run[k];
+					if(other_index >= current) break;
+					
+					cpSpaceHashItem *item = &items[other_index];
+					if(item->stamp == stamp || !item->obj) continue;
+					
+					func(obj, item->obj, data);
+					item->stamp = stamp;
+				}
+			}
+		}
+		
+		// Increment the stamp for each object we query.
+		hash->stamp++;
+	}
+}
 
-	void *obj = hand->obj;
-	cpBB bb = hash->bbfunc(obj);
+// Tuning parameters for cpSpaceHashTune().
+// Number of objects sampled to estimate the typical object size.
+#define TUNE_SAMPLES 64
+// The cell size is changed when it's more than this factor away from the median object size.
+#define TUNE_DIM_RATIO CP_FLOAT(2.0f)
+// Load is the number of cell entries per cell. The table is grown above
+// TUNE_MAX_LOAD and shrunk below TUNE_MIN_LOAD to about TUNE_TARGET_LOAD.
+// The load statistics are plain floats even in fixed point mode. Tuning
+// is rare, and the counts can be larger than a fixed point cpFloat holds.
+#define TUNE_MAX_LOAD 2.0f
+#define TUNE_MIN_LOAD 0.125f
+#define TUNE_TARGET_LOAD 0.5f
+// Average entries per occupied cell above which the table is grown early.
+#define TUNE_MAX_CHAIN 8.0f
+#define TUNE_MIN_CELLS 37
 
-	int l = bb.l/dim;
-	int r = bb.r/dim;
-	int b = bb.b/dim;
-	int t = bb.t/dim;
+static int
+floatCompare(const void *a, const void *b)
+{
+	cpFloat fa = *(const cpFloat *)a;
+	cpFloat fb = *(const cpFloat *)b;
+	return (fa > fb) - (fa < fb);
+}
 
-	for(int i=l; i<=r; i++){
-		for(int j=b; j<=t; j++){
-			int index = hash_func(i,j,n);
-			cpSpaceHashBin *bin = hash->table[index];
-			
-			if(containsHandle(bin, hand)) continue;
-			query(hash, bin, obj, func, pair->data);
-			
-			cpHandleRetain(hand);
-			cpSpaceHashBin *newBin = getEmptyBin(hash);
-			newBin->handle = hand;
-			newBin->next = bin;
-			hash->table[index] = newBin;
-		}
+// Number of cells a BBox would cover with the given cell size.
+static inline int
+cellsCovered(cpBB bb, cpFloat dim)
+{
+	int w = cpftoint(cpfdiv(bb.r, dim)) - cpftoint(cpfdiv(bb.l, dim)) + 1;
+	int h = cpftoint(cpfdiv(bb.t, dim)) - cpftoint(cpfdiv(bb.b, dim)) + 1;
+	return w*h;
+}
+
+int
+cpSpaceHashTune(cpSpaceHash *hash)
+{
+	if(hash->dirty) rebuild(hash, 0);
+	
+	int numItems = hash->numItems - hash->numRemoved;
+	if(numItems <= 0) return 0;
+	
+	// Sample the sizes of evenly spaced objects.
+	cpBB bbs[TUNE_SAMPLES];
+	cpFloat sizes[TUNE_SAMPLES];
+	int numSamples = 0;
+	
+	int stride = hash->numItems/TUNE_SAMPLES + 1;
+	for(int i=0; i<hash->numItems && numSamples<TUNE_SAMPLES; i+=stride){
+		void *obj = hash->items[i].obj;
+		if(!obj) continue;
+		
+		cpBB bb = hash->index.bbfunc(obj);
+		bbs[numSamples] = bb;
+		sizes[numSamples] = cpfmax(bb.r - bb.l, bb.t - bb.b);
+		numSamples++;
 	}
+	if(!numSamples) return 0;
 	
-	// Increment the stamp for each object we hash.
-	hash->stamp++;
+	qsort(sizes, numSamples, sizeof(cpFloat), &floatCompare);
+	cpFloat median = sizes[numSamples/2];
+	
+	cpFloat dim = hash->celldim;
+	if(median > 0.0f && (cpfmul(dim, TUNE_DIM_RATIO) < median || dim > cpfmul(median, TUNE_DIM_RATIO)))
+		dim = median;
+	
+	// Count the cell entries and the occupied cells.
+	int entries = 0, occupied = 0;
+	for(int i=0; i<hash->numcells; i++){
+		entries += hash->cellCount[i];
+		occupied += (hash->cellCount[i] > 0);
+	}
+	
+	// Estimate the entries from the samples if the cell size changes.
+	if(dim != hash->celldim){
+		int covered = 0;
+		for(int i=0; i<numSamples; i++) covered += cellsCovered(bbs[i], dim);
+		entries = (int)((float)covered/numSamples*numItems);
+	}
+	
+	float load = (float)entries/hash->numcells;
+	float chain = (occupied ? (float)entries/occupied : 0.0f);
+	
+	int numcells = hash->numcells;
+	if(
+		load > TUNE_MAX_LOAD || load < TUNE_MIN_LOAD
+		|| (chain > TUNE_MAX_CHAIN && load > TUNE_TARGET_LOAD)
+	){
+		int target = next_prime((int)(entries/TUNE_TARGET_LOAD));
+		numcells = (target > TUNE_MIN_CELLS ? target : TUNE_MIN_CELLS);
+	}
+	
+	if(dim == hash->celldim && numcells == hash->numcells) return 0;
+	
+	cpSpaceHashResize(hash, dim, numcells);
+	return 1;
 }
 
-void
-cpSpaceHashQueryRehash(cpSpaceHash *hash, cpSpaceHashQueryFunc func, void *data)
+// cpSpatialIndex wrappers.
+static void
+destroyImpl(cpSpatialIndex *index)
+{
+	cpSpaceHashDestroy((cpSpaceHash *)index);
+}
+
+static void
+insertImpl(cpSpatialIndex *index, void *obj, unsigned int id, cpBB bb)
 {
-	clearHash(hash);
+	cpSpaceHashInsert((cpSpaceHash *)index, obj, id, bb);
+}
+
+static void
+removeImpl(cpSpatialIndex *index, void *obj, unsigned int id)
+{
+	cpSpaceHashRemove((cpSpaceHash *)index, obj, id);
+}
+
+static void
+eachImpl(cpSpatialIndex *index, cpSpatialIndexIterator func, void *data)
+{
+	cpSpaceHashEach((cpSpaceHash *)index, func, data);
+}
 
-	queryRehashPair pair = {hash, func, data};
-	cpHashSetEach(hash->handleSet, &handleQueryRehashHelper, &pair);
+static void
+rehashImpl(cpSpatialIndex *index)
+{
+	cpSpaceHashRehash((cpSpaceHash *)index);
+}
+
+static void
+rehashObjectImpl(cpSpatialIndex *index, void *obj, unsigned int id)
+{
+	cpSpaceHashRehashObject((cpSpaceHash *)index, obj, id);
+}
+
+static void
+queryImpl(cpSpatialIndex *index, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
+{
+	cpSpaceHashQuery((cpSpaceHash *)index, obj, bb, func, data);
+}
+
+static void
+queryRehashImpl(cpSpatialIndex *index, cpSpatialIndexQueryFunc func, void *data)
+{
+	cpSpaceHashQueryRehash((cpSpaceHash *)index, func, data);
+}
+
+static cpSpatialIndexClass klass = {
+	destroyImpl,
+	insertImpl,
+	removeImpl,
+	eachImpl,
+	rehashImpl,
+	rehashObjectImpl,
+	queryImpl,
+	queryRehashImpl,
+};
+
+cpSpatialIndexClass *
+cpSpaceHashGetClass(void)
+{
+	return &klass;
 }
@@ -19,46 +19,80 @@
  * SOFTWARE.
  */
 
-// The spatial hash is Chipmunk's default (and currently only) spatial index type.
-// Based on a chained hash table.
+// The spatial hash is Chipmunk's default spatial index type.
+// The objects are bucketed into cells with a counting sort whenever the hash
+// is rehashed, so each cell is a contiguous run of indexes into a flat item
+// array instead of a linked list. Objects inserted between rehashes are
+// bucketed lazily by the next query.
+//
+// In incremental mode the runs are given some slack so that a rehash only
+// has to unlink and relink the objects whose cell range changed. Mostly
+// resting scenes then pay for the objects that move instead of all of them.
 
 // Used internally to track objects added to the hash
 typedef struct cpHandle{
 	// Pointer to the object
 	void *obj;
-	// Retain count
-	int retain;
+	// BBox the object was last hashed with.
+	cpBB bb;
+	// Index of the object in the item array. -1 until the next rebuild.
+	int index;
+} cpHandle;
+
+// Bounds of a BBox in cell coordinates.
+typedef struct cpSpaceHashRange{
+	int l, r, b, t;
+} cpSpaceHashRange;
+
+// Flat copy of a handle used by the queries.
+typedef struct cpSpaceHashItem{
+	// Pointer to the object. NULL if it was removed since the last rebuild.
+	void *obj;
 	// Query stamp. Used to make sure two objects
 	// aren't identified twice in the same query.
 	int stamp;
-} cpHandle;
-
-// Linked list element for in the chains.
-typedef struct cpSpaceHashBin{
-	cpHandle *handle;
-	struct cpSpaceHashBin *next;
-} cpSpaceHashBin;
+	// Cells the object is currently linked into.
+	cpSpaceHashRange range;
+} cpSpaceHashItem;
 
 // BBox callback. Called whenever the hash needs a bounding box from an object.
-typedef cpBB (*cpSpaceHashBBFunc)(void *obj);
+typedef cpSpatialIndexBBFunc cpSpaceHashBBFunc;
 
 typedef struct cpSpaceHash{
+	// Spatial index base. (holds the bbfunc)
+	cpSpatialIndex index;
+	
+	// Allocator for the handles. (see cpSpaceHashSetAllocator())
+	cpAllocator *allocator;
+	
 	// Number of cells in the table.
 	int numcells;
 	// Dimentions of the cells.
 	cpFloat celldim;
 	
-	// BBox callback.
-	cpSpaceHashBBFunc bbfunc;
-
 	// Hashset of all the handles.
 	cpHashSet *handleSet;
 	
-	cpSpaceHashBin **table;
-	// List of recycled bins.
-	cpSpaceHashBin *bins;
+	// Items in handle set order as of the last rebuild.
+	int numItems, maxItems;
+	cpSpaceHashItem *items;
+	
+	// Cell i holds the cellCount[i] item indexes starting at
+	// cellItems[cellStart[i]] in increasing order. The run may grow up to
+	// cellStart[i + 1]. (numcells + 1 entries)
+	int *cellStart;
+	int *cellCount;
+	int maxCellItems;
+	int *cellItems;
+	
+	// True if objects were added or the table resized since the last rebuild.
+	int dirty;
+	// Only relink the objects whose cells changed when rehashing.
+	int incremental;
+	// Number of items blanked out since the last rebuild.
+	int numRemoved;
 
-	// Incremented on each query. See cpHandle.stamp.
+	// Incremented on each query. See cpSpaceHashItem.stamp.
 	int stamp;
 } cpSpaceHash;
 
@@ -70,8 +104,24 @@ cpSpaceHash *cpSpaceHashNew(cpFloat celldim, int cells, cpSpaceHashBBFunc bbfunc
 void cpSpaceHashDestroy(cpSpaceHash *hash);
 void cpSpaceHashFree(cpSpaceHash *hash);
 
-// Resize the hashtable. (Does not rehash! You must call cpSpaceHashRehash() if needed.)
+// cpSpatialIndex class for the spatial hash.
+cpSpatialIndexClass *cpSpaceHashGetClass(void);
+
+// Resize the hashtable. (The objects are rebucketed with their old BBoxes
+// by the next query. Call cpSpaceHashRehash() to update them as well.)
 void cpSpaceHashResize(cpSpaceHash *hash, cpFloat celldim, int numcells);
+// Enable or disable incremental rehashing. (Disabled by default)
+// Uses more memory for the cells, but is much faster when most of the
+// objects don't cross a cell boundary between rehashes.
+void cpSpaceHashSetIncremental(cpSpaceHash *hash, int incremental);
+// Allocate the handles with the allocator.
+// Only call this while the hash is empty. (Defaults to NULL, the heap)
+void cpSpaceHashSetAllocator(cpSpaceHash *hash, cpAllocator *allocator);
+// Resize the hash if the cell size is far off from the median object size
+// or the cells are too full or too empty. Returns true if it was resized.
+// The thresholds leave a wide margin so that the hash doesn't flip back and
+// forth between two sizes.
+int cpSpaceHashTune(cpSpaceHash *hash);
 
 // Add an object to the hash.
 void cpSpaceHashInsert(cpSpaceHash *hash, void *obj, unsigned int id, cpBB bb);
@@ -79,7 +129,7 @@ void cpSpaceHashInsert(cpSpaceHash *hash, void *obj, unsigned int id, cpBB bb);
 void cpSpaceHashRemove(cpSpaceHash *hash, void *obj, unsigned int id);
 
 // Iterator function
-typedef void (*cpSpaceHashIterator)(void *obj, void *data);
+typedef cpSpatialIndexIterator cpSpaceHashIterator;
 // Iterate over the objects in the hash.
 void cpSpaceHashEach(cpSpaceHash *hash, cpSpaceHashIterator func, void *data);
 
@@ -89,7 +139,7 @@ void cpSpaceHashRehash(cpSpaceHash *hash);
 void cpSpaceHashRehashObject(cpSpaceHash *hash, void *obj, unsigned int id);
 
 // Query callback.
-typedef int (*cpSpaceHashQueryFunc)(void *obj1, void *obj2, void *data);
+typedef cpSpatialIndexQueryFunc cpSpaceHashQueryFunc;
 // Query the hash for a given BBox.
 void cpSpaceHashQuery(cpSpaceHash *hash, void *obj, cpBB bb, cpSpaceHashQueryFunc func, void *data);
 // Run a query for the object, then insert it. (Optimized case)
@@ -0,0 +1,109 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Generic interface for the spatial indexes used by cpSpace.
+// cpSpaceHash and cpBBTree both implement it, and you can plug in your own
+// index by filling in a cpSpatialIndexClass and embedding a cpSpatialIndex
+// as the first member of your index struct.
+
+// BBox callback. Called whenever the index needs a bounding box from an object.
+typedef cpBB (*cpSpatialIndexBBFunc)(void *obj);
+// Iterator function.
+typedef void (*cpSpatialIndexIterator)(void *obj, void *data);
+// Query callback.
+typedef int (*cpSpatialIndexQueryFunc)(void *obj1, void *obj2, void *data);
+
+struct cpSpatialIndex;
+
+// Virtual function table for a spatial index type.
+typedef struct cpSpatialIndexClass{
+	// Free everything the index owns except for the index struct itself.
+	void (*destroy)(struct cpSpatialIndex *index);
+	
+	// Add and remove objects. 'id' is used as the hash value for the object.
+	void (*insert)(struct cpSpatialIndex *index, void *obj, unsigned int id, cpBB bb);
+	void (*remove)(struct cpSpatialIndex *index, void *obj, unsigned int id);
+	
+	// Iterate over the objects in the index.
+	void (*each)(struct cpSpatialIndex *index, cpSpatialIndexIterator func, void *data);
+	
+	// Update the index for all objects, or a single object.
+	void (*rehash)(struct cpSpatialIndex *index);
+	void (*rehashObject)(struct cpSpatialIndex *index, void *obj, unsigned int id);
+	
+	// Call func for each object in the index whose bounds may overlap bb.
+	void (*query)(struct cpSpatialIndex *index, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data);
+	// Rehash the index while calling func once for each pair of objects that may overlap.
+	void (*queryRehash)(struct cpSpatialIndex *index, cpSpatialIndexQueryFunc func, void *data);
+} cpSpatialIndexClass;
+
+// Base struct that all spatial indexes start with.
+typedef struct cpSpatialIndex{
+	cpSpatialIndexClass *klass;
+	
+	// BBox callback.
+	cpSpatialIndexBBFunc bbfunc;
+} cpSpatialIndex;
+
+// Frees the index using its class destructor.
+void cpSpatialIndexFree(cpSpatialIndex *index);
+
+static inline void
+cpSpatialIndexInsert(cpSpatialIndex *index, void *obj, unsigned int id, cpBB bb)
+{
+	index->klass->insert(index, obj, id, bb);
+}
+
+static inline void
+cpSpatialIndexRemove(cpSpatialIndex *index, void *obj, unsigned int id)
+{
+	index->klass->remove(index, obj, id);
+}
+
+static inline void
+cpSpatialIndexEach(cpSpatialIndex *index, cpSpatialIndexIterator func, void *data)
+{
+	index->klass->each(index, func, data);
+}
+
+static inline void
+cpSpatialIndexRehash(cpSpatialIndex *index)
+{
+	index->klass->rehash(index);
+}
+
+static inline void
+cpSpatialIndexRehashObject(cpSpatialIndex *index, void *obj, unsigned int id)
+{
+	index->klass->rehashObject(index, obj, id);
+}
+
+static inline void
+cpSpatialIndexQuery(cpSpatialIndex *index, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
+{
+	index->klass->query(index, obj, bb, func, data);
+}
+
+static inline void
+cpSpatialIndexQueryRehash(cpSpatialIndex *index, cpSpatialIndexQueryFunc func, void *data)
+{
+	index->klass->queryRehash(index, func, data);
+}
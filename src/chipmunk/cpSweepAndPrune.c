@@ -0,0 +1,593 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ 
+#include <stdlib.h>
+#include <string.h>
+
+#include "chipmunk.h"
+
+// Equality function for the proxy set.
+static int
+proxySetEql(void *obj, void *elt)
+{
+	cpSweepProxy *proxy = (cpSweepProxy *)elt;
+	return (obj == proxy->obj);
+}
+
+// Transformation function for the proxy set.
+static void *
+proxySetTrans(void *obj, void *unused)
+{
+	cpSweepProxy *proxy = (cpSweepProxy *)malloc(sizeof(cpSweepProxy));
+	proxy->obj = obj;
+	proxy->pairs = NULL;
+	proxy->inserted = 1;
+	proxy->removed = 0;
+	
+	return proxy;
+}
+
+// Get the thread of a pair that belongs to the given proxy.
+static inline cpSweepThread *
+threadFor(cpSweepPair *pair, cpSweepProxy *proxy)
+{
+	return (pair->a.proxy == proxy ? &pair->a : &pair->b);
+}
+
+// Link a pair onto the front of a proxy's pair list.
+static void
+threadLink(cpSweepPair *pair, cpSweepThread *thread, cpSweepProxy *proxy)
+{
+	cpSweepPair *next = proxy->pairs;
+	if(next) threadFor(next, proxy)->prev = pair;
+	
+	thread->prev = NULL;
+	thread->proxy = proxy;
+	thread->next = next;
+	proxy->pairs = pair;
+}
+
+static void
+threadUnlink(cpSweepThread *thread)
+{
+	cpSweepProxy *proxy = thread->proxy;
+	cpSweepPair *prev = thread->prev;
+	cpSweepPair *next = thread->next;
+	
+	if(next) threadFor(next, proxy)->prev = prev;
+	
+	if(prev){
+		threadFor(prev, proxy)->next = next;
+	} else {
+		proxy->pairs = next;
+	}
+}
+
+// Equality function for the pair set.
+static int
+pairSetEql(void *ptr, void *elt)
+{
+	cpSweepProxy **proxies = (cpSweepProxy **)ptr;
+	cpSweepProxy *a = proxies[0];
+	cpSweepProxy *b = proxies[1];
+	
+	cpSweepPair *pair = (cpSweepPair *)elt;
+	
+	return ((a == pair->a.proxy && b == pair->b.proxy) || (b == pair->a.proxy && a == pair->b.proxy));
+}
+
+// Transformation function for the pair set.
+// Gets a recycled or new pair and links it into the lists of both proxies.
+static void *
+pairSetTrans(void *ptr, void *data)
+{
+	cpSweepProxy **proxies = (cpSweepProxy **)ptr;
+	cpSweepAndPrune *sap = (cpSweepAndPrune *)data;
+	
+	cpSweepPair *pair = sap->pooledPairs;
+	if(pair){
+		sap->pooledPairs = pair->a.next;
+	} else {
+		pair = (cpSweepPair *)malloc(sizeof(cpSweepPair));
+	}
+	
+	threadLink(pair, &pair->a, proxies[0]);
+	threadLink(pair, &pair->b, proxies[1]);
+	
+	return pair;
+}
+
+static void
+recyclePair(cpSweepAndPrune *sap, cpSweepPair *pair)
+{
+	pair->a.next = sap->pooledPairs;
+	sap->pooledPairs = pair;
+}
+
+cpSweepAndPrune *
+cpSweepAndPruneAlloc(void)
+{
+	return (cpSweepAndPrune *)calloc(1, sizeof(cpSweepAndPrune));
+}
+
+cpSweepAndPrune *
+cpSweepAndPruneInit(cpSweepAndPrune *sap, cpSpatialIndexBBFunc bbfunc)
+{
+	sap->index.klass = cpSweepAndPruneGetClass();
+	sap->index.bbfunc = bbfunc;
+	
+	sap->proxies = cpHashSetNew(0, &proxySetEql, &proxySetTrans);
+	
+	sap->numEndpoints = 0;
+	sap->numSorted = 0;
+	sap->maxEndpoints = 16;
+	sap->endpoints[0] = (cpSweepEndpoint *)malloc(sap->maxEndpoints*sizeof(cpSweepEndpoint));
+	sap->endpoints[1] = (cpSweepEndpoint *)malloc(sap->maxEndpoints*sizeof(cpSweepEndpoint));
+	
+	sap->dirty = 0;
+	sap->removed = cpArrayNew(0);
+	sap->active = cpArrayNew(0);
+	
+	sap->pairs = cpHashSetNew(0, &pairSetEql, &pairSetTrans);
+	sap->pooledPairs = NULL;
+	
+	return sap;
+}
+
+cpSweepAndPrune *
+cpSweepAndPruneNew(cpSpatialIndexBBFunc bbfunc)
+{
+	return cpSweepAndPruneInit(cpSweepAndPruneAlloc(), bbfunc);
+}
+
+static void freeWrap(void *ptr, void *unused){free(ptr);}
+
+void
+cpSweepAndPruneDestroy(cpSweepAndPrune *sap)
+{
+	cpHashSetEach(sap->proxies, &freeWrap, NULL);
+	cpHashSetFree(sap->proxies);
+	
+	cpArrayEach(sap->removed, &freeWrap, NULL);
+	cpArrayFree(sap->removed);
+	cpArrayFree(sap->active);
+	
+	cpHashSetEach(sap->pairs, &freeWrap, NULL);
+	cpHashSetFree(sap->pairs);
+	
+	cpSweepPair *pair = sap->pooledPairs;
+	while(pair){
+		cpSweepPair *next = pair->a.next;
+		free(pair);
+		pair = next;
+	}
+	
+	free(sap->endpoints[0]);
+	free(sap->endpoints[1]);
+}
+
+void
+cpSweepAndPruneFree(cpSweepAndPrune *sap)
+{
+	if(!sap) return;
+	cpSweepAndPruneDestroy(sap);
+	free(sap);
+}
+
+static void
+addPair(cpSweepAndPrune *sap, cpSweepProxy *a, cpSweepProxy *b)
+{
+	cpSweepProxy *proxies[] = {a, b};
+	cpHashSetInsert(sap->pairs, CP_HASH_PAIR(a->id, b->id), proxies, sap);
+}
+
+static void
+removePair(cpSweepAndPrune *sap, cpSweepPair *pair)
+{
+	cpSweepProxy *a = pair->a.proxy;
+	cpSweepProxy *b = pair->b.proxy;
+	cpSweepProxy *proxies[] = {a, b};
+	cpHashSetRemove(sap->pairs, CP_HASH_PAIR(a->id, b->id), proxies);
+	
+	threadUnlink(&pair->a);
+	threadUnlink(&pair->b);
+	recyclePair(sap, pair);
+}
+
+// Add or remove the pair depending on whether the BBoxes overlap now.
+static void
+updatePair(cpSweepAndPrune *sap, cpSweepProxy *a, cpSweepProxy *b)
+{
+	if(cpBBintersects(a->bb, b->bb)){
+		addPair(sap, a, b);
+	} else {
+		cpSweepProxy *proxies[] = {a, b};
+		cpSweepPair *pair = (cpSweepPair *)cpHashSetFind(sap->pairs, CP_HASH_PAIR(a->id, b->id), proxies);
+		if(pair) removePair(sap, pair);
+	}
+}
+
+// Endpoint ordering. Min endpoints go first on ties so that touching
+// BBoxes are ordered the same way cpBBintersects() treats them.
+static inline int
+endpointLess(cpSweepEndpoint a, cpSweepEndpoint b)
+{
+	return (a.value < b.value || (a.value == b.value && !a.isMax && b.isMax));
+}
+
+static int
+endpointCompare(const void *a, const void *b)
+{
+	cpSweepEndpoint ea = *(cpSweepEndpoint *)a;
+	cpSweepEndpoint eb = *(cpSweepEndpoint *)b;
+	
+	return (endpointLess(ea, eb) ? -1 : endpointLess(eb, ea));
+}
+
+// Insertion sort the sorted part of an axis.
+// Whenever a min and a max endpoint swap, the overlap of those two proxies
+// may have changed, so the pair is updated.
+static void
+sortAxis(cpSweepAndPrune *sap, int axis)
+{
+	cpSweepEndpoint *endpoints = sap->endpoints[axis];
+	int num = sap->numSorted;
+	
+	for(int i=1; i<num; i++){
+		cpSweepEndpoint endpoint = endpoints[i];
+		
+		int j = i - 1;
+		for(; j>=0 && endpointLess(endpoint, endpoints[j]); j--){
+			cpSweepEndpoint other = endpoints[j];
+			if(endpoint.isMax != other.isMax) updatePair(sap, endpoint.proxy, other.proxy);
+			
+			endpoints[j + 1] = other;
+		}
+		
+		endpoints[j + 1] = endpoint;
+	}
+}
+
+// Sort the inserted endpoints of an axis and merge them into the sorted part.
+static void
+mergeAxis(cpSweepAndPrune *sap, int axis, cpSweepEndpoint *buffer)
+{
+	cpSweepEndpoint *endpoints = sap->endpoints[axis];
+	int numInserted = sap->numEndpoints - sap->numSorted;
+	
+	memcpy(buffer, endpoints + sap->numSorted, numInserted*sizeof(cpSweepEndpoint));
+	qsort(buffer, numInserted, sizeof(cpSweepEndpoint), &endpointCompare);
+	
+	// Merge from the back so the sorted endpoints can be moved in place.
+	int i = sap->numSorted - 1;
+	int j = numInserted - 1;
+	for(int k=sap->numEndpoints - 1; j>=0; k--){
+		if(i >= 0 && endpointLess(buffer[j], endpoints[i])){
+			endpoints[k] = endpoints[i--];
+		} else {
+			endpoints[k] = buffer[j--];
+		}
+	}
+}
+
+// Sweep the x axis to find the pairs of the inserted proxies.
+// Proxies stay in the active list from their min to their max endpoint, and
+// two proxies overlap on the x axis when one starts while the other is active.
+static void
+sweepInserted(cpSweepAndPrune *sap)
+{
+	cpSweepEndpoint *xs = sap->endpoints[0];
+	cpArray *active = sap->active;
+	int activeInserted = 0;
+	
+	for(int i=0; i<sap->numEndpoints; i++){
+		cpSweepProxy *proxy = xs[i].proxy;
+		
+		if(xs[i].isMax){
+			cpArrayDeleteIndex(active, proxy->activeIndex);
+			if(proxy->activeIndex < active->num) ((cpSweepProxy *)active->arr[proxy->activeIndex])->activeIndex = proxy->activeIndex;
+			
+			if(proxy->inserted){
+				proxy->inserted = 0;
+				activeInserted--;
+			}
+		} else {
+			// Pairs between two old proxies are already known.
+			if(proxy->inserted || activeInserted){
+				for(int j=0; j<active->num; j++){
+					cpSweepProxy *other = (cpSweepProxy *)active->arr[j];
+					if((proxy->inserted || other->inserted) && cpBBintersects(proxy->bb, other->bb)) addPair(sap, proxy, other);
+				}
+			}
+			
+			proxy->activeIndex = active->num;
+			cpArrayPush(active, proxy);
+			if(proxy->inserted) activeInserted++;
+		}
+	}
+}
+
+// Drop the endpoints of removed proxies and free them.
+static void
+compactEndpoints(cpSweepAndPrune *sap)
+{
+	int num = 0, numSorted = 0;
+	
+	for(int axis=0; axis<2; axis++){
+		cpSweepEndpoint *endpoints = sap->endpoints[axis];
+		
+		num = 0;
+		for(int i=0; i<sap->numEndpoints; i++){
+			if(!endpoints[i].proxy->removed) endpoints[num++] = endpoints[i];
+			if(i == sap->numSorted - 1) numSorted = num;
+		}
+	}
+	
+	sap->numEndpoints = num;
+	sap->numSorted = numSorted;
+	
+	cpArrayEach(sap->removed, &freeWrap, NULL);
+	sap->removed->num = 0;
+}
+
+// Copy the proxy BBoxes into the endpoint arrays.
+static void
+updateEndpoints(cpSweepAndPrune *sap)
+{
+	cpSweepEndpoint *xs = sap->endpoints[0];
+	cpSweepEndpoint *ys = sap->endpoints[1];
+	
+	for(int i=0; i<sap->numEndpoints; i++){
+		cpBB bb = xs[i].proxy->bb;
+		xs[i].value = (xs[i].isMax ? bb.r : bb.l);
+		
+		bb = ys[i].proxy->bb;
+		ys[i].value = (ys[i].isMax ? bb.t : bb.b);
+	}
+}
+
+// Bring the endpoint arrays and the pair set up to date with the proxy BBoxes.
+static void
+sortEndpoints(cpSweepAndPrune *sap)
+{
+	if(sap->removed->num) compactEndpoints(sap);
+	updateEndpoints(sap);
+	
+	sortAxis(sap, 0);
+	sortAxis(sap, 1);
+	
+	if(sap->numSorted < sap->numEndpoints){
+		cpSweepEndpoint *buffer = (cpSweepEndpoint *)malloc((sap->numEndpoints - sap->numSorted)*sizeof(cpSweepEndpoint));
+		mergeAxis(sap, 0, buffer);
+		mergeAxis(sap, 1, buffer);
+		free(buffer);
+		
+		sap->numSorted = sap->numEndpoints;
+		sweepInserted(sap);
+	}
+	
+	sap->dirty = 0;
+}
+
+static void
+pushEndpoints(cpSweepAndPrune *sap, cpSweepProxy *proxy)
+{
+	if(sap->numEndpoints + 2 > sap->maxEndpoints){
+		sap->maxEndpoints *= 2;
+		for(int axis=0; axis<2; axis++){
+			size_t size = sap->maxEndpoints*sizeof(cpSweepEndpoint);
+			size_t old_size = sap->numEndpoints*sizeof(cpSweepEndpoint);
+			sap->endpoints[axis] = (cpSweepEndpoint *)realloc2(sap->endpoints[axis], size, old_size);
+		}
+	}
+	
+	cpBB bb = proxy->bb;
+	cpSweepEndpoint *xs = sap->endpoints[0] + sap->numEndpoints;
+	cpSweepEndpoint *ys = sap->endpoints[1] + sap->numEndpoints;
+	
+	cpSweepEndpoint xmin = {bb.l, 0, proxy}, xmax = {bb.r, 1, proxy};
+	cpSweepEndpoint ymin = {bb.b, 0, proxy}, ymax = {bb.t, 1, proxy};
+	xs[0] = xmin; xs[1] = xmax;
+	ys[0] = ymin; ys[1] = ymax;
+	
+	sap->numEndpoints += 2;
+}
+
+void
+cpSweepAndPruneInsert(cpSweepAndPrune *sap, void *obj, unsigned int id, cpBB bb)
+{
+	int entries = sap->proxies->entries;
+	cpSweepProxy *proxy = (cpSweepProxy *)cpHashSetInsert(sap->proxies, id, obj, NULL);
+	proxy->id = id;
+	proxy->bb = bb;
+	
+	// New endpoints wait at the end of the arrays until the next sort.
+	if(sap->proxies->entries != entries) pushEndpoints(sap, proxy);
+	sap->dirty = 1;
+}
+
+void
+cpSweepAndPruneRemove(cpSweepAndPrune *sap, void *obj, unsigned int id)
+{
+	cpSweepProxy *proxy = (cpSweepProxy *)cpHashSetRemove(sap->proxies, id, obj);
+	if(!proxy) return;
+	
+	while(proxy->pairs) removePair(sap, proxy->pairs);
+	
+	// The endpoints are compacted away at the next sort.
+	proxy->removed = 1;
+	cpArrayPush(sap->removed, proxy);
+	sap->dirty = 1;
+}
+
+// Used by the cpSweepAndPruneEach() iterator.
+typedef struct eachPair {
+	cpSpatialIndexIterator func;
+	void *data;
+} eachPair;
+
+static void
+eachHelper(void *elt, void *data)
+{
+	cpSweepProxy *proxy = (cpSweepProxy *)elt;
+	eachPair *pair = (eachPair *)data;
+	
+	pair->func(proxy->obj, pair->data);
+}
+
+void
+cpSweepAndPruneEach(cpSweepAndPrune *sap, cpSpatialIndexIterator func, void *data)
+{
+	eachPair pair = {func, data};
+	cpHashSetEach(sap->proxies, &eachHelper, &pair);
+}
+
+static void
+updateProxyHelper(void *elt, void *data)
+{
+	cpSweepProxy *proxy = (cpSweepProxy *)elt;
+	cpSweepAndPrune *sap = (cpSweepAndPrune *)data;
+	
+	proxy->bb = sap->index.bbfunc(proxy->obj);
+}
+
+void
+cpSweepAndPruneRehash(cpSweepAndPrune *sap)
+{
+	cpHashSetEach(sap->proxies, &updateProxyHelper, sap);
+	sortEndpoints(sap);
+}
+
+void
+cpSweepAndPruneRehashObject(cpSweepAndPrune *sap, void *obj, unsigned int id)
+{
+	cpSweepProxy *proxy = (cpSweepProxy *)cpHashSetFind(sap->proxies, id, obj);
+	if(!proxy) return;
+	
+	proxy->bb = sap->index.bbfunc(obj);
+	sap->dirty = 1;
+}
+
+void
+cpSweepAndPruneQuery(cpSweepAndPrune *sap, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
+{
+	if(sap->dirty) sortEndpoints(sap);
+	
+	cpSweepEndpoint *xs = sap->endpoints[0];
+	
+	// Only proxies that start left of the query's right edge can overlap it.
+	for(int i=0; i<sap->numEndpoints && xs[i].value <= bb.r; i++){
+		cpSweepProxy *proxy = xs[i].proxy;
+		if(xs[i].isMax || proxy->obj == obj) continue;
+		
+		if(cpBBintersects(proxy->bb, bb)) func(obj, proxy->obj, data);
+	}
+}
+
+// Similar to struct eachPair above.
+typedef struct queryRehashPair {
+	cpSpatialIndexQueryFunc func;
+	void *data;
+} queryRehashPair;
+
+static void
+pairQueryHelper(void *elt, void *data)
+{
+	cpSweepPair *pair = (cpSweepPair *)elt;
+	queryRehashPair *context = (queryRehashPair *)data;
+	
+	context->func(pair->a.proxy->obj, pair->b.proxy->obj, context->data);
+}
+
+void
+cpSweepAndPruneQueryRehash(cpSweepAndPrune *sap, cpSpatialIndexQueryFunc func, void *data)
+{
+	cpSweepAndPruneRehash(sap);
+	
+	queryRehashPair context = {func, data};
+	cpHashSetEach(sap->pairs, &pairQueryHelper, &context);
+}
+
+// cpSpatialIndex wrappers.
+static void
+destroyImpl(cpSpatialIndex *index)
+{
+	cpSweepAndPruneDestroy((cpSweepAndPrune *)index);
+}
+
+static void
+insertImpl(cpSpatialIndex *index, void *obj, unsigned int id, cpBB bb)
+{
+	cpSweepAndPruneInsert((cpSweepAndPrune *)index, obj, id, bb);
+}
+
+static void
+removeImpl(cpSpatialIndex *index, void *obj, unsigned int id)
+{
+	cpSweepAndPruneRemove((cpSweepAndPrune *)index, obj, id);
+}
+
+static void
+eachImpl(cpSpatialIndex *index, cpSpatialIndexIterator func, void *data)
+{
+	cpSweepAndPruneEach((cpSweepAndPrune *)index, func, data);
+}
+
+static void
+rehashImpl(cpSpatialIndex *index)
+{
+	cpSweepAndPruneRehash((cpSweepAndPrune *)index);
+}
+
+static void
+rehashObjectImpl(cpSpatialIndex *index, void *obj, unsigned int id)
+{
+	cpSweepAndPruneRehashObject((cpSweepAndPrune *)index, obj, id);
+}
+
+static void
+queryImpl(cpSpatialIndex *index, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
+{
+	cpSweepAndPruneQuery((cpSweepAndPrune *)index, obj, bb, func, data);
+}
+
+static void
+queryRehashImpl(cpSpatialIndex *index, cpSpatialIndexQueryFunc func, void *data)
+{
+	cpSweepAndPruneQueryRehash((cpSweepAndPrune *)index, func, data);
+}
+
+static cpSpatialIndexClass klass = {
+	destroyImpl,
+	insertImpl,
+	removeImpl,
+	eachImpl,
+	rehashImpl,
+	rehashObjectImpl,
+	queryImpl,
+	queryRehashImpl,
+};
+
+cpSpatialIndexClass *
+cpSweepAndPruneGetClass(void)
+{
+	return &klass;
+}
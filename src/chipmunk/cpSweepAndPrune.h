@@ -0,0 +1,124 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Sort and sweep spatial index.
+// Keeps the BBox endpoints of the objects sorted along both axes between
+// steps. Objects usually move very little from one step to the next, so an
+// insertion sort restores the order in close to linear time, and the set of
+// overlapping pairs is updated from the endpoint swaps it makes instead of
+// being rebuilt. Inserts and removes are deferred until the next sort, where
+// inserted endpoints are merged in with a single sweep. Best suited for the
+// active shapes of scenes with lots of coherent motion.
+
+struct cpSweepPair;
+
+// Used internally to track objects added to the index.
+typedef struct cpSweepProxy{
+	// Pointer to the object.
+	void *obj;
+	// Hash value of the object.
+	unsigned int id;
+	// BBox of the object as of the last sort.
+	cpBB bb;
+	
+	// Linked list of the pairs this proxy is part of.
+	struct cpSweepPair *pairs;
+	
+	// True until the proxy's endpoints are merged into the sorted arrays.
+	int inserted;
+	// True once removed. Freed when its endpoints are compacted away.
+	int removed;
+	// Position in the active list while sweeping.
+	int activeIndex;
+} cpSweepProxy;
+
+// One end of a proxy's BBox along an axis.
+typedef struct cpSweepEndpoint{
+	cpFloat value;
+	// True for the right/top end of the BBox.
+	int isMax;
+	cpSweepProxy *proxy;
+} cpSweepEndpoint;
+
+// Links a pair into the pair list of one of its proxies.
+typedef struct cpSweepThread{
+	struct cpSweepPair *prev;
+	cpSweepProxy *proxy;
+	struct cpSweepPair *next;
+} cpSweepThread;
+
+// A pair of proxies whose BBoxes overlap.
+typedef struct cpSweepPair{
+	cpSweepThread a, b;
+} cpSweepPair;
+
+typedef struct cpSweepAndPrune{
+	// Spatial index base. (holds the bbfunc)
+	cpSpatialIndex index;
+	
+	// Hashset of all the proxies.
+	cpHashSet *proxies;
+	
+	// Endpoint arrays for the x and y axes.
+	// The first numSorted endpoints are sorted, inserted ones follow them.
+	int numEndpoints, numSorted, maxEndpoints;
+	cpSweepEndpoint *endpoints[2];
+	
+	// Set when objects were inserted or removed since the last sort.
+	int dirty;
+	// Removed proxies that still have endpoints in the arrays.
+	cpArray *removed;
+	// Proxies overlapping the sweep line while merging in inserted proxies.
+	cpArray *active;
+	
+	// Set of currently overlapping pairs.
+	cpHashSet *pairs;
+	// List of recycled pairs. (Linked through a.next)
+	cpSweepPair *pooledPairs;
+} cpSweepAndPrune;
+
+// Basic allocation/destruction functions.
+cpSweepAndPrune *cpSweepAndPruneAlloc(void);
+cpSweepAndPrune *cpSweepAndPruneInit(cpSweepAndPrune *sap, cpSpatialIndexBBFunc bbfunc);
+cpSweepAndPrune *cpSweepAndPruneNew(cpSpatialIndexBBFunc bbfunc);
+
+void cpSweepAndPruneDestroy(cpSweepAndPrune *sap);
+void cpSweepAndPruneFree(cpSweepAndPrune *sap);
+
+// cpSpatialIndex class for sort and sweep.
+cpSpatialIndexClass *cpSweepAndPruneGetClass(void);
+
+// Add an object to the index.
+void cpSweepAndPruneInsert(cpSweepAndPrune *sap, void *obj, unsigned int id, cpBB bb);
+// Remove an object from the index.
+void cpSweepAndPruneRemove(cpSweepAndPrune *sap, void *obj, unsigned int id);
+
+// Iterate over the objects in the index.
+void cpSweepAndPruneEach(cpSweepAndPrune *sap, cpSpatialIndexIterator func, void *data);
+
+// Refresh the BBoxes, resort the endpoints and update the overlapping pairs.
+void cpSweepAndPruneRehash(cpSweepAndPrune *sap);
+void cpSweepAndPruneRehashObject(cpSweepAndPrune *sap, void *obj, unsigned int id);
+
+// Query the index for a given BBox.
+void cpSweepAndPruneQuery(cpSweepAndPrune *sap, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data);
+// Rehash, then call func once for each overlapping pair.
+void cpSweepAndPruneQueryRehash(cpSweepAndPrune *sap, cpSpatialIndexQueryFunc func, void *data);
@@ -0,0 +1,315 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ 
+#include <stdlib.h>
+
+#include "chipmunk.h"
+
+// Run a parallel for on the calling thread.
+static void
+runChunks(int count, int grain, cpJobFunc func, void *data)
+{
+	for(int start=0; start<count; start+=grain){
+		int end = start + grain;
+		func(data, start, (end < count ? end : count), 0);
+	}
+}
+
+static void jobsParallelFor(cpJobSystem *jobs, int count, int grain, cpJobFunc func, void *data){cpThreadsParallelFor((cpThreads *)jobs, count, grain, func, data);}
+static void jobsRunTeam(cpJobSystem *jobs, cpThreadsFunc func, void *data){cpThreadsRun((cpThreads *)jobs, func, data);}
+static void jobsBarrier(cpJobSystem *jobs){cpThreadsBarrier((cpThreads *)jobs);}
+
+// Fill in the cpJobSystem interface. It's the first member of cpThreads.
+static void
+initJobSystem(cpJobSystem *jobs, int threadCount)
+{
+	jobs->threadCount = threadCount;
+	jobs->parallelFor = jobsParallelFor;
+	jobs->runTeam = jobsRunTeam;
+	jobs->barrier = jobsBarrier;
+}
+
+#ifdef CP_USE_PTHREADS
+
+#include <pthread.h>
+#include <sched.h>
+
+// Number of times a waiting thread polls before it starts yielding.
+#define SPIN_COUNT 256
+
+typedef struct worker{
+	cpThreads *threads;
+	int index;
+	pthread_t handle;
+} worker;
+
+// Chunks of a parallel for still to be run from a thread's share.
+// Padded to keep the shares on separate cache lines.
+typedef struct forShare{
+	int next, end;
+	char padding[64 - 2*sizeof(int)];
+} forShare;
+
+struct cpThreads{
+	cpJobSystem jobs;
+	
+	int count;
+	worker *workers;
+	forShare *shares;
+	
+	// Workers sleep on start until generation changes.
+	pthread_mutex_t mutex;
+	pthread_cond_t start;
+	int generation;
+	int quit;
+	
+	// The function of the current run.
+	cpThreadsFunc func;
+	void *data;
+	// Number of workers that haven't finished the current run.
+	int pending;
+	
+	// Spin barrier. The last thread to arrive resets count and bumps the generation.
+	int barrierCount;
+	int barrierGeneration;
+};
+
+static inline void
+spinWait(int *value, int old)
+{
+	for(int i=0; __atomic_load_n(value, __ATOMIC_ACQUIRE) == old; i++){
+		if(i >= SPIN_COUNT) sched_yield();
+	}
+}
+
+static void *
+workerMain(void *ptr)
+{
+	worker *self = (worker *)ptr;
+	cpThreads *threads = self->threads;
+	int seen = 0;
+	
+	for(;;){
+		pthread_mutex_lock(&threads->mutex);
+		while(threads->generation == seen && !threads->quit)
+			pthread_cond_wait(&threads->start, &threads->mutex);
+		
+		seen = threads->generation;
+		int quit = threads->quit;
+		cpThreadsFunc func = threads->func;
+		void *data = threads->data;
+		pthread_mutex_unlock(&threads->mutex);
+		
+		if(quit) break;
+		
+		func(data, self->index, threads->count);
+		__atomic_sub_fetch(&threads->pending, 1, __ATOMIC_RELEASE);
+	}
+	
+	return NULL;
+}
+
+cpThreads *
+cpThreadsNew(int count)
+{
+	cpThreads *threads = (cpThreads *)calloc(1, sizeof(cpThreads));
+	threads->count = (count > 1 ? count : 1);
+	threads->shares = (forShare *)calloc(threads->count, sizeof(forShare));
+	
+	pthread_mutex_init(&threads->mutex, NULL);
+	pthread_cond_init(&threads->start, NULL);
+	
+	// The calling thread is thread 0 and doesn't need a worker.
+	threads->workers = (worker *)calloc(threads->count, sizeof(worker));
+	for(int i=1; i<threads->count; i++){
+		worker *w = &threads->workers[i];
+		w->threads = threads;
+		w->index = i;
+		
+		if(pthread_create(&w->handle, NULL, workerMain, w)){
+			// Make do with the threads that did start.
+			threads->count = i;
+			break;
+		}
+	}
+	
+	initJobSystem(&threads->jobs, threads->count);
+	return threads;
+}
+
+void
+cpThreadsFree(cpThreads *threads)
+{
+	if(!threads) return;
+	
+	pthread_mutex_lock(&threads->mutex);
+	threads->quit = 1;
+	pthread_cond_broadcast(&threads->start);
+	pthread_mutex_unlock(&threads->mutex);
+	
+	for(int i=1; i<threads->count; i++)
+		pthread_join(threads->workers[i].handle, NULL);
+	
+	pthread_cond_destroy(&threads->start);
+	pthread_mutex_destroy(&threads->mutex);
+	free(threads->workers);
+	free(threads->shares);
+	free(threads);
+}
+
+void
+cpThreadsRun(cpThreads *threads, cpThreadsFunc func, void *data)
+{
+	if(threads->count == 1){
+		func(data, 0, 1);
+		return;
+	}
+	
+	pthread_mutex_lock(&threads->mutex);
+	threads->func = func;
+	threads->data = data;
+	threads->pending = threads->count - 1;
+	threads->generation++;
+	pthread_cond_broadcast(&threads->start);
+	pthread_mutex_unlock(&threads->mutex);
+	
+	func(data, 0, threads->count);
+	
+	for(int i=0; __atomic_load_n(&threads->pending, __ATOMIC_ACQUIRE); i++){
+		if(i >= SPIN_COUNT) sched_yield();
+	}
+}
+
+void
+cpThreadsBarrier(cpThreads *threads)
+{
+	if(threads->count == 1) return;
+	
+	int generation = __atomic_load_n(&threads->barrierGeneration, __ATOMIC_ACQUIRE);
+	if(__atomic_add_fetch(&threads->barrierCount, 1, __ATOMIC_ACQ_REL) == threads->count){
+		__atomic_store_n(&threads->barrierCount, 0, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&threads->barrierGeneration, 1, __ATOMIC_RELEASE);
+	} else {
+		spinWait(&threads->barrierGeneration, generation);
+	}
+}
+
+typedef struct forContext{
+	cpThreads *threads;
+	int count, grain;
+	cpJobFunc func;
+	void *data;
+} forContext;
+
+// Run the chunks left in a share. Also used to steal from other threads.
+static void
+runShare(forContext *context, forShare *share, int thread)
+{
+	for(;;){
+		int chunk = __atomic_fetch_add(&share->next, 1, __ATOMIC_RELAXED);
+		if(chunk >= share->end) break;
+		
+		int start = chunk*context->grain;
+		int end = start + context->grain;
+		context->func(context->data, start, (end < context->count ? end : context->count), thread);
+	}
+}
+
+static void
+forThread(void *data, int thread, int count)
+{
+	forContext *context = (forContext *)data;
+	forShare *shares = context->threads->shares;
+	
+	// Finish our own share first, then steal from the following threads.
+	for(int i=0; i<count; i++)
+		runShare(context, &shares[(thread + i)%count], thread);
+}
+
+void
+cpThreadsParallelFor(cpThreads *threads, int count, int grain, cpJobFunc func, void *data)
+{
+	int numChunks = (count + grain - 1)/grain;
+	if(numChunks <= 1 || threads->count == 1){
+		runChunks(count, grain, func, data);
+		return;
+	}
+	
+	for(int i=0; i<threads->count; i++){
+		threads->shares[i].next = numChunks*i/threads->count;
+		threads->shares[i].end = numChunks*(i + 1)/threads->count;
+	}
+	
+	forContext context = {threads, count, grain, func, data};
+	cpThreadsRun(threads, forThread, &context);
+}
+
+#else
+
+// Single threaded fallback.
+struct cpThreads{
+	cpJobSystem jobs;
+	int count;
+};
+
+cpThreads *
+cpThreadsNew(int count)
+{
+	cpThreads *threads = (cpThreads *)malloc(sizeof(cpThreads));
+	threads->count = 1;
+	
+	initJobSystem(&threads->jobs, threads->count);
+	return threads;
+}
+
+void
+cpThreadsFree(cpThreads *threads)
+{
+	free(threads);
+}
+
+void
+cpThreadsRun(cpThreads *threads, cpThreadsFunc func, void *data)
+{
+	func(data, 0, 1);
+}
+
+void cpThreadsBarrier(cpThreads *threads){}
+
+void
+cpThreadsParallelFor(cpThreads *threads, int count, int grain, cpJobFunc func, void *data)
+{
+	runChunks(count, grain, func, data);
+}
+
+#endif
+
+int
+cpThreadsCount(cpThreads *threads)
+{
+	return threads->count;
+}
+
+cpJobSystem *
+cpThreadsGetJobSystem(cpThreads *threads)
+{
+	return &threads->jobs;
+}
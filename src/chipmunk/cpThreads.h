@@ -0,0 +1,82 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Called on every thread by cpThreadsRun(). thread is in [0, count).
+typedef void (*cpThreadsFunc)(void *data, int thread, int count);
+// Called by cpJobSystem.parallelFor() for the items in [start, end).
+// thread is in [0, threadCount) and identifies the thread it's running on.
+typedef void (*cpJobFunc)(void *data, int start, int end, int thread);
+
+// Job system interface used by cpSpace to spread the work of a step across
+// threads. Use cpThreads, or plug in an engine's own job system by
+// embedding this as the first member of a struct, like cpAllocator.
+typedef struct cpJobSystem cpJobSystem;
+struct cpJobSystem{
+	// Number of threads that jobs can run on, including the calling thread.
+	int threadCount;
+	
+	// Call func for the items in [0, count), in chunks of up to grain items
+	// that start at multiples of grain. Returns once they are all done.
+	void (*parallelFor)(cpJobSystem *jobs, int count, int grain, cpJobFunc func, void *data);
+	
+	// Optional. Run func once on each of threadCount threads at the same time,
+	// with barrier() to synchronize them. Loops with many sync points (like
+	// the solver) use these instead of a parallelFor() per step if they are set.
+	void (*runTeam)(cpJobSystem *jobs, cpThreadsFunc func, void *data);
+	void (*barrier)(cpJobSystem *jobs);
+};
+
+// Call jobs->parallelFor(), or func on the calling thread if jobs is NULL.
+static inline void
+cpJobSystemParallelFor(cpJobSystem *jobs, int count, int grain, cpJobFunc func, void *data)
+{
+	if(jobs){
+		jobs->parallelFor(jobs, count, grain, func, data);
+	} else if(count > 0){
+		func(data, 0, count, 0);
+	}
+}
+
+// Minimal thread pool with work stealing used as the default cpJobSystem.
+// Threads are only created when Chipmunk is compiled with CP_USE_PTHREADS
+// defined (and linked with -pthread). Otherwise a cpThreads always has a
+// single thread and runs everything on the calling thread.
+typedef struct cpThreads cpThreads;
+
+// Basic allocation/destruction functions.
+// count is the total number of threads including the calling thread.
+cpThreads *cpThreadsNew(int count);
+void cpThreadsFree(cpThreads *threads);
+
+// Number of threads that cpThreadsRun() will use.
+int cpThreadsCount(cpThreads *threads);
+// The cpJobSystem interface of the thread pool.
+cpJobSystem *cpThreadsGetJobSystem(cpThreads *threads);
+
+// Run func on all of the threads and wait for them to finish.
+// The calling thread runs it as thread 0.
+void cpThreadsRun(cpThreads *threads, cpThreadsFunc func, void *data);
+// Wait until all of the threads running func have reached the barrier.
+// Only call this from inside a func passed to cpThreadsRun().
+void cpThreadsBarrier(cpThreads *threads);
+// Split [0, count) into chunks of grain items. Each thread starts on its
+// own share of the chunks and steals from the others when it runs out.
+void cpThreadsParallelFor(cpThreads *threads, int count, int grain, cpJobFunc func, void *data);
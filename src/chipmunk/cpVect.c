@@ -27,7 +27,7 @@
 cpFloat
 cpvlength(const cpVect v)
 {
-	return sqrt2( cpvdot(v, v) );
+	return cpfhypot(v.x, v.y);
 }
 
 cpFloat
@@ -39,25 +39,30 @@ cpvlengthsq(const cpVect v)
 cpVect
 cpvnormalize(const cpVect v)
 {
-	return cpvmult( v, 1.0f/cpvlength(v) );
+#ifdef CP_USE_FIXED
+	// A reciprocal would only keep a few bits for long vectors.
+	cpFloat len = cpfhypot(v.x, v.y);
+	return cpv(cpfdiv(v.x, len), cpfdiv(v.y, len));
+#else
+	return cpvmult( v, cpfrsqrt(cpvdot(v, v)) );
+#endif
 }
 
 cpVect
 cpvforangle(const cpFloat a)
 {
-	return cpv(cos(a), sin(a));
+	return cpv(cpfcos(a), cpfsin(a));
 }
 
 cpFloat
 cpvtoangle(const cpVect v)
 {
-	return atan2(v.x, v.y);
+	return cpfatan2(v.x, v.y);
 }
 
 char*
-cpvstr(const cpVect v)
+cpvstr(const cpVect v, char *str, size_t size)
 {
-	static char str[256];
-	sprintf(str, "(% .3f, % .3f)", v.x, v.y);
+	snprintf(str, size, "(% .3f, % .3f)", cpftodouble(v.x), cpftodouble(v.y));
 	return str;
 }
@@ -53,19 +53,19 @@ cpvsub(const cpVect v1, const cpVect v2)
 static inline cpVect
 cpvmult(const cpVect v, const cpFloat s)
 {
-	return cpv(v.x*s, v.y*s);
+	return cpv(cpfmul(v.x, s), cpfmul(v.y, s));
 }
 
 static inline cpFloat
 cpvdot(const cpVect v1, const cpVect v2)
 {
-	return v1.x*v2.x + v1.y*v2.y;
+	return cpfmul2(v1.x, v2.x, v1.y, v2.y);
 }
 
 static inline cpFloat
 cpvcross(const cpVect v1, const cpVect v2)
 {
-	return v1.x*v2.y - v1.y*v2.x;
+	return cpfmul2(v1.x, v2.y, -v1.y, v2.x);
 }
 
 static inline cpVect
@@ -83,19 +83,26 @@ cpvrperp(const cpVect v)
 static inline cpVect
 cpvproject(const cpVect v1, const cpVect v2)
 {
-	return cpvmult(v2, cpvdot(v1, v2)/cpvdot(v2, v2));
+	return cpvmult(v2, cpfdiv(cpvdot(v1, v2), cpvdot(v2, v2)));
 }
 
 static inline cpVect
 cpvrotate(const cpVect v1, const cpVect v2)
 {
-	return cpv(v1.x*v2.x - v1.y*v2.y, v1.x*v2.y + v1.y*v2.x);
+	return cpv(cpfmul(v1.x, v2.x) - cpfmul(v1.y, v2.y), cpfmul(v1.x, v2.y) + cpfmul(v1.y, v2.x));
 }
 
 static inline cpVect
 cpvunrotate(const cpVect v1, const cpVect v2)
 {
-	return cpv(v1.x*v2.x + v1.y*v2.y, v1.y*v2.x - v1.x*v2.y);
+	return cpv(cpfmul(v1.x, v2.x) + cpfmul(v1.y, v2.y), cpfmul(v1.y, v2.x) - cpfmul(v1.x, v2.y));
+}
+
+// Linear interpolation from v1 (t = 0) to v2 (t = 1).
+static inline cpVect
+cpvlerp(const cpVect v1, const cpVect v2, const cpFloat t)
+{
+	return cpvadd(v1, cpvmult(cpvsub(v2, v1), t));
 }
 
 cpFloat cpvlength(const cpVect v);
@@ -103,4 +110,4 @@ cpFloat cpvlengthsq(const cpVect v); // no sqrt() call
 cpVect cpvnormalize(const cpVect v);
 cpVect cpvforangle(const cpFloat a); // convert radians to a normalized vector
 cpFloat cpvtoangle(const cpVect v); // convert a vector to radians
-char *cpvstr(const cpVect v); // get a string representation of a vector
+char *cpvstr(const cpVect v, char *str, size_t size); // write a string representation of a vector to str